@@ -15,12 +15,17 @@ LOCAL_SRC_FILES:= \
 	u300-ril.c \
 	u300-ril-manager.c \
 	u300-ril-callhandling.c \
+	u300-ril-calltimeline.c \
 	u300-ril-messaging.c \
 	u300-ril-network.c \
 	u300-ril-pdp.c \
+	u300-ril-pdpstats.c \
+	u300-ril-dormancy.c \
 	u300-ril-requestdatahandler.c \
 	u300-ril-services.c \
 	u300-ril-sim.c \
+	u300-ril-simcache.c \
+	u300-ril-lchannel.c \
 	u300-ril-stk.c \
 	u300-ril-audio.c \
 	u300-ril-information.c \
@@ -91,6 +96,16 @@ else
 LOCAL_CFLAGS += -DRIL_MAX_MTU=1500
 endif
 
+# Fast dormancy is only used if the AT command that makes the modem release
+# the signalling connection is given in RIL_FAST_DORMANCY_COMMAND.
+ifneq ($(RIL_FAST_DORMANCY_COMMAND),)
+LOCAL_CFLAGS += -DRIL_FAST_DORMANCY_COMMAND=\"$(RIL_FAST_DORMANCY_COMMAND)\"
+endif
+
+ifneq ($(RIL_FAST_DORMANCY_IDLE_MS),)
+LOCAL_CFLAGS += -DRIL_FAST_DORMANCY_IDLE_MS=$(RIL_FAST_DORMANCY_IDLE_MS)
+endif
+
 ifneq ($(USE_LEGACY_SAT_AT_CMDS),)
 LOCAL_CFLAGS += -DUSE_LEGACY_SAT_AT_CMDS
 endif
@@ -19,6 +19,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdarg.h>
 
 /**
  * Starts tokenizing an AT response string.
@@ -248,4 +249,194 @@ int at_tok_charcounter(char *p_in, char needle, int *p_out)
 
     *p_out = num_found;
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Tokens of a line split by at_tok_scan(), with the schema field each
+ * token was matched to.
+ */
+struct scanState {
+    char *tok[AT_TOK_MAX_FIELDS];
+    char quoted[AT_TOK_MAX_FIELDS];
+    int ntok;
+    int match[AT_TOK_MAX_FIELDS];
+};
+
+static int isSchemaField(char c)
+{
+    return c == 'd' || c == 'x' || c == 's' || c == '_';
+}
+
+/* Returns the position after the ']' closing the group at s. */
+static const char *groupEnd(const char *s)
+{
+    int depth = 0;
+
+    for (; *s != '\0'; s++) {
+        if (*s == '[')
+            depth++;
+        else if (*s == ']' && --depth == 0)
+            return s + 1;
+    }
+    return NULL;
+}
+
+static int fieldMatches(char type, const char *tok, int quoted)
+{
+    char *end;
+
+    switch (type) {
+    case 'd':
+        /* Numeric parameters are never quoted, which tells them from <lac> */
+        if (quoted)
+            return 0;
+        strtol(tok, &end, 10);
+        break;
+    case 'x':
+        strtoul(tok, &end, 16);
+        break;
+    default:
+        return 1;
+    }
+
+    if (end == tok)
+        return 0;
+
+    while (*end != '\0' && isspace(*end))
+        end++;
+    return *end == '\0';
+}
+
+/*
+ * Match the tokens from tok onwards against the schema from s onwards.
+ * Optional groups are tried present first, so the longest interpretation
+ * wins. field is the ordinal of the next field in the schema.
+ */
+static int matchSchema(struct scanState *st, const char *s, int field, int tok)
+{
+    const char *after;
+
+    for (;;) {
+        switch (*s) {
+        case '\0':
+            return tok == st->ntok;
+
+        case '[':
+            after = groupEnd(s);
+            if (after == NULL)
+                return 0;
+
+            if (matchSchema(st, s + 1, field, tok))
+                return 1;
+
+            /* The group is absent. */
+            for (; s != after; s++)
+                if (isSchemaField(*s))
+                    st->match[field++] = -1;
+            break;
+
+        case 'd':
+        case 'x':
+        case 's':
+        case '_':
+            if (tok >= st->ntok || field >= AT_TOK_MAX_FIELDS ||
+                !fieldMatches(*s, st->tok[tok], st->quoted[tok]))
+                return 0;
+            st->match[field++] = tok++;
+            s++;
+            break;
+
+        default:
+            /* ',', ']' and spaces only make the schema readable. */
+            s++;
+            break;
+        }
+    }
+}
+
+/**
+ * Parses the rest of an AT response line according to a schema, in one pass
+ * and without allocating memory.
+ *
+ * The schema lists one character per parameter, optionally separated by
+ * commas:
+ *   d  decimal integer, must not be quoted, stored in an int
+ *   x  hexadecimal integer, quoted or not, stored in an int
+ *   s  string, stored as a char * pointing into the line
+ *   _  any parameter, which is skipped
+ * Parameters within [ and ] are optional and groups can be nested, e.g.
+ * "[_,]d[,x,x[,d]]" for "+CGREG: [<n>,]<stat>[,<lac>,<ci>[,<AcT>]]".
+ *
+ * One pointer is passed for each parameter other than '_'. Pointers of
+ * absent parameters are left untouched, so they can be preset to defaults.
+ *
+ * Returns -1 if the line does not match the schema, otherwise a mask with
+ * bit n set if the n:th field of the schema, counting '_', was present.
+ * Updates *p_cur.
+ */
+int at_tok_scan(char **p_cur, const char *schema, ...)
+{
+    struct scanState st;
+    void *out[AT_TOK_MAX_FIELDS];
+    const char *s;
+    int nout = 0;
+    int field = 0;
+    int present = 0;
+    va_list ap;
+
+    if (*p_cur == NULL || schema == NULL)
+        return -1;
+
+    va_start(ap, schema);
+    for (s = schema; *s != '\0'; s++) {
+        if (*s == 'd' || *s == 'x' || *s == 's') {
+            if (nout == AT_TOK_MAX_FIELDS) {
+                va_end(ap);
+                return -1;
+            }
+            out[nout++] = va_arg(ap, void *);
+        }
+    }
+    va_end(ap);
+
+    for (st.ntok = 0; at_tok_hasmore(p_cur); st.ntok++) {
+        if (st.ntok == AT_TOK_MAX_FIELDS)
+            return -1;
+
+        skipWhiteSpace(p_cur);
+        st.quoted[st.ntok] = **p_cur == '"';
+        st.tok[st.ntok] = nextTok(p_cur);
+        if (st.tok[st.ntok] == NULL)
+            return -1;
+    }
+
+    if (!matchSchema(&st, schema, 0, 0))
+        return -1;
+
+    for (s = schema, nout = 0; *s != '\0'; s++) {
+        int tok;
+
+        if (!isSchemaField(*s))
+            continue;
+
+        tok = st.match[field];
+        if (tok >= 0)
+            present |= 1 << field;
+        field++;
+
+        if (*s == '_')
+            continue;
+
+        if (tok >= 0) {
+            if (*s == 'd')
+                *(int *) out[nout] = (int) strtol(st.tok[tok], NULL, 10);
+            else if (*s == 'x')
+                *(int *) out[nout] = (int) strtoul(st.tok[tok], NULL, 16);
+            else
+                *(char **) out[nout] = st.tok[tok];
+        }
+        nout++;
+    }
+
+    return present;
+}
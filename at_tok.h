@@ -33,6 +33,11 @@ int at_tok_hasmore(char **p_cur);
 
 int at_tok_charcounter(char *p_in, char needle, int *p_out);
 
+/* Most parameters handled by at_tok_scan() */
+#define AT_TOK_MAX_FIELDS 16
+
+int at_tok_scan(char **p_cur, const char *schema, ...);
+
 #ifdef __cplusplus
 }
 #endif
@@ -65,6 +65,20 @@ enum eolresult {
     EOL_NOTFOUND = 2
 };
 
+/* Classification of a line, made by findNextEOL() while framing it. */
+enum lineclass {
+    LINE_OTHER = 0,             /* Intermediate response or unsolicited. */
+    LINE_FINAL_OK,
+    LINE_FINAL_ERROR,
+    LINE_SMS_UNSOLICITED,       /* First line of a two-line SMS unsolicited. */
+    LINE_SMS_PROMPT
+};
+
+struct lineinfo {
+    enum lineclass type;
+    int errorCode;              /* +CME/+CMS ERROR code, -1 if none. */
+};
+
 struct atcontext {
     pthread_t tid_reader;
     int fd;                     /* fd of the AT channel. */
@@ -287,80 +301,80 @@ static void addIntermediate(const char *line)
 
 
 /**
- * Returns 1 if line is a final response indicating error.
- * See 27.007 annex B.
- * WARNING: NO CARRIER and others are sometimes unsolicited.
- */
-static const char *s_finalResponsesError[] = {
-    "ERROR",
-    "+CMS ERROR:",
-    "+CME ERROR:",
-    "NO CARRIER",               /* Sometimes! */
-    "NO ANSWER",
-    "NO DIALTONE",
-};
-
-static int isFinalResponseError(const char *line)
-{
-    size_t i;
-
-    for (i = 0; i < NUM_ELEMS(s_finalResponsesError); i++)
-        if (strStartsWith(line, s_finalResponsesError[i]))
-            return 1;
-
-    return 0;
-}
-
-/**
- * Returns 1 if line is a final response indicating success.
- * See 27.007 annex B.
+ * Classifies a line from its first characters, the line may still be
+ * terminated by CR or LF rather than NUL.
+ *
+ * Final responses, see 27.007 annex B:
+ *   success: "OK", "CONNECT" (some stacks start up data on another channel)
+ *   error:   "ERROR", "+CMS ERROR:", "+CME ERROR:", "NO CARRIER",
+ *            "NO ANSWER", "NO DIALTONE"
  * WARNING: NO CARRIER and others are sometimes unsolicited.
+ *
+ * "+CMT:", "+CDS:" and "+CBM:" are the first line in (what will be) a
+ * two-line SMS unsolicited response.
+ *
+ * "> " is the SMS prompt, also when the modem terminates it by CR or LF.
  */
-static const char *s_finalResponsesSuccess[] = {
-    "OK",
-    "CONNECT"    /* Some stacks start up data on another channel. */
-};
-
-static int isFinalResponseSuccess(const char *line)
-{
-    size_t i;
-
-    for (i = 0; i < NUM_ELEMS(s_finalResponsesSuccess); i++)
-        if (strStartsWith(line, s_finalResponsesSuccess[i]))
-            return 1;
-
-    return 0;
-}
-
-
-/**
- * Returns 1 if line is the first line in (what will be) a two-line
- * SMS unsolicited response.
- */
-static const char *s_smsUnsoliciteds[] = {
-    "+CMT:",
-    "+CDS:",
-    "+CBM:"
-};
-
-static int isSMSUnsolicited(const char *line)
+static void classifyLine(const char *line, struct lineinfo *info)
 {
-    size_t i;
-
-    for (i = 0; i < NUM_ELEMS(s_smsUnsoliciteds); i++)
-        if (strStartsWith(line, s_smsUnsoliciteds[i]))
-            return 1;
+    info->type = LINE_OTHER;
+    info->errorCode = -1;
+
+    switch (line[0]) {
+    case '>':
+        if (line[1] == ' ' &&
+            (line[2] == '\0' || line[2] == '\r' || line[2] == '\n'))
+            info->type = LINE_SMS_PROMPT;
+        break;
+    case 'O':
+        if (line[1] == 'K')
+            info->type = LINE_FINAL_OK;
+        break;
+    case 'C':
+        if (strStartsWith(line, "CONNECT"))
+            info->type = LINE_FINAL_OK;
+        break;
+    case 'E':
+        if (strStartsWith(line, "ERROR"))
+            info->type = LINE_FINAL_ERROR;
+        break;
+    case 'N':
+        if (strStartsWith(line, "NO CARRIER") ||
+            strStartsWith(line, "NO ANSWER") ||
+            strStartsWith(line, "NO DIALTONE"))
+            info->type = LINE_FINAL_ERROR;
+        break;
+    case '+':
+        if (line[1] != 'C')
+            break;
 
-    return 0;
+        if (strStartsWith(line + 2, "MS ERROR:") ||
+            strStartsWith(line + 2, "ME ERROR:")) {
+            char *end;
+            long code = strtol(line + 11, &end, 10);
+
+            info->type = LINE_FINAL_ERROR;
+            if (end != line + 11)
+                info->errorCode = (int) code;
+        } else if (strStartsWith(line + 2, "MT:") ||
+                   strStartsWith(line + 2, "DS:") ||
+                   strStartsWith(line + 2, "BM:"))
+            info->type = LINE_SMS_UNSOLICITED;
+        break;
+    default:
+        break;
+    }
 }
 
 
 /** Assumes commandmutex is held. */
-static void handleFinalResponse(const char *line)
+static void handleFinalResponse(const char *line,
+                                const struct lineinfo *info)
 {
     struct atcontext *ac = getAtContext();
 
     ac->response->finalResponse = strdup(line);
+    ac->response->finalErrorCode = info->errorCode;
 
     pthread_cond_signal(&ac->commandcond);
 }
@@ -373,7 +387,7 @@ static void handleUnsolicited(const char *line)
         ac->unsolHandler(line, NULL);
 }
 
-static void processLine(const char *line)
+static void processLine(const char *line, const struct lineinfo *info)
 {
     struct atcontext *ac = getAtContext();
 
@@ -382,13 +396,13 @@ static void processLine(const char *line)
     if (ac->response == NULL)
         /* No command pending. */
         handleUnsolicited(line);
-    else if (isFinalResponseSuccess(line)) {
+    else if (info->type == LINE_FINAL_OK) {
         ac->response->success = 1;
-        handleFinalResponse(line);
-    } else if (isFinalResponseError(line)) {
+        handleFinalResponse(line, info);
+    } else if (info->type == LINE_FINAL_ERROR) {
         ac->response->success = 0;
-        handleFinalResponse(line);
-    } else if (ac->smsPDU != NULL && 0 == strcmp(line, "> ")) {
+        handleFinalResponse(line, info);
+    } else if (ac->smsPDU != NULL && info->type == LINE_SMS_PROMPT) {
         /* See eg. TS 27.005 4.3.
            Commands like AT+CMGS have a "> " prompt. */
         writeCtrlZ(ac->smsPDU);
@@ -442,6 +456,7 @@ static void processLine(const char *line)
 /**
  * Returns a pointer to the end of the next line,
  * special-cases the "> " SMS prompt.
+ * Complete lines are also classified into *p_info.
  *
  * returns NULL if there is no complete line.
  *
@@ -458,13 +473,17 @@ static void processLine(const char *line)
  * |  End   |     '--------->| Error  |<-----------------'
  * '--------'                '--------'
  */
-static char *findNextEOL(char *cur, enum eolresult *p_eolres)
+static char *findNextEOL(char *cur, enum eolresult *p_eolres,
+                         struct lineinfo *p_info)
 {
     char c;
+    char *start = cur;
     enum State {NORMAL, ERROR, END, STRING, ESCAPE} state = NORMAL;
 
     if (cur[0] == '>' && cur[1] == ' ' && cur[2] == '\0') {
         *p_eolres = EOL_SMS;
+        p_info->type = LINE_SMS_PROMPT;
+        p_info->errorCode = -1;
         return cur + 2;
     }
 
@@ -527,6 +546,7 @@ static char *findNextEOL(char *cur, enum eolresult *p_eolres)
         return NULL;
     } else {
         *p_eolres = EOL_FOUND;
+        classifyLine(start, p_info);
         /*
          * In End state, cur increment once too much, therefore we need to
          * decrease it before returning.
@@ -545,7 +565,7 @@ static char *findNextEOL(char *cur, enum eolresult *p_eolres)
  * have buffered stdio.
  */
 
-static const char *readline()
+static const char *readline(struct lineinfo *p_info)
 {
     ssize_t count;
     enum eolresult eolres = EOL_NOTFOUND;
@@ -573,7 +593,7 @@ static const char *readline()
         while (*ac->ATBufferCur == '\r' || *ac->ATBufferCur == '\n')
             ac->ATBufferCur++;
 
-        p_eol = findNextEOL(ac->ATBufferCur, &eolres);
+        p_eol = findNextEOL(ac->ATBufferCur, &eolres, p_info);
 
         if (p_eol == NULL) {
             /* A partial line. Move it up and prepare to read more. */
@@ -650,7 +670,7 @@ static const char *readline()
             while (*ac->ATBufferCur == '\r' || *ac->ATBufferCur == '\n')
                 ac->ATBufferCur++;
 
-            p_eol = findNextEOL(ac->ATBufferCur, &eolres);
+            p_eol = findNextEOL(ac->ATBufferCur, &eolres, p_info);
             p_read += count;
         } else if (count <= 0) {
             /* Read error encountered or EOF reached. */
@@ -721,13 +741,14 @@ static void *readerLoop(void *arg)
 
     for (;;) {
         const char *line;
+        struct lineinfo info;
 
-        line = readline();
+        line = readline(&info);
 
         if (line == NULL)
             break;
 
-        if (isSMSUnsolicited(line)) {
+        if (info.type == LINE_SMS_UNSOLICITED) {
             char *line1;
             const char *line2;
 
@@ -735,7 +756,7 @@ static void *readerLoop(void *arg)
                until next call to 'readline()' hence making a copy of line
                before calling readline again. */
             line1 = strdup(line);
-            line2 = readline();
+            line2 = readline(&info);
 
             if (line2 == NULL) {
                 free(line1);
@@ -747,7 +768,7 @@ static void *readerLoop(void *arg)
 
             free(line1);
         } else
-            processLine(line);
+            processLine(line, &info);
     }
 
     onReaderClosed();
@@ -1041,6 +1062,7 @@ static int at_send_command_full_nolock(const char *command,
 
     ac->response = (ATResponse *) calloc(1, sizeof(ATResponse));
     assert(ac->response != NULL);
+    ac->response->finalErrorCode = -1;
 
 #ifndef USE_NP
 
@@ -1407,6 +1429,12 @@ static int at_get_error(const ATResponse *p_response,
        )
         goto error;
 
+    /* Pre-parsed by the reader when the final response was received. */
+    if (p_response->finalErrorCode >= 0) {
+        *p_errorCode = p_response->finalErrorCode;
+        return 1;
+    }
+
     p_cur = p_response->finalResponse;
     err = at_tok_start(&p_cur);
 
@@ -214,6 +214,8 @@ typedef struct {
                                success (eg "OK"). */
     char *finalResponse;    /* Eg OK, ERROR */
     ATLine *p_intermediates;    /* Any intermediate responses. */
+    int finalErrorCode;     /* +CME/+CMS ERROR code of finalResponse,
+                               -1 if none. */
 } ATResponse;
 
 /**
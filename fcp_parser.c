@@ -32,99 +32,359 @@
 #include "fcp_parser.h"
 #include "misc.h"
 
-int fcp_to_ts_51011(/*in*/ const char *stream, /*in*/ size_t len,
-        /*out*/ struct ts_51011_921_resp *out)
+/*
+ * Parse one BER-TLV data object, ISO/IEC 7816-4, 5.2.2.
+ * On success *stream is advanced past the object and tlv->data points into
+ * the parsed buffer.
+ */
+int ber_tlv_parse(/*in,out*/ const uint8_t **stream,
+                  /*in*/ const uint8_t *end,
+                  /*out*/ struct ber_tlv *tlv)
+{
+    const uint8_t *it = *stream;
+    size_t size;
+    int i;
+
+    if (it >= end)
+        return -EINVAL;
+
+    /* Tag, up to three bytes */
+    tlv->tag = *it++;
+    if ((tlv->tag & 0x1F) == 0x1F) {
+        for (i = 0; ; i++) {
+            if (it >= end || i == 2)
+                return -EINVAL;
+            tlv->tag = (tlv->tag << 8) | *it;
+            if (!(*it++ & 0x80))
+                break;
+        }
+    }
+
+    /* Length, short form or long form with up to three bytes */
+    if (it >= end)
+        return -EINVAL;
+    size = *it++;
+    if (size & 0x80) {
+        int n = size & 0x7F;
+
+        if (n == 0 || n > 3 || end - it < n)
+            return -EINVAL;
+        for (size = 0; n > 0; n--)
+            size = (size << 8) | *it++;
+    }
+
+    if ((size_t)(end - it) < size)
+        return -EINVAL;
+
+    tlv->data = it;
+    tlv->len = size;
+    *stream = it + size;
+    return 0;
+}
+
+static uint32_t be_value(const uint8_t *data, size_t len)
 {
-    const char *end = &stream[len];
-    struct tlv fcp;
-    int ret = parseTlv(stream, end, &fcp);
+    uint32_t value = 0;
+
+    while (len-- > 0)
+        value = (value << 8) | *data++;
+    return value;
+}
+
+/*
+ * Decode an FCP template, ETSI TS 102 221, 11.1.1.3, from binary data.
+ * Unknown properties are skipped. Variable length properties are returned
+ * as views into buf, which must outlive info.
+ */
+int fcp_decode(/*in*/ const uint8_t *buf, /*in*/ size_t len,
+        /*out*/ struct fcp_info *info)
+{
+    const uint8_t *it = buf;
+    const uint8_t *end = &buf[len];
+    const uint8_t *fcp_end;
+    struct ber_tlv fcp;
     const char *what = NULL;
-#define FCP_CVT_THROW(_ret, _what)  \
+    int ret;
+#define FCP_DECODE_THROW(_ret, _what)  \
     do {                    \
         ret = _ret;         \
         what = _what;       \
         goto except;        \
     } while (0)
 
+    memset(info, 0, sizeof(*info));
+
+    ret = ber_tlv_parse(&it, end, &fcp);
     if (ret < 0)
-        FCP_CVT_THROW(ret, "ETSI TS 102 221, 11.1.1.3: FCP template TLV structure");
+        FCP_DECODE_THROW(ret, "ETSI TS 102 221, 11.1.1.3: FCP template TLV structure");
     if (fcp.tag != 0x62)
-        FCP_CVT_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.3: FCP template tag");
+        FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.3: FCP template tag");
 
-    /*
-     * NOTE: Following fields do not exist in FCP template:
-     * - file_acc
-     * - file_status
-     */
+    it = fcp.data;
+    fcp_end = &fcp.data[fcp.len];
+    while (it < fcp_end) {
+        struct ber_tlv tlv;
+        uint8_t fdbyte;
 
-    memset(out, 0, sizeof(*out));
-    while (fcp.data < fcp.end) {
-        unsigned char fdbyte;
-        size_t property_size;
-        struct tlv tlv;
-        ret = parseTlv(fcp.data, end, &tlv);
+        ret = ber_tlv_parse(&it, fcp_end, &tlv);
         if (ret < 0)
-            FCP_CVT_THROW(ret, "ETSI TS 102 221, 11.1.1.3: FCP property TLV structure");
-        property_size = (tlv.end - tlv.data) / 2;
+            FCP_DECODE_THROW(ret, "ETSI TS 102 221, 11.1.1.3: FCP property TLV structure");
 
         switch (tlv.tag) {
-            case 0x80: /* File size, ETSI TS 102 221, 11.1.1.4.1 */
-                /* File size > 0xFFFF is not supported by ts_51011 */
-                if (property_size != 2)
-                    FCP_CVT_THROW(-ENOTSUP, "3GPP TS 51 011, 9.2.1: Unsupported file size");
-                /* be16 on both sides */
-                ((char*)&out->file_size)[0] = TLV_DATA(tlv, 0);
-                ((char*)&out->file_size)[1] = TLV_DATA(tlv, 1);
-                break;
-            case 0x83: /* File identifier, ETSI TS 102 221, 11.1.1.4.4 */
-                /* Sanity check */
-                if (property_size != 2)
-                    FCP_CVT_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.4: Invalid file identifier");
-                /* be16 on both sides */
-                ((char*)&out->file_id)[0] = TLV_DATA(tlv, 0);
-                ((char*)&out->file_id)[1] = TLV_DATA(tlv, 1);
-                break;
-            case 0x82: /* File descriptior, ETSI TS 102 221, 11.1.1.4.3 */
-                /* Sanity check */
-                if (property_size < 2)
-                    FCP_CVT_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.3: Invalid file descriptor");
-                fdbyte = TLV_DATA(tlv, 0);
-                /* ETSI TS 102 221, Table 11.5 for FCP fields */
-                /* 3GPP TS 51 011, 9.2.1 and 9.3 for 'out' fields */
+            case 0x82: /* File descriptor, ETSI TS 102 221, 11.1.1.4.3 */
+                if (tlv.len < 2)
+                    FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.3: Invalid file descriptor");
+                fdbyte = tlv.data[0];
+                info->present |= FCP_HAS_DESCRIPTOR;
+                info->descriptor = fdbyte;
+                info->data_coding = tlv.data[1];
+                info->shareable = (fdbyte & 0x40) ? 1 : 0;
+                /* ETSI TS 102 221, Table 11.5 */
                 if ((fdbyte & 0xBF) == 0x38) {
-                    out->file_type = 2; /* DF of ADF */
+                    info->file_type = FCP_FILE_TYPE_DF;
                 } else if ((fdbyte & 0xB0) == 0x00) {
-                    out->file_type = 4; /* EF */
-                    out->file_status = 1; /* Not invalidated */
-                    ++out->data_size; /* file_structure field is valid */
-                    if ((fdbyte & 0x07) == 0x01) {
-                        out->file_structure = 0; /* Transparent */
-                    } else {
-                        if (property_size < 5)
-                            FCP_CVT_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.3: Invalid non-transparent file descriptor");
-                        ++out->data_size; /* record_size field is valid */
-                        out->record_size = TLV_DATA(tlv, 3);
-                        if ((fdbyte & 0x07) == 0x06) {
-                            out->file_structure = 3; /* Cyclic */
-                        } else if ((fdbyte & 0x07) == 0x02) {
-                            out->file_structure = 1; /* Linear fixed */
-                        } else {
-                            FCP_CVT_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.3: Invalid file structure");
-                        }
+                    info->file_type = FCP_FILE_TYPE_EF;
+                    switch (fdbyte & 0x07) {
+                        case 0x01:
+                            info->structure = FCP_EF_TRANSPARENT;
+                            break;
+                        case 0x02:
+                            info->structure = FCP_EF_LINEAR_FIXED;
+                            break;
+                        case 0x06:
+                            info->structure = FCP_EF_CYCLIC;
+                            break;
+                        default:
+                            FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.3: Invalid file structure");
+                    }
+                    if (info->structure != FCP_EF_TRANSPARENT) {
+                        if (tlv.len < 5)
+                            FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.3: Invalid non-transparent file descriptor");
+                        info->record_size = be_value(&tlv.data[2], 2);
+                        info->num_records = tlv.data[4];
                     }
-                } else {
-                    out->file_type = 0; /* RFU */
+                } else if ((fdbyte & 0xBF) == 0x39) {
+                    info->file_type = FCP_FILE_TYPE_EF;
+                    info->structure = FCP_EF_BER_TLV;
                 }
                 break;
+            case 0x83: /* File identifier, ETSI TS 102 221, 11.1.1.4.4 */
+                if (tlv.len != 2)
+                    FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.4: Invalid file identifier");
+                info->present |= FCP_HAS_FILE_ID;
+                info->file_id = be_value(tlv.data, 2);
+                break;
+            case 0x84: /* DF name (AID), ETSI TS 102 221, 11.1.1.4.5 */
+                if (tlv.len < 1 || tlv.len > 16)
+                    FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.5: Invalid DF name");
+                info->present |= FCP_HAS_DF_NAME;
+                info->df_name.data = tlv.data;
+                info->df_name.len = tlv.len;
+                break;
+            case 0xA5: /* Proprietary information, ETSI TS 102 221, 11.1.1.4.6 */
+                info->present |= FCP_HAS_PROPRIETARY;
+                info->proprietary.data = tlv.data;
+                info->proprietary.len = tlv.len;
+                break;
+            case 0x8A: /* Life cycle status, ETSI TS 102 221, 11.1.1.4.9 */
+                if (tlv.len != 1)
+                    FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.9: Invalid life cycle status");
+                info->present |= FCP_HAS_LIFE_CYCLE;
+                info->life_cycle = tlv.data[0];
+                break;
+            case 0x8B: /* Security attributes, ETSI TS 102 221, 11.1.1.4.7 */
+            case 0x8C:
+            case 0xAB:
+                info->present |= FCP_HAS_SECURITY;
+                info->security_tag = tlv.tag;
+                info->security.data = tlv.data;
+                info->security.len = tlv.len;
+                break;
+            case 0xC6: /* PIN status template DO, ETSI TS 102 221, 11.1.1.4.10 */
+                info->present |= FCP_HAS_PIN_STATUS;
+                info->pin_status.data = tlv.data;
+                info->pin_status.len = tlv.len;
+                break;
+            case 0x80: /* File size, ETSI TS 102 221, 11.1.1.4.1 */
+                if (tlv.len < 1 || tlv.len > 4)
+                    FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.1: Invalid file size");
+                info->present |= FCP_HAS_FILE_SIZE;
+                info->file_size = be_value(tlv.data, tlv.len);
+                break;
+            case 0x81: /* Total file size, ETSI TS 102 221, 11.1.1.4.2 */
+                if (tlv.len < 1 || tlv.len > 4)
+                    FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.2: Invalid total file size");
+                info->present |= FCP_HAS_TOTAL_SIZE;
+                info->total_size = be_value(tlv.data, tlv.len);
+                break;
+            case 0x88: /* Short file identifier, ETSI TS 102 221, 11.1.1.4.8 */
+                if (tlv.len > 1)
+                    FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.4.8: Invalid short file identifier");
+                info->present |= FCP_HAS_SFI;
+                /* Empty means the file has no SFI */
+                info->sfi = tlv.len ? tlv.data[0] >> 3 : 0;
+                break;
         }
-        fcp.data = tlv.end;
+    }
+
+    if (info->file_type == FCP_FILE_TYPE_EF && !(info->present & FCP_HAS_FILE_SIZE)) {
+        if (info->structure == FCP_EF_TRANSPARENT || info->structure == FCP_EF_BER_TLV)
+            FCP_DECODE_THROW(-EINVAL, "ETSI TS 102 221, 11.1.1.3: Missing file size");
+        info->file_size = (uint32_t)info->record_size * info->num_records;
     }
 
  finally:
     return ret;
 
  except:
- #undef FCP_CVT_THROW
-    LOGE("FCP to TS 510 11: Specification violation: %s.", what);
+ #undef FCP_DECODE_THROW
+    LOGE("FCP decode: Specification violation: %s.", what);
     goto finally;
 }
+
+/*
+ * Convert a decoded FCP template to the GET RESPONSE layout of
+ * 3GPP TS 51.011, 9.2.1. Files larger than 0xFFFF bytes are reported with
+ * the largest size the 2G layout can hold.
+ */
+int fcp_info_to_ts_51011(/*in*/ const struct fcp_info *info,
+        /*out*/ struct ts_51011_921_resp *out)
+{
+    uint32_t file_size = info->file_size;
+
+    /*
+     * NOTE: The access conditions of the security attributes can not be
+     * expressed in the 2G layout, file_acc is left as ALW.
+     */
+
+    memset(out, 0, sizeof(*out));
+    out->file_id = htobe16(info->file_id);
+
+    switch (info->file_type) {
+        case FCP_FILE_TYPE_DF:
+            /* 3GPP TS 51 011, 9.3: MF or DF */
+            out->file_type = info->file_id == 0x3F00 ? 1 : 2;
+            break;
+        case FCP_FILE_TYPE_EF:
+            if (info->structure == FCP_EF_BER_TLV) {
+                /* No 2G equivalent, ETSI TS 102 221, Table 11.5 */
+                out->file_type = 0; /* RFU */
+                break;
+            }
+            out->file_type = 4;
+            /*
+             * Operational state deactivated and termination state map to
+             * invalidated, ETSI TS 102 221, Table 11.6.
+             */
+            if (!(info->present & FCP_HAS_LIFE_CYCLE) ||
+                ((info->life_cycle & 0xFD) != 0x04 &&
+                 (info->life_cycle & 0xFC) != 0x0C))
+                out->file_status = 1; /* Not invalidated */
+            ++out->data_size; /* file_structure field is valid */
+            switch (info->structure) {
+                case FCP_EF_TRANSPARENT:
+                    out->file_structure = 0;
+                    break;
+                case FCP_EF_LINEAR_FIXED:
+                case FCP_EF_CYCLIC:
+                    if (info->record_size > 0xFF) {
+                        LOGE("FCP to TS 510 11: Unsupported record size %u.",
+                             info->record_size);
+                        return -ENOTSUP;
+                    }
+                    ++out->data_size; /* record_size field is valid */
+                    out->record_size = info->record_size;
+                    out->file_structure =
+                        info->structure == FCP_EF_CYCLIC ? 3 : 1;
+                    break;
+                default:
+                    LOGE("FCP to TS 510 11: Unsupported file structure.");
+                    return -ENOTSUP;
+            }
+            break;
+        default:
+            out->file_type = 0; /* RFU */
+            break;
+    }
+
+    if (file_size > 0xFFFF) {
+        LOGW("FCP to TS 510 11: File size %u truncated.", file_size);
+        file_size = 0xFFFF;
+    }
+    out->file_size = htobe16(file_size);
+
+    return 0;
+}
+
+/*
+ * Fill the fields of struct fcp_info that a 3GPP TS 51.011, 9.2.1 GET
+ * RESPONSE carries, so that 2G and 3G responses can be handled alike.
+ */
+int ts_51011_to_fcp_info(/*in*/ const uint8_t *buf, /*in*/ size_t len,
+        /*out*/ struct fcp_info *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    if (len < 7)
+        return -EINVAL;
+
+    info->present = FCP_HAS_FILE_ID | FCP_HAS_FILE_SIZE;
+    info->file_size = be_value(&buf[2], 2);
+    info->file_id = be_value(&buf[4], 2);
+
+    switch (buf[6]) {
+        case 1: /* MF */
+        case 2: /* DF */
+            info->file_type = FCP_FILE_TYPE_DF;
+            break;
+        case 4: /* EF */
+            if (len < 14)
+                return -EINVAL;
+            info->file_type = FCP_FILE_TYPE_EF;
+            switch (buf[13]) {
+                case 0:
+                    info->structure = FCP_EF_TRANSPARENT;
+                    break;
+                case 1:
+                case 3:
+                    if (len < 15)
+                        return -EINVAL;
+                    info->structure = buf[13] == 1 ? FCP_EF_LINEAR_FIXED
+                                                   : FCP_EF_CYCLIC;
+                    info->record_size = buf[14];
+                    if (info->record_size)
+                        info->num_records = info->file_size / info->record_size;
+                    break;
+                default:
+                    return -EINVAL;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+int fcp_to_ts_51011(/*in*/ const char *stream, /*in*/ size_t len,
+        /*out*/ struct ts_51011_921_resp *out)
+{
+    uint8_t buf[FCP_MAX_SIZE];
+    struct fcp_info info;
+    int ret;
+
+    if ((len & 1) || len / 2 > sizeof(buf)) {
+        LOGE("FCP to TS 510 11: Invalid FCP length %u.", (unsigned) len);
+        return -EINVAL;
+    }
+
+    ret = stringToBinary(stream, len, buf);
+    if (ret < 0)
+        return ret;
+
+    ret = fcp_decode(buf, len / 2, &info);
+    if (ret < 0)
+        return ret;
+
+    return fcp_info_to_ts_51011(&info, out);
+}
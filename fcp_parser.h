@@ -24,6 +24,7 @@
 #ifndef FCP_PARSER_H
 #define FCP_PARSER_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <endian.h>
 
@@ -40,6 +41,84 @@ struct ts_51011_921_resp {
     uint8_t   record_size;
 } __attribute__((packed));
 
+/* Largest FCP template handled, the maximum response of a short APDU */
+#define FCP_MAX_SIZE                256
+
+/* Properties found in the FCP template, see struct fcp_info.present */
+#define FCP_HAS_DESCRIPTOR          (1 << 0)
+#define FCP_HAS_FILE_ID             (1 << 1)
+#define FCP_HAS_DF_NAME             (1 << 2)
+#define FCP_HAS_PROPRIETARY         (1 << 3)
+#define FCP_HAS_LIFE_CYCLE          (1 << 4)
+#define FCP_HAS_SECURITY            (1 << 5)
+#define FCP_HAS_PIN_STATUS          (1 << 6)
+#define FCP_HAS_FILE_SIZE           (1 << 7)
+#define FCP_HAS_TOTAL_SIZE          (1 << 8)
+#define FCP_HAS_SFI                 (1 << 9)
+
+enum fcp_file_type {
+    FCP_FILE_TYPE_UNKNOWN = 0,
+    FCP_FILE_TYPE_EF,
+    FCP_FILE_TYPE_DF,           /* DF or ADF */
+};
+
+enum fcp_ef_structure {
+    FCP_EF_NONE = 0,
+    FCP_EF_TRANSPARENT,
+    FCP_EF_LINEAR_FIXED,
+    FCP_EF_CYCLIC,
+    FCP_EF_BER_TLV,
+};
+
+/* A view into the buffer that was decoded, nothing is copied */
+struct fcp_view {
+    const uint8_t *data;
+    size_t         len;
+};
+
+struct ber_tlv {
+    unsigned       tag;
+    const uint8_t *data;
+    size_t         len;
+};
+
+/* Decoded FCP template, ETSI TS 102 221, 11.1.1.3 */
+struct fcp_info {
+    unsigned        present;        /* FCP_HAS_* */
+    uint8_t         descriptor;     /* file descriptor byte */
+    uint8_t         data_coding;
+    uint8_t         file_type;      /* enum fcp_file_type */
+    uint8_t         structure;      /* enum fcp_ef_structure */
+    uint8_t         shareable;
+    uint16_t        record_size;
+    uint8_t         num_records;
+    uint16_t        file_id;
+    uint8_t         life_cycle;
+    uint8_t         security_tag;   /* 0x8B referenced, 0x8C compact, 0xAB expanded */
+    uint8_t         sfi;
+    uint32_t        file_size;
+    uint32_t        total_size;
+    struct fcp_view df_name;
+    struct fcp_view proprietary;
+    struct fcp_view security;
+    struct fcp_view pin_status;
+};
+
+int ber_tlv_parse(const uint8_t **stream,
+                  const uint8_t *end,
+                  struct ber_tlv *tlv);
+
+int fcp_decode(const uint8_t *buf,
+               size_t len,
+               struct fcp_info *info);
+
+int fcp_info_to_ts_51011(const struct fcp_info *info,
+                         struct ts_51011_921_resp *out);
+
+int ts_51011_to_fcp_info(const uint8_t *buf,
+                         size_t len,
+                         struct fcp_info *info);
+
 int fcp_to_ts_51011(const char *stream,
                     size_t len,
                     struct ts_51011_921_resp *out);
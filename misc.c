@@ -21,7 +21,10 @@
 ** Author: Christian Bejram <christian.bejram@stericsson.com>
 */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -43,113 +46,165 @@ int strStartsWith(const char *line, const char *prefix)
 }
 
 /**
- * Very simple function that extract and returns whats between ElementBeginTag
- * and ElementEndTag.
+ * Splits the next element off a response line, in place.
  *
- * Optional ppszRemainingDocument that can return a pointer to the remaining
- * of the document to be "scanned". This can be used if subsequent
- * scanning/searching is desired.
+ * This is used to walk the XML result returned by U3xx during a PDP Context
+ * setup, open = '<', and the tuples of operators returned from AT+COPS,
+ * open = '('.
  *
- * This function is used to extract the parameters from the XML result
- * returned by U3xx during a PDP Context setup, and used to parse the
- * tuples of operators returned from AT+COPS.
+ * For '<' the element is <name>value</name>. Elements that hold other
+ * elements, end tags and declarations are stepped over, so that the
+ * innermost elements are returned in document order. For '(' the element
+ * is (value) and name is set to NULL.
  *
- *  const char* document        - Document to be scanned
- *  const char* elementBeginTag - Begin tag to scan for, return whats
- *                                between begin/end tags
- *  const char* elementEndTag   - End tag to scan for, return whats
- *                                between begin/end tags
- *  char** remainingDocumen t   - Can return the a pointer to the remaining
- *                                of pszDocument, this parameter is optional
+ *  char **p_cur  - Position in the line, moved past the element
+ *  char open     - '<' or '('
+ *  char **name   - Element name, optional
+ *  char **value  - Element content
  *
- *  return char* containing whats between begin/end tags, allocated on the
- *               heap, need to free this.
- *               return NULL if nothing is found.
+ * return 0 on success, -1 if there is no complete element left on the line.
  */
-char *getFirstElementValue(const char *document,
-                           const char *elementBeginTag,
-                           const char *elementEndTag,
-                           char **remainingDocument)
+int nextElement(char **p_cur, char open, char **name, char **value)
 {
-    char *value = NULL;
-    char *start = NULL;
-    char *end = NULL;
-
-    if (document != NULL && elementBeginTag != NULL
-        && elementEndTag != NULL) {
-        start = strstr(document, elementBeginTag);
-        if (start != NULL) {
-            end = strstr(start, elementEndTag);
-            if (end != NULL) {
-                int n = strlen(elementBeginTag);
-                int m = end - (start + n);
-                value = (char *) malloc((m + 1) * sizeof(char));
-                strncpy(value, (start + n), m);
-                value[m] = (char) 0;
-
-                /* Optional, return a pointer to the remaining document,
-                   to be used when document contains many tags with same name. */
-                if (remainingDocument != NULL)
-                    *remainingDocument = end + strlen(elementEndTag);
-            }
+    char *cur;
+    char *tag;
+    char *close;
+    char *text;
+    char *endTag;
+    size_t len;
+
+    if (p_cur == NULL || *p_cur == NULL || value == NULL)
+        return -1;
+
+    cur = *p_cur;
+
+    if (open != '<') {
+        tag = strchr(cur, open);
+        if (tag == NULL || (close = strchr(tag + 1, ')')) == NULL)
+            return -1;
+
+        *close = '\0';
+        if (name != NULL)
+            *name = NULL;
+        *value = tag + 1;
+        *p_cur = close + 1;
+        return 0;
+    }
+
+    for (;;) {
+        tag = strchr(cur, '<');
+        if (tag == NULL || (close = strchr(tag + 1, '>')) == NULL)
+            return -1;
+
+        /* End tags, declarations, comments and empty elements */
+        if (tag[1] == '/' || tag[1] == '?' || tag[1] == '!' ||
+            close[-1] == '/') {
+            cur = close + 1;
+            continue;
+        }
+
+        text = close + 1;
+        endTag = strchr(text, '<');
+        if (endTag == NULL)
+            return -1;
+
+        /* Anything but our own end tag means an element with children. */
+        len = close - (tag + 1);
+        if (endTag[1] != '/' || strncmp(endTag + 2, tag + 1, len) != 0 ||
+            endTag[2 + len] != '>') {
+            cur = endTag;
+            continue;
         }
+
+        *close = '\0';
+        *endTag = '\0';
+        if (name != NULL)
+            *name = tag + 1;
+        *value = text;
+        *p_cur = endTag + 3 + len;
+        return 0;
     }
-    return value;
 }
 
+/*
+ * Hex digit lookup, the low nibble holds the value and HEX_VALID marks the
+ * characters that are hex digits. Invalid characters map to 0.
+ */
+#define HEX_VALID 0x10
+#define HEX_DIGIT(c, v) [c] = HEX_VALID | (v)
+
+static const unsigned char hex_values[256] = {
+    HEX_DIGIT('0', 0x0), HEX_DIGIT('1', 0x1), HEX_DIGIT('2', 0x2),
+    HEX_DIGIT('3', 0x3), HEX_DIGIT('4', 0x4), HEX_DIGIT('5', 0x5),
+    HEX_DIGIT('6', 0x6), HEX_DIGIT('7', 0x7), HEX_DIGIT('8', 0x8),
+    HEX_DIGIT('9', 0x9),
+    HEX_DIGIT('A', 0xA), HEX_DIGIT('B', 0xB), HEX_DIGIT('C', 0xC),
+    HEX_DIGIT('D', 0xD), HEX_DIGIT('E', 0xE), HEX_DIGIT('F', 0xF),
+    HEX_DIGIT('a', 0xA), HEX_DIGIT('b', 0xB), HEX_DIGIT('c', 0xC),
+    HEX_DIGIT('d', 0xD), HEX_DIGIT('e', 0xE), HEX_DIGIT('f', 0xF),
+};
+
+#undef HEX_DIGIT
+
+/* "000102...FEFF", two characters for each byte value */
+#define HEX_ROW(h) h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" \
+                   h "8" h "9" h "A" h "B" h "C" h "D" h "E" h "F"
+
+static const char hex_pairs[] =
+    HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+    HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+    HEX_ROW("8") HEX_ROW("9") HEX_ROW("A") HEX_ROW("B")
+    HEX_ROW("C") HEX_ROW("D") HEX_ROW("E") HEX_ROW("F");
+
+#undef HEX_ROW
+
 char char2nib(char c)
 {
-    if (c >= 0x30 && c <= 0x39)
-        return c - 0x30;
-
-    if (c >= 0x41 && c <= 0x46)
-        return c - 0x41 + 0xA;
-
-    if (c >= 0x61 && c <= 0x66)
-        return c - 0x61 + 0xA;
-
-    return 0;
+    return hex_values[(unsigned char) c] & 0x0F;
 }
 
+/*
+ * Convert a hex string to binary. Returns -EINVAL, with the content of
+ * binary undefined, if the string holds anything but hex digit pairs.
+ */
 int stringToBinary(/*in*/ const char *string,
                    /*in*/ size_t len,
                    /*out*/ unsigned char *binary)
 {
-    int pos;
-    const char *it;
-    const char *end = &string[len];
+    const unsigned char *it = (const unsigned char *) string;
+    const unsigned char *end = &it[len];
+    unsigned valid = HEX_VALID;
 
-    if (end < string)
+    if (end < it)
         return -EINVAL;
 
     if (len & 1)
         return -EINVAL;
 
-    for (pos = 0, it = string; it != end; ++pos, it += 2) {
-        binary[pos] = char2nib(it[0]) << 4 | char2nib(it[1]);
+    /* Validity is accumulated so that the loop body has no branches. */
+    for (; it != end; ++binary, it += 2) {
+        unsigned hi = hex_values[it[0]];
+        unsigned lo = hex_values[it[1]];
+
+        valid &= hi & lo;
+        *binary = ((hi & 0x0F) << 4) | (lo & 0x0F);
     }
-    return 0;
+    return valid ? 0 : -EINVAL;
 }
 
 int binaryToString(/*in*/ const unsigned char *binary,
                    /*in*/ size_t len,
                    /*out*/ char *string)
 {
-    int pos;
     const unsigned char *it;
     const unsigned char *end = &binary[len];
-    static const char nibbles[] =
-        {'0', '1', '2', '3', '4', '5', '6', '7',
-         '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
 
     if (end < binary)
         return -EINVAL;
 
-    for (pos = 0, it = binary; it != end; ++it, pos += 2) {
-        string[pos + 0] = nibbles[*it >> 4];
-        string[pos + 1] = nibbles[*it & 0x0f];
-    }
-    string[pos] = 0;
+    for (it = binary; it != end; ++it, string += 2)
+        memcpy(string, &hex_pairs[*it * 2], 2);
+    *string = 0;
     return 0;
 }
 
@@ -159,10 +214,14 @@ int parseTlv(/*in*/ const char *stream,
 {
 #define TLV_STREAM_GET(stream, end, p)  \
     do {                                \
+        unsigned hi, lo;                \
         if (stream + 1 >= end)          \
             goto underflow;             \
-        p = ((unsigned)char2nib(stream[0]) << 4)  \
-          | ((unsigned)char2nib(stream[1]) << 0); \
+        hi = hex_values[(unsigned char) stream[0]]; \
+        lo = hex_values[(unsigned char) stream[1]]; \
+        if (!(hi & lo & HEX_VALID))     \
+            goto underflow;             \
+        p = ((hi & 0x0F) << 4) | (lo & 0x0F); \
         stream += 2;                    \
     } while (0)
 
@@ -199,42 +258,188 @@ underflow:
  */
 int property_set_verified(const char *key, const char *value)
 {
-    int ret = -2;
-    int numChecks = 0;
-    int valuelen = 0;
+    struct property_batch batch;
+    int ret;
+
+    property_batch_init(&batch);
+    if (property_batch_add(&batch, value, "%s", key) < 0)
+        return -1;
+
+    ret = property_batch_apply(&batch);
+    if (ret < 0)
+        return ret;
+
+    return property_batch_verify(&batch);
+}
+
+void property_batch_init(struct property_batch *batch)
+{
+    batch->count = 0;
+}
+
+/**
+ * property_batch_add()
+ *
+ * Adds a property to a batch, the key is given as a printf format.
+ *
+ * Returns 0 on success, -1 if the batch is full or key or value too long.
+ */
+int property_batch_add(struct property_batch *batch, const char *value,
+                       const char *keyfmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (batch->count >= PROPERTY_BATCH_MAX ||
+        strlen(value) >= PROPERTY_VALUE_MAX)
+        return -1;
+
+    va_start(ap, keyfmt);
+    len = vsnprintf(batch->keys[batch->count], PROPERTY_KEY_MAX, keyfmt, ap);
+    va_end(ap);
+
+    if (len < 0 || len >= PROPERTY_KEY_MAX)
+        return -1;
+
+    strcpy(batch->values[batch->count], value);
+    batch->count++;
+
+    return 0;
+}
+
+/**
+ * property_batch_apply()
+ *
+ * Sets all properties of a batch without waiting for them to take effect,
+ * see property_batch_verify().
+ *
+ * Returns 0 on success, -1 if any property_set failed.
+ */
+int property_batch_apply(const struct property_batch *batch)
+{
+    int i;
+    int ret = 0;
+
+    for (i = 0; i < batch->count; i++) {
+        if (property_set(batch->keys[i], batch->values[i]) < 0) {
+            LOGE("%s() property_set failed for %s!", __func__,
+                 batch->keys[i]);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * property_batch_verify()
+ *
+ * Reads back the properties of an applied batch until all of them have
+ * been verified to be set, for at most PROPERTY_SET_MAX_MS_WAIT in total.
+ * (set_property is asynchronous as defined by Android.)
+ *
+ * Note: even if function fails on timeout it is still possible that the
+ * values are set at a later time.
+ *
+ * Returns 0 on success, -2 on timeout checking the values.
+ */
+int property_batch_verify(const struct property_batch *batch)
+{
+    int numChecks;
+    int i;
+    int pending = batch->count;
+    bool verified[PROPERTY_BATCH_MAX];
     static const int maxchecks =
         PROPERTY_SET_MAX_MS_WAIT/PROPERTY_SET_CHECK_INTERVAL_MS;
     static const int msWait = 1000 * PROPERTY_SET_CHECK_INTERVAL_MS;
 
-    /* Set property */
-    ret = property_set(key, value);
-    if (ret < 0) {
-        LOGE("%s() property_set failed!",__func__);
-        ret = -1;
-        goto exit;
-    }
+    memset(verified, 0, sizeof(verified));
+
+    for (numChecks = 0; numChecks < maxchecks; numChecks++) {
+        for (i = 0; i < batch->count; i++) {
+            char checkvalue[PROPERTY_VALUE_MAX + 1];
+
+            if (verified[i])
+                continue;
 
-    ret = -2; /* Need to reset return-value before reading */
-    valuelen = strlen(value);
-
-    /* Loop and verify the property is set in database */
-    for(numChecks = 0; numChecks < maxchecks; numChecks++) {
-        char checkvalue[PROPERTY_VALUE_MAX + 1];
-        int getRet = property_get(key, checkvalue, NULL);
-        if (getRet == valuelen) {
-            if (strcmp(value, checkvalue) == 0) {
-                LOGD("%s() property verified with property_get!",__func__);
-                ret = 0;
-                break;
+            if (property_get(batch->keys[i], checkvalue, NULL) ==
+                (int) strlen(batch->values[i]) &&
+                strcmp(batch->values[i], checkvalue) == 0) {
+                verified[i] = true;
+                pending--;
             }
         }
+
+        if (pending == 0) {
+            LOGD("%s() %d properties verified with property_get!", __func__,
+                 batch->count);
+            return 0;
+        }
+
         usleep(msWait);
     }
 
-exit:
-    return ret;
+    for (i = 0; i < batch->count; i++)
+        if (!verified[i])
+            LOGW("%s() %s not verified", __func__, batch->keys[i]);
+
+    return -2;
 }
 
+/**
+ * Count a value in the histogram bucket it falls in. The histogram has
+ * numBounds + 1 buckets, bounds holds the upper bounds of all but the last.
+ */
+void addToHistogram(unsigned long histogram[], const long bounds[],
+                    size_t numBounds, long value)
+{
+    size_t i;
 
+    for (i = 0; i < numBounds; i++)
+        if (value < bounds[i])
+            break;
 
+    histogram[i]++;
+}
 
+/**
+ * Append formatted text to a report in buf, at *len which is updated. Text
+ * that does not fit is dropped.
+ */
+void reportAppend(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (*len + 1 >= size)
+        return;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return;
+    if (*len + n >= size)
+        *len = size - 1;
+    else
+        *len += n;
+}
+
+/**
+ * Append a histogram to a report as one line, see addToHistogram().
+ */
+void reportAppendHistogram(char *buf, size_t size, size_t *len,
+                           const char *name, const char *unit,
+                           const unsigned long histogram[],
+                           const long bounds[], size_t numBounds)
+{
+    size_t i;
+
+    reportAppend(buf, size, len, "%s", name);
+    for (i = 0; i < numBounds; i++)
+        reportAppend(buf, size, len, " <%ld%s:%lu", bounds[i], unit,
+                     histogram[i]);
+    reportAppend(buf, size, len, " >=%ld%s:%lu\n", bounds[numBounds - 1],
+                 unit, histogram[numBounds]);
+}
@@ -24,6 +24,8 @@
 #ifndef _U300_RIL_MISC_H
 #define _U300_RIL_MISC_H 1
 
+#include <cutils/properties.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,6 +33,15 @@ extern "C" {
 #define PROPERTY_SET_MAX_MS_WAIT            750
 #define PROPERTY_SET_CHECK_INTERVAL_MS      50
 
+#define PROPERTY_BATCH_MAX                  8
+
+/* Properties that are set together and verified together. */
+struct property_batch {
+    int count;
+    char keys[PROPERTY_BATCH_MAX][PROPERTY_KEY_MAX];
+    char values[PROPERTY_BATCH_MAX][PROPERTY_VALUE_MAX];
+};
+
 struct tlv {
     unsigned    tag;
     const char *data;
@@ -40,10 +51,7 @@ struct tlv {
 /** Returns 1 if line starts with prefix, 0 if it does not. */
 int strStartsWith(const char *line, const char *prefix);
 
-char *getFirstElementValue(const char *document,
-                           const char *elementBeginTag,
-                           const char *elementEndTag,
-                           char **remainingDocument);
+int nextElement(char **p_cur, char open, char **name, char **value);
 
 char char2nib(char c);
 
@@ -61,9 +69,23 @@ int parseTlv(const char *stream,
 
 int property_set_verified(const char *key, const char *value);
 
+void property_batch_init(struct property_batch *batch);
+int property_batch_add(struct property_batch *batch, const char *value,
+                       const char *keyfmt, ...);
+int property_batch_apply(const struct property_batch *batch);
+int property_batch_verify(const struct property_batch *batch);
+
 #define TLV_DATA(tlv, pos) (((unsigned)char2nib(tlv.data[(pos) * 2 + 0]) << 4) | \
                             ((unsigned)char2nib(tlv.data[(pos) * 2 + 1]) << 0))
 
+void addToHistogram(unsigned long histogram[], const long bounds[],
+                    size_t numBounds, long value);
+void reportAppend(char *buf, size_t size, size_t *len, const char *fmt, ...);
+void reportAppendHistogram(char *buf, size_t size, size_t *len,
+                           const char *name, const char *unit,
+                           const unsigned long histogram[],
+                           const long bounds[], size_t numBounds);
+
 #define NUM_ELEMS(x) (sizeof(x) / sizeof(x[0]))
 
 #ifdef __cplusplus
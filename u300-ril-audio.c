@@ -27,6 +27,7 @@
 #include "at_tok.h"
 #include "u300-ril.h"
 #include "u300-ril-audio.h"
+#include "u300-ril-calltimeline.h"
 
 #define LOG_TAG "RILV"
 #include <utils/Log.h>
@@ -116,7 +117,11 @@ void onAudioCallEventNotify(const char *s)
      * *EACE:3 indicates voice call start, RIL uses this to inform Android
      * call state changed. This indicates call state has changed to ALERTING.
      */
+    if (res == 1)
+        callTimelineRecord(0, CALL_EVENT_COMFORT_TONE);
+
     if (res == 3) {
+        callTimelineRecord(0, CALL_EVENT_ALERTING);
 #ifdef ENABLE_REPORTING_ALERTING_UPON_MISSING_CALL_STATE_FROM_NETWORK
         g_voice_call_start = true;
 #endif
@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <telephony/ril.h>
 
 #include <assert.h>
@@ -33,6 +35,8 @@
 #include "at_tok.h"
 #include "u300-ril.h"
 #include "u300-ril-audio.h"
+#include "u300-ril-calltimeline.h"
+#include "u300-ril-sim.h"
 
 #define LOG_TAG "RILV"
 #include <utils/Log.h>
@@ -68,9 +72,89 @@ enum clccState {
     CLCC_STATE_WAITING = 5
 };
 
+/* *ECAV <calltype> */
+#define ECAV_CALLTYPE_VOICE 1
+
+/* Call ids are 1-7, see 3GPP TS 22.030 6.5.5.1 */
+#define CALL_TABLE_SIZE 7
+
+#define CALL_MAX_NUMBER_LEN 82
+#define CALL_MAX_NAME_LEN 80
+
+/* Interval of AT+CLCC checks of the call table while there are calls */
+static const struct timeval TIMEVAL_CALL_RECONCILE = { 10, 0 };
+
+/* AT+VTD values, in 1/10 ms. 0 is the modem default of 70 ms. */
+#define DTMF_DURATION_DEFAULT 0
+#define DTMF_DURATION_CONTINUOUS 10000000
+
+/* Most tones sent in one AT+VTS command line */
+#define DTMF_MAX_MERGED 16
+
+/*
+ * Last AT+VTD setting acknowledged by the modem, -1 if unknown, and whether
+ * a tone started by RIL_REQUEST_DTMF_START may still be playing. Only
+ * accessed from the queue serving the DTMF requests, except for the reset
+ * when the modem goes away.
+ */
+static int s_dtmfDuration = -1;
+static bool s_dtmfTonePlaying = false;
+
 /* Last call fail cause, obtained by *ECAV. */
 static int s_lastCallFailCause = CALL_FAIL_ERROR_UNSPECIFIED;
 
+/*
+ * Time of reception of the last emergency RIL_REQUEST_DIAL, and the delay
+ * until its ATD was sent. The time is set from the RIL thread in
+ * emergencyDialReceived() and read on the queue thread, both under
+ * s_emergencyDialMutex. The statistics are only used on the queue thread.
+ */
+static struct timeval s_emergencyDialReceived;
+static pthread_mutex_t s_emergencyDialMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    unsigned long calls;
+    long lastMs;
+    long maxMs;
+} s_emergencyDialStats;
+
+/*
+ * Table of current calls, by call id, kept up to date from *ECAV so that
+ * RIL_REQUEST_GET_CURRENT_CALLS does not need AT+CLCC for each of the many
+ * state changes during call setup.
+ *
+ * *ECAV does not carry the number, name or multiparty status, so entries
+ * of new calls are incomplete until filled in from AT+CLCC, and the table
+ * is marked out of sync when the multiparty status may have changed. The
+ * table is then rebuilt from AT+CLCC on the next request. While there are
+ * calls it is also checked against AT+CLCC every TIMEVAL_CALL_RECONCILE,
+ * in case an *ECAV was missed.
+ *
+ * Updated from the AT reader thread and the request queues, serialized by
+ * s_callTableMutex which is never held while waiting for the modem.
+ * s_callTableGeneration changes with every *ECAV, so that an AT+CLCC
+ * response that may be older than the table is not installed.
+ */
+typedef struct callEntry {
+    bool used;
+    bool complete;          /* number and name known, from AT+CLCC */
+    RIL_Call call;          /* number and name are set on copy out */
+    char number[CALL_MAX_NUMBER_LEN + 1];
+    char name[CALL_MAX_NAME_LEN + 1];
+} callEntry;
+
+static callEntry s_callTable[CALL_TABLE_SIZE];
+static bool s_callTableSynced = false;
+static unsigned long s_callTableGeneration = 0;
+static bool s_callReconcileScheduled = false;
+static struct {
+    unsigned long fromTable;    /* requests answered from the table */
+    unsigned long fromCLCC;     /* requests that needed AT+CLCC */
+    unsigned long drifts;       /* table corrected by reconciliation */
+} s_callTableStats;
+static pthread_mutex_t s_callTableMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void reconcileCallTable(void *param);
+
 static int clccStateToRILState(int state, RIL_CallState *p_state)
 {
     switch (state) {
@@ -247,6 +331,315 @@ error:
     goto finally;
 }
 
+static void lockCallTable(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_callTableMutex)) != 0) {
+        LOGE("%s() failed to take call table mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void unlockCallTable(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_callTableMutex)) != 0) {
+        LOGE("%s() failed to release call table mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static int ecavStateToRILState(int ccstatus, RIL_CallState *p_state)
+{
+    switch (ccstatus) {
+    case CALLING_MO:
+        *p_state = RIL_CALL_DIALING;
+        return 0;
+    case CONNECTING_MO:
+        *p_state = RIL_CALL_ALERTING;
+        return 0;
+    case ACTIVE:
+        *p_state = RIL_CALL_ACTIVE;
+        return 0;
+    case HOLD:
+        *p_state = RIL_CALL_HOLDING;
+        return 0;
+    case WAITING_MT:
+        *p_state = RIL_CALL_WAITING;
+        return 0;
+    case ALERTING_MT:
+        *p_state = RIL_CALL_INCOMING;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static void copyString(char *dst, size_t size, const char *src)
+{
+    strncpy(dst, src != NULL ? src : "", size - 1);
+    dst[size - 1] = '\0';
+}
+
+/**
+ * Marks the call table out of sync, so that the next request for the
+ * current calls rebuilds it from AT+CLCC.
+ */
+static void invalidateCallTable(void)
+{
+    lockCallTable();
+    s_callTableSynced = false;
+    unlockCallTable();
+}
+
+/**
+ * Updates the call table from an *ECAV line.
+ *
+ * *ECAV: <ccid>,<ccstatus>,<calltype>[,<processid>][,<exitcause>]...
+ */
+static void updateCallTableFromECAV(const char *s)
+{
+    char *line;
+    char *tok;
+    int ccid;
+    int ccstatus;
+    int calltype;
+    RIL_CallState state;
+    callEntry *e;
+    bool mpty = false;
+    bool schedule = false;
+    int i;
+
+    tok = line = strdup(s);
+    if (line == NULL) {
+        invalidateCallTable();
+        return;
+    }
+
+    lockCallTable();
+
+    s_callTableGeneration++;
+
+    if (at_tok_start(&tok) < 0 ||
+        at_tok_nextint(&tok, &ccid) < 0 ||
+        at_tok_nextint(&tok, &ccstatus) < 0 ||
+        at_tok_nextint(&tok, &calltype) < 0 ||
+        ccid < 1 || ccid > CALL_TABLE_SIZE) {
+        s_callTableSynced = false;
+        goto exit;
+    }
+
+    e = &s_callTable[ccid - 1];
+
+    switch (ccstatus) {
+    case IDLE:
+        memset(e, 0, sizeof(*e));
+
+        /* A call leaving a multiparty call may leave a single call. */
+        for (i = 0; i < CALL_TABLE_SIZE; i++)
+            if (s_callTable[i].used && s_callTable[i].call.isMpty)
+                mpty = true;
+        if (mpty)
+            s_callTableSynced = false;
+        break;
+
+    case BUSY:
+    case RELEASED:
+        /* Listed until hung up, see onECAVReceived(). */
+        break;
+
+    default:
+        if (ecavStateToRILState(ccstatus, &state) < 0) {
+            s_callTableSynced = false;
+            break;
+        }
+
+        if (!e->used) {
+            memset(e, 0, sizeof(*e));
+            e->used = true;
+            e->call.index = ccid;
+            e->call.isMT = (ccstatus == WAITING_MT ||
+                            ccstatus == ALERTING_MT);
+            e->call.isVoice = (calltype == ECAV_CALLTYPE_VOICE);
+            e->call.numberPresentation = 2;
+            e->call.namePresentation = 2;
+        }
+        e->call.state = state;
+
+        if (!s_callReconcileScheduled) {
+            s_callReconcileScheduled = true;
+            schedule = true;
+        }
+        break;
+    }
+
+exit:
+    unlockCallTable();
+    free(line);
+
+    if (schedule)
+        enqueueRILEvent(CMD_QUEUE_AUXILIARY, reconcileCallTable, NULL,
+                        &TIMEVAL_CALL_RECONCILE);
+}
+
+/**
+ * Replaces the call table with the calls listed by AT+CLCC, unless an
+ * *ECAV has been received since generation was read.
+ *
+ * \return true if the table differed from the calls.
+ */
+static bool installCalls(const RIL_Call *calls, int count,
+                         unsigned long generation)
+{
+    callEntry table[CALL_TABLE_SIZE];
+    bool changed = false;
+    int i;
+
+    memset(table, 0, sizeof(table));
+    for (i = 0; i < count; i++) {
+        callEntry *e;
+
+        if (calls[i].index < 1 || calls[i].index > CALL_TABLE_SIZE)
+            return false;
+
+        e = &table[calls[i].index - 1];
+        e->used = true;
+        e->complete = true;
+        e->call = calls[i];
+        e->call.uusInfo = NULL;
+        copyString(e->number, sizeof(e->number), calls[i].number);
+        copyString(e->name, sizeof(e->name), calls[i].name);
+    }
+
+    lockCallTable();
+
+    if (generation != s_callTableGeneration)
+        goto exit;
+
+    for (i = 0; i < CALL_TABLE_SIZE; i++) {
+        const callEntry *o = &s_callTable[i];
+        const callEntry *n = &table[i];
+
+        if (o->used != n->used)
+            changed = true;
+        else if (o->used &&
+                 (o->call.state != n->call.state ||
+                  o->call.isMpty != n->call.isMpty ||
+                  o->call.isMT != n->call.isMT ||
+                  (o->complete && strcmp(o->number, n->number) != 0)))
+            changed = true;
+    }
+
+    memcpy(s_callTable, table, sizeof(table));
+    s_callTableSynced = true;
+
+exit:
+    unlockCallTable();
+    return changed;
+}
+
+/**
+ * Sends AT+CLCC and parses the calls into calls, with strings pointing
+ * into *atresponse which must be freed by the caller.
+ *
+ * \return number of calls, or -1 on failure.
+ */
+static int queryCurrentCalls(ATResponse **atresponse,
+                             RIL_Call calls[CALL_TABLE_SIZE])
+{
+    ATLine *cursor;
+    int count = 0;
+    int err;
+
+    err = at_send_command_multiline("AT+CLCC", "+CLCC:", atresponse);
+    if (err != 0 || (*atresponse)->success == 0)
+        return -1;
+
+    for (cursor = (*atresponse)->p_intermediates; cursor != NULL;
+         cursor = cursor->p_next) {
+        RIL_Call *call = &calls[count];
+
+        if (count == CALL_TABLE_SIZE) {
+            LOGW("%s(): more than %d calls listed", __func__,
+                 CALL_TABLE_SIZE);
+            break;
+        }
+
+        memset(call, 0, sizeof(*call));
+        call->number  = NULL;
+        call->name    = NULL;
+        call->uusInfo = NULL;
+
+        if (callFromCLCCLine(cursor->line, call) != 0)
+            continue;
+
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * Checks the call table against AT+CLCC while there are calls, and
+ * reports a call state change if they differed.
+ */
+static void reconcileCallTable(void *param)
+{
+    ATResponse *atresponse = NULL;
+    RIL_Call calls[CALL_TABLE_SIZE];
+    unsigned long generation;
+    bool schedule = false;
+    int count;
+    int i;
+
+    lockCallTable();
+    generation = s_callTableGeneration;
+    unlockCallTable();
+
+    count = queryCurrentCalls(&atresponse, calls);
+    if (count < 0) {
+        lockCallTable();
+        s_callTableSynced = false;
+        s_callReconcileScheduled = false;
+        unlockCallTable();
+        goto exit;
+    }
+
+    if (installCalls(calls, count, generation)) {
+        unsigned long drifts, fromTable, fromCLCC;
+
+        lockCallTable();
+        drifts = ++s_callTableStats.drifts;
+        fromTable = s_callTableStats.fromTable;
+        fromCLCC = s_callTableStats.fromCLCC;
+        unlockCallTable();
+
+        LOGW("%s(): call table was out of date (%lu drifts, %lu requests "
+             "from table, %lu from AT+CLCC)", __func__,
+             drifts, fromTable, fromCLCC);
+        RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
+                                  NULL, 0);
+    }
+
+    lockCallTable();
+    for (i = 0; i < CALL_TABLE_SIZE; i++)
+        if (s_callTable[i].used)
+            schedule = true;
+    s_callReconcileScheduled = schedule;
+    unlockCallTable();
+
+    if (schedule)
+        enqueueRILEvent(CMD_QUEUE_AUXILIARY, reconcileCallTable, NULL,
+                        &TIMEVAL_CALL_RECONCILE);
+
+exit:
+    at_response_free(atresponse);
+}
+
 /**
  * Hangup MO call.
  * This is needed either when the remote end is BUSY
@@ -280,16 +673,20 @@ void onECAVReceived(const char *s)
     int err;
     int res;
     int skip;
+    int ccid;
+    int exitCause = -1;
     int lastCallFailCause = CALL_FAIL_ERROR_UNSPECIFIED;
 
+    updateCallTableFromECAV(s);
+
     tok = line = strdup(s);
 
     err = at_tok_start(&tok);
     if (err < 0)
         goto error;
 
-    /* Read CID. Ignored - not needed */
-    err = at_tok_nextint(&tok, &res);
+    /* Read CID. Only used for the call timeline */
+    err = at_tok_nextint(&tok, &ccid);
     if (err < 0)
         goto error;
 
@@ -316,6 +713,7 @@ void onECAVReceived(const char *s)
         err = at_tok_nextint(&tok, &lastCallFailCause);
         if (err < 0)
             goto error;
+        exitCause = lastCallFailCause;
 
         /*
          * The STE modems support these additional proprietary exit cause
@@ -375,6 +773,31 @@ void onECAVReceived(const char *s)
         lastCallFailCause = CALL_FAIL_BUSY;
         enqueueRILEvent(CMD_QUEUE_AUXILIARY, hangupCall, NULL, NULL);
     }
+
+    switch (res) {
+    case IDLE:
+        callTimelineEnd(ccid, exitCause);
+        break;
+    case CALLING_MO:
+        callTimelineRecord(ccid, CALL_EVENT_CALLING);
+        break;
+    case CONNECTING_MO:
+        callTimelineRecord(ccid, CALL_EVENT_CONNECTING);
+        break;
+    case ACTIVE:
+        callTimelineRecord(ccid, CALL_EVENT_ACTIVE);
+        break;
+    case WAITING_MT:
+    case ALERTING_MT:
+        callTimelineRecord(ccid, CALL_EVENT_INCOMING);
+        break;
+    case BUSY:
+    case RELEASED:
+        callTimelineRecord(ccid, CALL_EVENT_RELEASED);
+        break;
+    default:
+        break;
+    }
     goto exit;
 
 error:
@@ -505,6 +928,9 @@ void requestConference(void *data, size_t datalen, RIL_Token t)
     /* 3GPP 22.030 6.5.5
        "Adds a held call to the conversation." */
     err = at_send_command("AT+CHLD=3", &atresponse);
+
+    /* *ECAV does not tell which calls are now in the multiparty call. */
+    invalidateCallTable();
     if (err < 0 || atresponse->success == 0)
         goto error;
 
@@ -541,6 +967,8 @@ void requestSeparateConnection(void *data, size_t datalen, RIL_Token t)
 
     asprintf(&cmd, "AT+CHLD=2%d", party);
     err = at_send_command(cmd, &atresponse);
+
+    invalidateCallTable();
     if (err < 0 || atresponse->success == 0)
         goto error;
 
@@ -569,6 +997,8 @@ void requestExplicitCallTransfer(void *data, size_t datalen, RIL_Token t)
     /* 3GPP TS 22.091
        Connects the two calls and disconnects the subscriber from both calls. */
     err = at_send_command("AT+CHLD=4", &atresponse);
+
+    invalidateCallTable();
     if (err < 0 || atresponse->success == 0)
         goto error;
 
@@ -711,104 +1141,130 @@ void requestLastCallFailCause(void *data, size_t datalen, RIL_Token t)
  */
 void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 {
-    int err;
     ATResponse *atresponse = NULL;
-    ATLine *cursor;
-    int countCalls;
-    int countValidCalls = 0;
-    RIL_Call *calls = NULL;
-    RIL_Call **response = NULL;
-    RIL_Call *call = NULL;
+    callEntry table[CALL_TABLE_SIZE];
+    RIL_Call calls[CALL_TABLE_SIZE];
+    RIL_Call *response[CALL_TABLE_SIZE];
+    unsigned long generation;
+    bool useTable = true;
+    int count = 0;
     int i;
 
-    err = at_send_command_multiline("AT+CLCC", "+CLCC:", &atresponse);
+    lockCallTable();
+    if (s_callTableSynced) {
+        for (i = 0; i < CALL_TABLE_SIZE; i++)
+            if (s_callTable[i].used && !s_callTable[i].complete)
+                useTable = false;
+    } else
+        useTable = false;
+
+    if (useTable) {
+        memcpy(table, s_callTable, sizeof(table));
+        s_callTableStats.fromTable++;
+    } else
+        s_callTableStats.fromCLCC++;
+    generation = s_callTableGeneration;
+    unlockCallTable();
+
+    if (useTable) {
+        for (i = 0; i < CALL_TABLE_SIZE; i++) {
+            if (!table[i].used)
+                continue;
+
+            calls[count] = table[i].call;
+            calls[count].number = table[i].number;
+            calls[count].name = table[i].name;
+#ifdef ENABLE_REPORTING_ALERTING_UPON_MISSING_CALL_STATE_FROM_NETWORK
+            /* See clccStateToRILState() */
+            if (calls[count].state == RIL_CALL_DIALING &&
+                getVoiceCallStartState())
+                calls[count].state = RIL_CALL_ALERTING;
+#endif
+            count++;
+        }
+    } else {
+        count = queryCurrentCalls(&atresponse, calls);
+        if (count < 0) {
+            RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+            goto exit;
+        }
 
-    if (err != 0 || atresponse->success == 0) {
-        RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
-        return;
+        (void)installCalls(calls, count, generation);
     }
 
-    /* Count the calls. */
-    for (countCalls = 0, cursor = atresponse->p_intermediates;
-         cursor != NULL; cursor = cursor->p_next)
-        countCalls++;
-
-    if (countCalls == 0)
-        goto exit;
-
-    /* Yes, there's an array of pointers and then an array of structures. */
-    response = (RIL_Call **) alloca(countCalls * sizeof(RIL_Call *));
-    calls = (RIL_Call *) alloca(countCalls * sizeof(RIL_Call));
+    for (i = 0; i < count; i++)
+        response[i] = &calls[i];
 
-    /* Init the pointer array. */
-    for (i = 0; i < countCalls; i++)
-        response[i] = &(calls[i]);
-
-    for (countValidCalls = 0, cursor = atresponse->p_intermediates;
-         cursor != NULL; cursor = cursor->p_next) {
-        call = calls + countValidCalls;
-        memset(call, 0, sizeof(*call));
-        call->number  = NULL;
-        call->name    = NULL;
-        call->uusInfo = NULL;
-
-        err = callFromCLCCLine(cursor->line, call);
-        if (err != 0)
-            continue;
-
-        countValidCalls++;
-    }
+    RIL_onRequestComplete(t, RIL_E_SUCCESS, count > 0 ? response : NULL,
+                          count * sizeof(RIL_Call *));
 
 exit:
-    RIL_onRequestComplete(t, RIL_E_SUCCESS, response,
-                          countValidCalls * sizeof(RIL_Call *));
-
     at_response_free(atresponse);
     return;
 }
 
 /**
- * Returns false if FDN is not active, not available or failed to get result
- * for AT+CLCK,true if FDN is enabled
+ * To be called when an emergency RIL_REQUEST_DIAL is received, before it
+ * is queued.
  */
-static bool isFdnEnabled(void)
+void emergencyDialReceived(void)
 {
-    int err = -1;
-    int status = 0;
-    bool res = false;
-    char *line = NULL;
-    ATResponse *atresponse = NULL;
+    int err;
 
-    err = at_send_command_multiline("AT+CLCK=\"FD\",2", "+CLCK:", &atresponse);
-    if (err < 0 || atresponse->success == 0)
-        goto error;
+    if ((err = pthread_mutex_lock(&s_emergencyDialMutex)) != 0) {
+        LOGE("%s() failed to take emergency dial mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
 
-    line = atresponse->p_intermediates->line;
+    gettimeofday(&s_emergencyDialReceived, NULL);
 
-    err = at_tok_start(&line);
-    if (err < 0)
-        goto error;
+    if ((err = pthread_mutex_unlock(&s_emergencyDialMutex)) != 0) {
+        LOGE("%s() failed to release emergency dial mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
 
-    err = at_tok_nextint(&line, &status);
-    if (err < 0 )
-        goto error;
+static void recordEmergencyDialLatency(void)
+{
+    struct timeval now;
+    long ms;
+    int err;
 
-    /* status = 1 means that FDN facility is active */
-    if (status == 1)
-        res = true;
+    if ((err = pthread_mutex_lock(&s_emergencyDialMutex)) != 0) {
+        LOGE("%s() failed to take emergency dial mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
 
-    goto exit;
-error:
-    LOGE("%s(): Failed to parse facility check response.\n", __func__);
-exit:
-    at_response_free(atresponse);
-    return res;
+    gettimeofday(&now, NULL);
+    ms = (now.tv_sec - s_emergencyDialReceived.tv_sec) * 1000 +
+         (now.tv_usec - s_emergencyDialReceived.tv_usec) / 1000;
+
+    if ((err = pthread_mutex_unlock(&s_emergencyDialMutex)) != 0) {
+        LOGE("%s() failed to release emergency dial mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+
+    s_emergencyDialStats.calls++;
+    s_emergencyDialStats.lastMs = ms;
+    if (ms > s_emergencyDialStats.maxMs)
+        s_emergencyDialStats.maxMs = ms;
+
+    LOGI("[ECC]: ATD sent %ld ms after emergency dial request "
+         "(%lu calls, max %ld ms)", ms, s_emergencyDialStats.calls,
+         s_emergencyDialStats.maxMs);
 }
 
 /**
  * RIL_REQUEST_DIAL
  *
  * Initiate voice call.
+ *
+ * Emergency calls are put ahead of other queued requests by onRequest(),
+ * and never checked against FDN.
  */
 void requestDial(void *data, size_t datalen, RIL_Token t)
 {
@@ -818,8 +1274,10 @@ void requestDial(void *data, size_t datalen, RIL_Token t)
     const char *clir;
     int err;
     ATCmeError cme_error_code;
+    bool emergency;
 
     dial = (const RIL_Dial *) data;
+    emergency = isEmergencyNumber(dial->address);
 
     switch (dial->clir) {
     case 1:
@@ -836,7 +1294,12 @@ void requestDial(void *data, size_t datalen, RIL_Token t)
 
     asprintf(&cmd, "ATD%s%s;", dial->address, clir);
 
+    if (emergency)
+        recordEmergencyDialLatency();
+
+    callTimelineRecord(0, CALL_EVENT_ATD_SENT);
     err = at_send_command(cmd, &atresponse);
+    callTimelineRecord(0, CALL_EVENT_ATD_RESPONSE);
 
     free(cmd);
 
@@ -850,9 +1313,10 @@ void requestDial(void *data, size_t datalen, RIL_Token t)
              * RIL_REQUEST_DIAL returns GENERIC_FAILURE. If pre-dial check
              * has failed and FDN is enabled we conclude that the reason
              * for failed pre-dial check is that the number is not in the
-             * FDN list.
+             * FDN list. Emergency numbers are not subject to FDN.
              */
-            if (cme_error_code == CME_PRE_DIAL_CHECK_ERROR && isFdnEnabled())
+            if (cme_error_code == CME_PRE_DIAL_CHECK_ERROR && !emergency &&
+                isFdnEnabled())
                 s_lastCallFailCause = CALL_FAIL_FDN_BLOCKED;
             else
                 s_lastCallFailCause = CALL_FAIL_ERROR_UNSPECIFIED;
@@ -870,6 +1334,7 @@ void requestDial(void *data, size_t datalen, RIL_Token t)
     goto exit;
 
 error:
+    callTimelineEnd(0, s_lastCallFailCause);
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 
 exit:
@@ -1001,6 +1466,51 @@ error:
     goto finally;
 }
 
+/**
+ * Sets the duration of the following tones with AT+VTD, unless the modem
+ * already has it. Changing the duration also stops a tone being played,
+ * so the command is always sent while one may be playing.
+ */
+static int setDTMFDuration(int duration)
+{
+    ATResponse *atresponse = NULL;
+    char *cmd = NULL;
+    int err;
+
+    if (duration == s_dtmfDuration && !s_dtmfTonePlaying)
+        return 0;
+
+    asprintf(&cmd, "AT+VTD=%d", duration);
+    err = at_send_command(cmd, &atresponse);
+    free(cmd);
+
+    if (err < 0 || atresponse->success == 0) {
+        s_dtmfDuration = -1;
+        err = -1;
+    } else {
+        s_dtmfDuration = duration;
+        s_dtmfTonePlaying = false;
+        err = 0;
+    }
+
+    at_response_free(atresponse);
+    return err;
+}
+
+static bool isDTMFDigit(char c)
+{
+    return (c >= '0' && c <= '9') || c == '*' || c == '#';
+}
+
+/**
+ * To be called when the modem is lost, it forgets the AT+VTD setting.
+ */
+void resetDTMFState(void)
+{
+    s_dtmfDuration = -1;
+    s_dtmfTonePlaying = false;
+}
+
 /**
  * RIL_REQUEST_DTMF
  *
@@ -1009,42 +1519,74 @@ error:
  * If the implementation is currently playing a tone requested via
  * RIL_REQUEST_DTMF_START, that tone should be cancelled and the new tone
  * should be played instead.
+ *
+ * Further RIL_REQUEST_DTMF queued right behind this one are played in the
+ * same AT command line ("AT+VTS=1;+VTS=2;..."), so a string of digits costs
+ * a single round trip to the modem. The modem plays the tones in order and
+ * answers when the last one is done; all merged requests are completed
+ * with that answer.
  */
 void requestDTMF(void *data, size_t datalen, RIL_Token t)
 {
     char c = *((char *) data);
-    char *cmd = NULL;
+    RILRequest *merged[DTMF_MAX_MERGED - 1];
+    RILRequest *invalid = NULL;
+    char cmd[sizeof("AT+VTS=x") + (DTMF_MAX_MERGED - 1) * sizeof(";+VTS=x")];
+    char *p;
     ATResponse *atresponse = NULL;
-    int err = -1;
+    RIL_Errno ret = RIL_E_GENERIC_FAILURE;
+    int count = 0;
+    int err;
+    int i;
 
-    if (!((c>='0' && c<='9') || c=='*' || c=='#'))
-        goto error;
+    if (!isDTMFDigit(c)) {
+        RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+        return;
+    }
 
-    /* Set duration to default (manufacturer specific, 70ms in our case). */
-    err = at_send_command("AT+VTD=0", &atresponse);
-    if (err < 0 || atresponse->success == 0)
-        goto error;
+    p = cmd + sprintf(cmd, "AT+VTS=%c", c);
 
-    at_response_free(atresponse);
-    atresponse = NULL;
+    while (count < DTMF_MAX_MERGED - 1) {
+        RILRequest *r = takeQueuedRequest(RIL_REQUEST_DTMF);
+
+        if (r == NULL)
+            break;
+
+        if (r->data == NULL || !isDTMFDigit(*((char *) r->data))) {
+            invalid = r;
+            break;
+        }
+
+        p += sprintf(p, ";+VTS=%c", *((char *) r->data));
+        merged[count++] = r;
+    }
+
+    if (count > 0)
+        LOGD("%s(): playing %d tones in one command", __func__, count + 1);
+
+    /* Set duration to default (manufacturer specific, 70ms in our case). */
+    if (setDTMFDuration(DTMF_DURATION_DEFAULT) < 0)
+        goto complete;
 
-    asprintf(&cmd, "AT+VTS=%c", c);
     err = at_send_command(cmd, &atresponse);
     if (err < 0 || atresponse->success == 0)
-        goto error;
+        goto complete;
 
-    RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+    ret = RIL_E_SUCCESS;
 
-finally:
-    if (cmd != NULL)
-        free(cmd);
-    at_response_free(atresponse);
+complete:
+    RIL_onRequestComplete(t, ret, NULL, 0);
+    for (i = 0; i < count; i++) {
+        RIL_onRequestComplete(merged[i]->token, ret, NULL, 0);
+        freeQueuedRequest(merged[i]);
+    }
 
-    return;
+    if (invalid != NULL) {
+        RIL_onRequestComplete(invalid->token, RIL_E_GENERIC_FAILURE, NULL, 0);
+        freeQueuedRequest(invalid);
+    }
 
-error:
-    RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
-    goto finally;
+    at_response_free(atresponse);
 }
 
 /**
@@ -1066,19 +1608,16 @@ void requestDTMFStart(void *data, size_t datalen, RIL_Token t)
     int err = 0;
 
     /* Set duration to maximum, 10000000  n/10 ms = 10000s. */
-    err = at_send_command("AT+VTD=10000000", &atresponse);
-    if (err < 0 || atresponse->success == 0)
+    if (setDTMFDuration(DTMF_DURATION_CONTINUOUS) < 0)
         goto error;
 
-    at_response_free(atresponse);
-    atresponse = NULL;
-
     /* Start the DTMF tone. */
     asprintf(&cmd, "AT+VTS=%c", c);
     err = at_send_command(cmd, &atresponse);
     if (err < 0 || atresponse->success == 0)
         goto error;
 
+    s_dtmfTonePlaying = true;
     RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
 
 finally:
@@ -1102,20 +1641,11 @@ error:
  */
 void requestDTMFStop(void *data, size_t datalen, RIL_Token t)
 {
-    int err = 0;
-    ATResponse *atresponse = NULL;
-
-    err = at_send_command("AT+VTD=0", &atresponse);
-    if (err < 0 || atresponse->success == 0)
-        goto error;
-
-    RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+    /* Setting the duration is what stops the tone, so always send it. */
+    s_dtmfTonePlaying = true;
 
-finally:
-    at_response_free(atresponse);
-    return;
-
-error:
-    RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
-    goto finally;
+    if (setDTMFDuration(DTMF_DURATION_DEFAULT) < 0)
+        RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+    else
+        RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
 }
@@ -44,6 +44,8 @@ void requestHangup(void *data, size_t datalen, RIL_Token t);
 void requestDTMF(void *data, size_t datalen, RIL_Token t);
 void requestDTMFStart(void *data, size_t datalen, RIL_Token t);
 void requestDTMFStop(void *data, size_t datalen, RIL_Token t);
+void resetDTMFState(void);
+void emergencyDialReceived(void);
 
 void onECAVReceived(const char *s);
 #endif
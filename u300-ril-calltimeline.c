@@ -0,0 +1,443 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "misc.h"
+#include "u300-ril-calltimeline.h"
+
+#define LOG_TAG "RILV"
+#include <utils/Log.h>
+
+/*
+ * Call setup timelines.
+ *
+ * The time of each step of a call, from the dial request through the *ECAV
+ * and *EACE reports until the call is gone, is recorded per call id. When
+ * a call ends its post dial delay, answer latency and release latency are
+ * counted in histograms, its exit cause is counted, and its timeline is
+ * kept among the most recent ones for callTimelineReport().
+ *
+ * A dialled call has no call id until the first *ECAV, so its first steps
+ * are recorded in s_pending. Events that carry no call id (call id 0) go to
+ * the call being set up, or for RIL_REQUEST_ANSWER to the incoming call.
+ *
+ * Events come from the AT reader thread and the request queues, serialized
+ * by s_timelineMutex.
+ */
+
+/* Call ids are 1-7, see 3GPP TS 22.030 6.5.5.1 */
+#define CALL_TIMELINE_MAX_CALLS 7
+
+typedef struct callTimeline {
+    bool used;
+    bool mobileOriginated;
+    int ccid;
+    int cause;
+    struct timeval start;
+    long at[CALL_NUM_EVENTS];   /* ms after start, -1 if not seen */
+} callTimeline;
+
+static const char *s_eventNames[CALL_NUM_EVENTS] = {
+    "dial", "atd", "atd_response", "calling", "connecting", "incoming",
+    "alerting", "comfort_tone", "answer", "active", "hangup", "released",
+    "idle"
+};
+
+/* Upper bounds of the histogram buckets, in ms. */
+static const long s_postDialBounds[] = { 1000, 2000, 3000, 5000, 8000 };
+static const long s_answerBounds[] = { 250, 500, 1000, 2000, 5000 };
+static const long s_releaseBounds[] = { 250, 500, 1000, 2000, 5000 };
+
+static callTimeline s_pending;
+static callTimeline s_calls[CALL_TIMELINE_MAX_CALLS];
+static int s_setupCcid = 0;         /* MO call not yet active */
+static int s_incomingCcid = 0;      /* MT call not yet active */
+
+static callTimeline s_history[CALL_TIMELINE_HISTORY];
+static int s_historyNext = 0;
+static unsigned long s_completed = 0;
+
+static struct {
+    int cause;
+    unsigned long count;
+} s_causes[CALL_TIMELINE_MAX_CAUSES];
+static int s_numCauses = 0;
+static unsigned long s_otherCauses = 0;
+
+static unsigned long s_postDialHistogram[NUM_ELEMS(s_postDialBounds) + 1];
+static unsigned long s_answerHistogram[NUM_ELEMS(s_answerBounds) + 1];
+static unsigned long s_releaseHistogram[NUM_ELEMS(s_releaseBounds) + 1];
+
+static pthread_mutex_t s_timelineMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void timelineLock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_timelineMutex)) != 0) {
+        LOGE("%s() failed to take timeline mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void timelineUnlock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_timelineMutex)) != 0) {
+        LOGE("%s() failed to release timeline mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void startTimeline(callTimeline *t, int ccid)
+{
+    int i;
+
+    memset(t, 0, sizeof(*t));
+    t->used = true;
+    t->ccid = ccid;
+    t->cause = -1;
+    gettimeofday(&t->start, NULL);
+
+    for (i = 0; i < CALL_NUM_EVENTS; i++)
+        t->at[i] = -1;
+}
+
+/* Records the first occurrence of an event only. */
+static void markEvent(callTimeline *t, callTimelineEvent event)
+{
+    struct timeval now;
+
+    if (t->at[event] >= 0)
+        return;
+
+    gettimeofday(&now, NULL);
+    t->at[event] = (now.tv_sec - t->start.tv_sec) * 1000 +
+                   (now.tv_usec - t->start.tv_usec) / 1000;
+}
+
+/* Earliest of two event times, -1 if neither was seen. */
+static long earliest(long a, long b)
+{
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    return a < b ? a : b;
+}
+
+/**
+ * Finds the timeline an event belongs to, starting one if needed. Must be
+ * called with the timeline mutex held.
+ */
+static callTimeline *findTimeline(int ccid, callTimelineEvent event)
+{
+    callTimeline *t;
+
+    if (ccid == 0) {
+        if (event == CALL_EVENT_ANSWER_RECEIVED)
+            ccid = s_incomingCcid;
+        else if (s_pending.used)
+            return &s_pending;
+        else
+            ccid = s_setupCcid;
+    }
+
+    if (ccid < 1 || ccid > CALL_TIMELINE_MAX_CALLS)
+        return NULL;
+
+    t = &s_calls[ccid - 1];
+    if (t->used)
+        return t;
+
+    /* The first *ECAV of a dialled call gives it its call id. */
+    if (event == CALL_EVENT_CALLING && s_pending.used) {
+        *t = s_pending;
+        t->ccid = ccid;
+        s_pending.used = false;
+    } else {
+        startTimeline(t, ccid);
+    }
+
+    return t;
+}
+
+static void countCause(int cause)
+{
+    int i;
+
+    for (i = 0; i < s_numCauses; i++) {
+        if (s_causes[i].cause == cause) {
+            s_causes[i].count++;
+            return;
+        }
+    }
+
+    if (s_numCauses < CALL_TIMELINE_MAX_CAUSES) {
+        s_causes[s_numCauses].cause = cause;
+        s_causes[s_numCauses].count = 1;
+        s_numCauses++;
+    } else {
+        s_otherCauses++;
+    }
+}
+
+/**
+ * Adds a completed timeline to the statistics and frees it. Must be called
+ * with the timeline mutex held.
+ */
+static void completeTimeline(callTimeline *t)
+{
+    const long *at = t->at;
+    long from;
+    long postDial = -1;
+    long answer = -1;
+    long release = -1;
+
+    from = at[CALL_EVENT_DIAL_RECEIVED] >= 0 ? at[CALL_EVENT_DIAL_RECEIVED]
+                                             : at[CALL_EVENT_CALLING];
+    if (t->mobileOriginated && from >= 0 &&
+        earliest(at[CALL_EVENT_ALERTING], at[CALL_EVENT_COMFORT_TONE]) >= 0)
+        postDial = earliest(at[CALL_EVENT_ALERTING],
+                            at[CALL_EVENT_COMFORT_TONE]) - from;
+
+    if (at[CALL_EVENT_ANSWER_RECEIVED] >= 0 && at[CALL_EVENT_ACTIVE] >= 0)
+        answer = at[CALL_EVENT_ACTIVE] - at[CALL_EVENT_ANSWER_RECEIVED];
+
+    from = earliest(at[CALL_EVENT_HANGUP_RECEIVED], at[CALL_EVENT_RELEASED]);
+    if (from >= 0 && at[CALL_EVENT_IDLE] >= 0)
+        release = at[CALL_EVENT_IDLE] - from;
+
+    if (postDial >= 0)
+        addToHistogram(s_postDialHistogram, s_postDialBounds,
+                       NUM_ELEMS(s_postDialBounds), postDial);
+    if (answer >= 0)
+        addToHistogram(s_answerHistogram, s_answerBounds,
+                       NUM_ELEMS(s_answerBounds), answer);
+    if (release >= 0)
+        addToHistogram(s_releaseHistogram, s_releaseBounds,
+                       NUM_ELEMS(s_releaseBounds), release);
+
+    countCause(t->cause);
+    s_completed++;
+
+    LOGI("%s(): %s call %d ended, cause %d, post dial %ld ms, "
+         "answer %ld ms, release %ld ms", __func__,
+         t->mobileOriginated ? "MO" : "MT", t->ccid, t->cause, postDial,
+         answer, release);
+
+    s_history[s_historyNext] = *t;
+    s_historyNext = (s_historyNext + 1) % CALL_TIMELINE_HISTORY;
+
+    if (t->ccid != 0 && t->ccid == s_setupCcid)
+        s_setupCcid = 0;
+    if (t->ccid != 0 && t->ccid == s_incomingCcid)
+        s_incomingCcid = 0;
+
+    t->used = false;
+}
+
+/**
+ * Record a step of a call.
+ *
+ * \param ccid: call id, or 0 for the call being set up, or for
+ *              CALL_EVENT_ANSWER_RECEIVED the incoming call.
+ */
+void callTimelineRecord(int ccid, callTimelineEvent event)
+{
+    callTimeline *t;
+
+    if (event < 0 || event >= CALL_NUM_EVENTS)
+        return;
+
+    timelineLock();
+
+    /* A new dial request, drop what is left of a previous one. */
+    if (event == CALL_EVENT_DIAL_RECEIVED) {
+        startTimeline(&s_pending, 0);
+        s_pending.mobileOriginated = true;
+    }
+
+    t = findTimeline(ccid, event);
+    if (t == NULL)
+        goto exit;
+
+    markEvent(t, event);
+
+    switch (event) {
+    case CALL_EVENT_CALLING:
+        t->mobileOriginated = true;
+        s_setupCcid = t->ccid;
+        break;
+    case CALL_EVENT_INCOMING:
+        if (!t->mobileOriginated && t->at[CALL_EVENT_ACTIVE] < 0)
+            s_incomingCcid = t->ccid;
+        break;
+    case CALL_EVENT_ACTIVE:
+        if (t->ccid == s_setupCcid)
+            s_setupCcid = 0;
+        if (t->ccid == s_incomingCcid)
+            s_incomingCcid = 0;
+        break;
+    default:
+        break;
+    }
+
+exit:
+    timelineUnlock();
+}
+
+/**
+ * Record the end of a call, on *ECAV IDLE or a failed dial request.
+ *
+ * \param ccid: call id, or 0 for the call being set up.
+ * \param cause: exit cause, -1 if unknown.
+ */
+void callTimelineEnd(int ccid, int cause)
+{
+    callTimeline *t = NULL;
+
+    timelineLock();
+
+    if (ccid == 0) {
+        if (s_pending.used)
+            t = &s_pending;
+        else
+            ccid = s_setupCcid;
+    }
+
+    if (t == NULL && ccid >= 1 && ccid <= CALL_TIMELINE_MAX_CALLS &&
+        s_calls[ccid - 1].used)
+        t = &s_calls[ccid - 1];
+
+    if (t != NULL) {
+        markEvent(t, CALL_EVENT_IDLE);
+        t->cause = cause;
+        completeTimeline(t);
+    }
+
+    timelineUnlock();
+}
+
+/**
+ * Drop the timelines of calls in progress, to be called when the modem
+ * goes away and their ends will not be reported.
+ */
+void callTimelineReset(void)
+{
+    int i;
+
+    timelineLock();
+
+    s_pending.used = false;
+    for (i = 0; i < CALL_TIMELINE_MAX_CALLS; i++)
+        s_calls[i].used = false;
+    s_setupCcid = 0;
+    s_incomingCcid = 0;
+
+    timelineUnlock();
+}
+
+static void appendTimeline(char *buf, size_t size, size_t *len,
+                           const char *what, const callTimeline *t)
+{
+    int i;
+
+    reportAppend(buf, size, len, "%s %s call %d", what,
+                 t->mobileOriginated ? "MO" : "MT", t->ccid);
+    if (t->at[CALL_EVENT_IDLE] >= 0)
+        reportAppend(buf, size, len, " cause %d", t->cause);
+    reportAppend(buf, size, len, ":");
+
+    for (i = 0; i < CALL_NUM_EVENTS; i++)
+        if (t->at[i] >= 0)
+            reportAppend(buf, size, len, " %s@%ld", s_eventNames[i],
+                         t->at[i]);
+    reportAppend(buf, size, len, "\n");
+}
+
+/**
+ * Write a text report of the call setup statistics: histograms of post
+ * dial delay, answer latency and release latency in ms, exit cause counts,
+ * and the timelines of the calls in progress and of the most recent calls,
+ * in ms from the first event of each call.
+ *
+ * \return length of the report, which is truncated to fit size.
+ */
+int callTimelineReport(char *buf, size_t size)
+{
+    size_t len = 0;
+    int i;
+
+    if (buf == NULL || size == 0)
+        return -1;
+
+    buf[0] = '\0';
+
+    timelineLock();
+
+    reportAppend(buf, size, &len, "calls completed %lu\n", s_completed);
+    reportAppendHistogram(buf, size, &len, "post_dial", "ms",
+                          s_postDialHistogram, s_postDialBounds,
+                          NUM_ELEMS(s_postDialBounds));
+    reportAppendHistogram(buf, size, &len, "answer", "ms", s_answerHistogram,
+                          s_answerBounds, NUM_ELEMS(s_answerBounds));
+    reportAppendHistogram(buf, size, &len, "release", "ms",
+                          s_releaseHistogram, s_releaseBounds,
+                          NUM_ELEMS(s_releaseBounds));
+
+    reportAppend(buf, size, &len, "causes");
+    for (i = 0; i < s_numCauses; i++)
+        reportAppend(buf, size, &len, " %d:%lu", s_causes[i].cause,
+                     s_causes[i].count);
+    if (s_otherCauses > 0)
+        reportAppend(buf, size, &len, " other:%lu", s_otherCauses);
+    reportAppend(buf, size, &len, "\n");
+
+    if (s_pending.used)
+        appendTimeline(buf, size, &len, "dialling", &s_pending);
+    for (i = 0; i < CALL_TIMELINE_MAX_CALLS; i++)
+        if (s_calls[i].used)
+            appendTimeline(buf, size, &len, "current", &s_calls[i]);
+
+    /* Most recent first. */
+    for (i = 1; i <= CALL_TIMELINE_HISTORY; i++) {
+        const callTimeline *t = &s_history[(s_historyNext - i +
+                                CALL_TIMELINE_HISTORY) % CALL_TIMELINE_HISTORY];
+
+        if (t->used)
+            appendTimeline(buf, size, &len, "recent", t);
+    }
+
+    timelineUnlock();
+
+    return len;
+}
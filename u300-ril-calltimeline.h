@@ -0,0 +1,67 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#ifndef U300_RIL_CALLTIMELINE_H
+#define U300_RIL_CALLTIMELINE_H 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Completed calls whose full timeline is kept for the report */
+#define CALL_TIMELINE_HISTORY               4
+
+/* Distinct exit causes counted, others are counted together */
+#define CALL_TIMELINE_MAX_CAUSES            16
+
+/* Size of the buffer needed by callTimelineReport() */
+#define CALL_TIMELINE_REPORT_MAX_LEN        4096
+
+typedef enum {
+    CALL_EVENT_DIAL_RECEIVED,   /* RIL_REQUEST_DIAL received */
+    CALL_EVENT_ATD_SENT,
+    CALL_EVENT_ATD_RESPONSE,    /* final response to ATD */
+    CALL_EVENT_CALLING,         /* *ECAV CALLING */
+    CALL_EVENT_CONNECTING,      /* *ECAV CONNECTING */
+    CALL_EVENT_INCOMING,        /* *ECAV WAITING or ALERTING, MT calls */
+    CALL_EVENT_ALERTING,        /* *EACE voice call start */
+    CALL_EVENT_COMFORT_TONE,    /* *EACE comfort tone start */
+    CALL_EVENT_ANSWER_RECEIVED, /* RIL_REQUEST_ANSWER received */
+    CALL_EVENT_ACTIVE,          /* *ECAV ACTIVE */
+    CALL_EVENT_HANGUP_RECEIVED, /* RIL_REQUEST_HANGUP received */
+    CALL_EVENT_RELEASED,        /* *ECAV RELEASED or BUSY */
+    CALL_EVENT_IDLE,            /* *ECAV IDLE, the call is gone */
+    CALL_NUM_EVENTS
+} callTimelineEvent;
+
+void callTimelineRecord(int ccid, callTimelineEvent event);
+void callTimelineEnd(int ccid, int cause);
+void callTimelineReset(void);
+
+int callTimelineReport(char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
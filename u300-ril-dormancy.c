@@ -0,0 +1,242 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include <telephony/ril.h>
+
+#include "atchannel.h"
+#include "u300-ril.h"
+#include "u300-ril-pdp.h"
+#include "u300-ril-pdpstats.h"
+#include "u300-ril-dormancy.h"
+
+#define LOG_TAG "RILV"
+#include <utils/Log.h>
+
+/*
+ * Fast dormancy.
+ *
+ * While data contexts are active, the packet counters of their interfaces
+ * are checked on the AUXILIARY queue. When no packets have been sent or
+ * received for the idle time, the modem is asked to release the signalling
+ * connection with RIL_FAST_DORMANCY_COMMAND (see Android.mk), instead of
+ * leaving the radio in a high power state until the network timers expire.
+ * The controller is disabled unless the command is configured.
+ *
+ * All state is only accessed from the AUXILIARY queue.
+ */
+#ifdef RIL_FAST_DORMANCY_COMMAND
+static const char *s_releaseCommand = RIL_FAST_DORMANCY_COMMAND;
+#else
+static const char *s_releaseCommand = NULL;
+#endif
+
+static dormancyPolicy s_policy;
+static bool s_policyInitialized = false;
+static struct timeval s_epoch;
+static unsigned long long s_lastPackets;
+static bool s_havePackets = false;
+static volatile int s_running = 0;
+
+/**
+ * Initialize the policy with the idle time to use while the screen is off.
+ */
+void dormancyPolicyInit(dormancyPolicy *p, long idleMs)
+{
+    memset(p, 0, sizeof(*p));
+    p->baseIdleMs = idleMs;
+    p->idleMs = idleMs;
+    p->releasedMs = -1;
+}
+
+/**
+ * Run the policy for one traffic check.
+ *
+ * \param nowMs: time of the check, on any monotonic scale.
+ * \param traffic: packets were sent or received since the previous check.
+ * \param screenOn: the screen is on, and the user may be about to send
+ *                  more data, so the idle time is longer.
+ * \param linkUp: the physical link is up, i.e. not already released.
+ * \return true if the connection should be released now.
+ *
+ * Traffic soon after a release (within one idle time) means the release
+ * cost more than it saved, so the idle time is doubled, up to
+ * DORMANCY_MAX_IDLE_FACTOR times the base. It is halved again after each
+ * release that held. No new release is requested before there has been
+ * traffic again.
+ */
+bool dormancyPolicyStep(dormancyPolicy *p, long nowMs, bool traffic,
+                        bool screenOn, bool linkUp)
+{
+    long idle = p->idleMs * (screenOn ? DORMANCY_SCREEN_ON_FACTOR : 1);
+
+    if (traffic) {
+        if (!p->armed && p->releasedMs >= 0) {
+            if (nowMs - p->releasedMs < idle) {
+                p->earlyWakeups++;
+                p->idleMs *= 2;
+                if (p->idleMs > p->baseIdleMs * DORMANCY_MAX_IDLE_FACTOR)
+                    p->idleMs = p->baseIdleMs * DORMANCY_MAX_IDLE_FACTOR;
+            } else if (p->idleMs > p->baseIdleMs) {
+                p->idleMs /= 2;
+            }
+        }
+        p->armed = true;
+        p->lastTrafficMs = nowMs;
+        return false;
+    }
+
+    if (!p->armed)
+        return false;
+
+    /* Released by the network already, nothing to do until next traffic. */
+    if (!linkUp) {
+        p->armed = false;
+        p->releasedMs = -1;
+        return false;
+    }
+
+    if (nowMs - p->lastTrafficMs < idle)
+        return false;
+
+    p->armed = false;
+    p->releasedMs = nowMs;
+    p->releases++;
+    return true;
+}
+
+/**
+ * Sums the packet counters of the interfaces of all active contexts.
+ *
+ * \return false if no context is active.
+ */
+static bool readPackets(unsigned long long *packets)
+{
+    pdpContextInfo list[RIL_MAX_NUMBER_OF_PDP_CONTEXTS];
+    unsigned long long value;
+    bool active = false;
+    int i;
+
+    pdpListSnapshot(list);
+
+    *packets = 0;
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
+        if (!list[i].inUse || list[i].active != 1)
+            continue;
+
+        active = true;
+        if (pdpStatsReadCounter(list[i].ifName, "rx_packets", &value) == 0)
+            *packets += value;
+        if (pdpStatsReadCounter(list[i].ifName, "tx_packets", &value) == 0)
+            *packets += value;
+    }
+
+    return active;
+}
+
+static void releaseConnection(long idleMs)
+{
+    ATResponse *atresponse = NULL;
+    int err;
+
+    err = at_send_command(s_releaseCommand, &atresponse);
+    if (err < 0 || atresponse->success == 0)
+        LOGW("%s(): %s failed", __func__, s_releaseCommand);
+    else
+        LOGI("%s(): released after %ld ms idle (%lu releases, "
+             "%lu early wake ups)", __func__, idleMs, s_policy.releases,
+             s_policy.earlyWakeups);
+
+    at_response_free(atresponse);
+}
+
+static void checkIdle(void *param)
+{
+    struct timeval now;
+    struct timeval next;
+    unsigned long long packets;
+    bool screenOn;
+    bool traffic;
+    long nowMs;
+    long interval;
+
+    if (!readPackets(&packets)) {
+        s_havePackets = false;
+        __sync_lock_release(&s_running);
+
+        /* A context may have been set up after the list was read. */
+        if (!readPackets(&packets) || __sync_lock_test_and_set(&s_running, 1))
+            return;
+    }
+
+    if (!s_policyInitialized) {
+        dormancyPolicyInit(&s_policy, RIL_FAST_DORMANCY_IDLE_MS);
+        gettimeofday(&s_epoch, NULL);
+        s_policyInitialized = true;
+    }
+
+    gettimeofday(&now, NULL);
+    nowMs = (now.tv_sec - s_epoch.tv_sec) * 1000 +
+            (now.tv_usec - s_epoch.tv_usec) / 1000;
+
+    /* The first check after contexts come up counts as traffic. */
+    traffic = !s_havePackets || packets != s_lastPackets;
+    s_lastPackets = packets;
+    s_havePackets = true;
+
+    screenOn = getScreenState();
+
+    if (dormancyPolicyStep(&s_policy, nowMs, traffic, screenOn,
+                           pdpReportedBearer() != 0))
+        releaseConnection(nowMs - s_policy.lastTrafficMs);
+
+    interval = s_policy.idleMs * (screenOn ? DORMANCY_SCREEN_ON_FACTOR : 1);
+
+    /* After a release, only traffic is of interest, so check less often. */
+    if (s_policy.armed)
+        interval /= DORMANCY_CHECKS_PER_IDLE;
+
+    next.tv_sec = interval / 1000;
+    next.tv_usec = (interval % 1000) * 1000;
+    enqueueRILEvent(CMD_QUEUE_AUXILIARY, checkIdle, NULL, &next);
+}
+
+/**
+ * Start watching for idle data contexts, if not already doing so. To be
+ * called when a data context has been set up. Checks stop by themselves
+ * when no context is active.
+ */
+void dormancyStart(void)
+{
+    if (s_releaseCommand == NULL)
+        return;
+
+    if (__sync_lock_test_and_set(&s_running, 1))
+        return;
+
+    enqueueRILEvent(CMD_QUEUE_AUXILIARY, checkIdle, NULL, NULL);
+}
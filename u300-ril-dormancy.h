@@ -0,0 +1,70 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#ifndef U300_RIL_DORMANCY_H
+#define U300_RIL_DORMANCY_H 1
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Idle time before the connection is released with the screen off */
+#ifndef RIL_FAST_DORMANCY_IDLE_MS
+#define RIL_FAST_DORMANCY_IDLE_MS           5000
+#endif
+
+/* The idle time is this many times longer while the screen is on */
+#define DORMANCY_SCREEN_ON_FACTOR           3
+
+/* Upper limit of the idle time after repeated early wake ups */
+#define DORMANCY_MAX_IDLE_FACTOR            8
+
+/* Traffic is checked this many times per idle time */
+#define DORMANCY_CHECKS_PER_IDLE            4
+
+/*
+ * State of the fast dormancy policy. The policy only looks at the values
+ * passed to dormancyPolicyStep(), so recorded traffic can be replayed
+ * through it offline.
+ */
+typedef struct dormancyPolicy {
+    long baseIdleMs;
+    long idleMs;            /* current idle time, grows on early wake ups */
+    bool armed;             /* traffic seen since the last release */
+    long lastTrafficMs;
+    long releasedMs;        /* time of the last release, -1 if none */
+    unsigned long releases;
+    unsigned long earlyWakeups;
+} dormancyPolicy;
+
+void dormancyPolicyInit(dormancyPolicy *p, long idleMs);
+bool dormancyPolicyStep(dormancyPolicy *p, long nowMs, bool traffic,
+                        bool screenOn, bool linkUp);
+
+void dormancyStart(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
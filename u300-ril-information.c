@@ -24,6 +24,7 @@
 #include "u300-ril-information.h"
 #include "u300-ril-network.h"
 #include "u300-ril.h"
+#include "u300-ril-pdp.h"
 #include <stdio.h>
 #include <pthread.h>
 #include <string.h>
@@ -215,6 +216,7 @@ void requestScreenState(void *data, size_t datalen, RIL_Token t)
             goto error;
         if (at_send_command("AT*EPSB=1", NULL) < 0)
             goto error;
+        pdpSetBearerReporting(true);
         if (at_send_command("AT+CMER=3,0,0,1", NULL) < 0)
             goto error;
         /*
@@ -236,6 +238,7 @@ void requestScreenState(void *data, size_t datalen, RIL_Token t)
 #endif
         if (at_send_command("AT+CGREG=0", NULL) < 0)
             LOGI("Failed to disable CGREG notifications");
+        pdpSetBearerReporting(false);
         if (at_send_command("AT*EPSB=0", NULL) < 0)
             LOGI("Failed to disable EPSB notifications");
         if (at_send_command("AT+CMER=3,0,0,0", NULL) < 0)
@@ -0,0 +1,356 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <telephony/ril.h>
+
+#include "atchannel.h"
+#include "at_tok.h"
+#include "u300-ril.h"
+#include "u300-ril-stk.h"
+#include "u300-ril-lchannel.h"
+
+#define LOG_TAG "RILV"
+#include <utils/Log.h>
+
+/*
+ * Pool of UICC logical channels, one per application id.
+ *
+ * Users acquire a channel by AID and get a handle that stays valid for as
+ * long as they hold it, even if the channel has to be reopened after a SIM
+ * reset. The modem session id behind a handle is looked up with
+ * lchannelResolve() before each AT+CGLA, together with an epoch that
+ * changes whenever the channel is reopened or another user has sent
+ * commands on it (lchannelMarkDirty()), so that state kept about the
+ * channel, like the selected file, can be dropped.
+ *
+ * Released channels are kept open for reuse, and the least recently used
+ * idle channel is closed when a new application needs a slot.
+ */
+typedef struct lchannelEntry {
+    int used;
+    char aid[LCHANNEL_MAX_AID_LEN + 1];
+    int handle;                 /* id handed out to users */
+    int session;                /* current modem session id, 0 if closed */
+    int refcount;
+    unsigned long lastUsed;
+    unsigned long epoch;
+} lchannelEntry;
+
+static lchannelEntry s_pool[LCHANNEL_POOL_SIZE];
+static unsigned long s_poolClock = 0;
+static unsigned long s_poolEpoch = 0;
+static pthread_mutex_t s_poolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Set from the AT reader thread, which can not take s_poolMutex since it
+ * is held while AT commands are in progress.
+ */
+static volatile int s_poolStale = 0;
+
+static void poolLock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_poolMutex)) != 0) {
+        LOGE("%s() failed to take pool mutex: %s!", __func__, strerror(err));
+        assert(0);
+    }
+}
+
+static void poolUnlock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_poolMutex)) != 0) {
+        LOGE("%s() failed to release pool mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static int openSession(const char *aid, int *session)
+{
+    ATResponse *atresponse = NULL;
+    char *cmd = NULL;
+    char *line;
+    int err;
+
+    asprintf(&cmd, "AT+CCHO=\"%s\"", aid);
+    if (cmd == NULL)
+        return -1;
+
+    err = at_send_command_singleline(cmd, "+CCHO:", &atresponse);
+    if (err < 0 || atresponse->success == 0) {
+        err = -1;
+        goto exit;
+    }
+
+    line = atresponse->p_intermediates->line;
+
+    err = at_tok_start(&line);
+    if (err < 0)
+        goto exit;
+
+    err = at_tok_nextint(&line, session);
+
+exit:
+    at_response_free(atresponse);
+    free(cmd);
+    return err;
+}
+
+static void closeSession(int session)
+{
+    ATResponse *atresponse = NULL;
+    char *cmd = NULL;
+    int err;
+
+    asprintf(&cmd, "AT+CCHC=%d", session);
+    if (cmd == NULL)
+        return;
+
+    err = at_send_command(cmd, &atresponse);
+    if (err < 0 || atresponse->success == 0)
+        LOGD("%s(): closing session %d failed", __func__, session);
+
+    at_response_free(atresponse);
+    free(cmd);
+}
+
+/*
+ * After a SIM reset or NAA session reset the modem session ids are no
+ * longer valid. Sessions are closed on a best effort basis, in case the
+ * card was not actually reset, and reopened when next resolved.
+ * Must be called with s_poolMutex held.
+ */
+static void checkStaleLocked(void)
+{
+    int i;
+
+    if (checkAndClear_SIM_NAA_SESSION_RESET())
+        s_poolStale = 1;
+
+    if (!s_poolStale)
+        return;
+
+    s_poolStale = 0;
+
+    for (i = 0; i < LCHANNEL_POOL_SIZE; i++) {
+        if (s_pool[i].used && s_pool[i].session != 0) {
+            closeSession(s_pool[i].session);
+            s_pool[i].session = 0;
+        }
+    }
+}
+
+static lchannelEntry *findHandleLocked(int handle)
+{
+    int i;
+
+    for (i = 0; i < LCHANNEL_POOL_SIZE; i++)
+        if (s_pool[i].used && s_pool[i].handle == handle)
+            return &s_pool[i];
+
+    return NULL;
+}
+
+/**
+ * Acquire the logical channel of an application, opening it if needed.
+ *
+ * \param aid: application id as hex string.
+ * \param handle: channel handle, to be passed to lchannelResolve() and
+ *                lchannelRelease().
+ * \return 0 on success, -1 if the channel could not be opened or all
+ *         channels are in use.
+ */
+int lchannelAcquire(const char *aid, int *handle)
+{
+    lchannelEntry *e = NULL;
+    int i;
+    int session;
+    int err = -1;
+
+    if (aid == NULL || strlen(aid) > LCHANNEL_MAX_AID_LEN)
+        return -1;
+
+    poolLock();
+
+    checkStaleLocked();
+
+    for (i = 0; i < LCHANNEL_POOL_SIZE; i++) {
+        if (s_pool[i].used && strcasecmp(s_pool[i].aid, aid) == 0) {
+            e = &s_pool[i];
+            break;
+        }
+    }
+
+    if (e == NULL) {
+        /* Take a free slot, or evict the least recently used idle one. */
+        for (i = 0; i < LCHANNEL_POOL_SIZE; i++) {
+            lchannelEntry *c = &s_pool[i];
+
+            if (!c->used) {
+                e = c;
+                break;
+            }
+            if (c->refcount == 0 &&
+                (e == NULL || c->lastUsed < e->lastUsed))
+                e = c;
+        }
+
+        if (e == NULL) {
+            LOGW("%s(): all %d logical channels are in use", __func__,
+                 LCHANNEL_POOL_SIZE);
+            goto exit;
+        }
+
+        if (e->used && e->session != 0) {
+            LOGD("%s(): evicting channel of %s", __func__, e->aid);
+            closeSession(e->session);
+        }
+
+        if (openSession(aid, &session) < 0) {
+            memset(e, 0, sizeof(*e));
+            goto exit;
+        }
+
+        memset(e, 0, sizeof(*e));
+        e->used = 1;
+        strcpy(e->aid, aid);
+        e->handle = session;
+        e->session = session;
+        e->epoch = ++s_poolEpoch;
+
+        /* Handles must stay unique even if the modem reuses session ids. */
+        for (i = 0; i < LCHANNEL_POOL_SIZE; i++) {
+            if (&s_pool[i] != e && s_pool[i].used &&
+                s_pool[i].handle == e->handle) {
+                e->handle += 0x100;
+                i = -1; /* start over */
+            }
+        }
+    }
+
+    e->refcount++;
+    e->lastUsed = ++s_poolClock;
+    *handle = e->handle;
+    err = 0;
+
+exit:
+    poolUnlock();
+    return err;
+}
+
+/**
+ * Release a channel acquired with lchannelAcquire(). The channel is kept
+ * open for later users of the same application.
+ */
+int lchannelRelease(int handle)
+{
+    lchannelEntry *e;
+    int err = -1;
+
+    poolLock();
+
+    e = findHandleLocked(handle);
+    if (e != NULL && e->refcount > 0) {
+        e->refcount--;
+        err = 0;
+    }
+
+    poolUnlock();
+    return err;
+}
+
+/**
+ * Get the modem session id to use with AT+CGLA for a channel handle. The
+ * channel is reopened if it was lost in a SIM reset.
+ * epoch may be NULL if the caller keeps no state about the channel.
+ *
+ * \return 0 on success, -1 if the handle is unknown or reopen failed.
+ */
+int lchannelResolve(int handle, int *session, unsigned long *epoch)
+{
+    lchannelEntry *e;
+    int err = -1;
+
+    poolLock();
+
+    checkStaleLocked();
+
+    e = findHandleLocked(handle);
+    if (e == NULL)
+        goto exit;
+
+    if (e->session == 0) {
+        LOGI("%s(): reopening channel of %s", __func__, e->aid);
+        if (openSession(e->aid, &e->session) < 0) {
+            e->session = 0;
+            goto exit;
+        }
+        e->epoch = ++s_poolEpoch;
+    }
+
+    e->lastUsed = ++s_poolClock;
+    *session = e->session;
+    if (epoch != NULL)
+        *epoch = e->epoch;
+    err = 0;
+
+exit:
+    poolUnlock();
+    return err;
+}
+
+/**
+ * Tell other users of a channel that its state, e.g. the selected file,
+ * may have been changed by commands sent through the handle.
+ */
+void lchannelMarkDirty(int handle)
+{
+    lchannelEntry *e;
+
+    poolLock();
+
+    e = findHandleLocked(handle);
+    if (e != NULL)
+        e->epoch = ++s_poolEpoch;
+
+    poolUnlock();
+}
+
+/**
+ * Mark all sessions as lost, e.g. on SIM reset or radio off. Safe to call
+ * from the AT reader thread; channels are reopened on next use.
+ */
+void lchannelInvalidateAll(void)
+{
+    s_poolStale = 1;
+}
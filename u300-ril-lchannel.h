@@ -0,0 +1,46 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#ifndef U300_RIL_LCHANNEL_H
+#define U300_RIL_LCHANNEL_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Logical channels kept open at the same time, see ETSI TS 102 221 */
+#define LCHANNEL_POOL_SIZE          3
+
+/* Longest application id (in hex characters), see ETSI TS 101 220 */
+#define LCHANNEL_MAX_AID_LEN        32
+
+int lchannelAcquire(const char *aid, int *handle);
+int lchannelRelease(int handle);
+int lchannelResolve(int handle, int *session, unsigned long *epoch);
+void lchannelMarkDirty(int handle);
+
+void lchannelInvalidateAll(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -536,7 +536,7 @@ static void *managerRunner(void *param)
     int ret;
     int i;
     pthread_attr_t attr;
-    struct queueArgs *queueArgs[RIL_MAX_NR_OF_CHANNELS] = { NULL, NULL };
+    struct queueArgs *queueArgs[RIL_MAX_NR_OF_CHANNELS] = { NULL, NULL, NULL };
 
     for(;;) {
         activeThreads = 0;
@@ -675,6 +675,7 @@ static void usage(char *s)
             "[-g <groups of RIL commands tied to separate AT channels>] "
             "[-p <primary channel argument>] "
             "[-s <secondary channel argument>] "
+            "[-d <data channel argument>] "
             "[-x <extra argument>] "
             "[-i <network interface>]\n", s);
     exit(-1);
@@ -701,7 +702,7 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc,
 
     s_rilenv = env;
 
-    while (-1 != (opt = getopt(argc, argv, "c:n:g:p:s:x:i:"))) {
+    while (-1 != (opt = getopt(argc, argv, "c:n:g:p:s:d:x:i:"))) {
         switch (opt) {
         case 'c':
             mgrArgs.type = optarg;
@@ -716,7 +717,8 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc,
             groups = optarg;
             mgrArgs.channels = parseGroups(groups, mgrArgs.parsedGroups);
             LOGI("RIL command group(s) "
-                "(DEFAULT and AUXILIARY may be omitted): %s", groups);
+                "(DEFAULT and AUXILIARY may be omitted, DATA is optional): %s",
+                groups);
             break;
 
         case 'p':
@@ -729,6 +731,11 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc,
             LOGI("Secondary AT channel: %s", mgrArgs.args[1]);
             break;
 
+        case 'd':
+            mgrArgs.args[2] = optarg;
+            LOGI("Data AT channel: %s", mgrArgs.args[2]);
+            break;
+
         case 'x':
             mgrArgs.xarg = optarg;
             LOGI("Extra argument %s.", mgrArgs.xarg);
@@ -26,15 +26,23 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdbool.h>
+#include <sys/time.h>
 #include <telephony/ril.h>
 #include "atchannel.h"
 #include "at_tok.h"
 #include "misc.h"
 #include "u300-ril.h"
+#include "u300-ril-sim.h"
+#include "u300-ril-simcache.h"
 
 #define LOG_TAG "RILV"
 #include <utils/Log.h>
 
+/* SIM files the modem updates behind the SIM I/O cache */
+#define EF_SMS  0x6F3C
+#define EF_SMSS 0x6F43
+
 void onNewStatusReport(const char *sms_pdu)
 {
     char *response = NULL;
@@ -71,6 +79,16 @@ error:
     return;
 }
 
+/**
+ * Drops cached EF_SMS and EF_SMSS content after the modem stored,
+ * wrote or deleted a message on the SIM.
+ */
+static void invalidateSmsOnSim(void)
+{
+    simCacheInvalidateFile(EF_SMS);
+    simCacheInvalidateFile(EF_SMSS);
+}
+
 void onNewSmsOnSIM(const char *s)
 {
     char *line;
@@ -92,6 +110,8 @@ void onNewSmsOnSIM(const char *s)
     if (strncmp(mem, "SM", 2) != 0)
         goto error;
 
+    invalidateSmsOnSim();
+
     err = at_tok_nextint(&tok, &index);
     if (err < 0)
         goto error;
@@ -309,52 +329,90 @@ error:
 }
 
 /*
- * Returns: 0 if FDN is not enabled
- *          1 if FDN is enabled
+ * Multipart messages are sent with the SMS relay protocol link held open
+ * between parts by AT+CMMS=1 (3GPP TS 27.005 3.5.6). In that mode the
+ * modem closes the link by itself 1-5 s after the last +CMGS response, so
+ * a message whose last part never comes can not hold the link; mode 2 is
+ * not used for that reason. The link is closed with AT+CMMS=0 right after
+ * the last part, instead of waiting for that timeout.
+ *
+ * Only accessed from the queue serving the SMS send requests.
  */
-static int isFdnEnabled(void)
+#define SMS_LINK_MIN_TIMEOUT_MS 1000
+#define SMS_LINK_MAX_TIMEOUT_MS 5000
+
+/* Message references of this many parts are logged */
+#define SMS_MAX_LOGGED_PARTS 16
+
+/* Hex length of SMSC address (12 octets) and TPDU (164 octets) */
+#define SMS_MAX_PDU_HEX_LEN ((12 + 164) * 2)
+
+static struct {
+    bool held;                  /* AT+CMMS=1 sent for this message */
+    struct timeval lastResponse;
+    struct timeval start;
+    int parts;
+    int refs[SMS_MAX_LOGGED_PARTS];
+} s_smsLink;
+
+static long msSince(const struct timeval *then)
 {
-    int err = -1;
-    int status = 0;
-    char *line = NULL;
-    ATResponse *atresponse = NULL;
+    struct timeval now;
 
-    err = at_send_command_multiline("AT+CLCK=\"FD\",2", "+CLCK:", &atresponse);
-    if (err < 0 || atresponse->success == 0)
-        goto finally;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - then->tv_sec) * 1000 +
+           (now.tv_usec - then->tv_usec) / 1000;
+}
 
-    line = atresponse->p_intermediates->line;
+/**
+ * Hold the relay link for the next part, unless the modem still holds it
+ * from the previous one.
+ */
+static void holdSMSLink(void)
+{
+    if (s_smsLink.held &&
+        msSince(&s_smsLink.lastResponse) < SMS_LINK_MIN_TIMEOUT_MS)
+        return;
 
-    err = at_tok_start(&line);
-    if (err < 0)
-        goto finally;
+    /* Errors are ignored, since the SMS has to be sent anyway. */
+    (void)at_send_command("AT+CMMS=1", NULL);
+
+    if (!s_smsLink.held) {
+        gettimeofday(&s_smsLink.start, NULL);
+        s_smsLink.parts = 0;
+    }
+    s_smsLink.held = true;
+}
 
-    err = at_tok_nextint(&line, &status);
-    if (err < 0 )
-        goto finally;
+static void releaseSMSLink(void)
+{
+    long ms = msSince(&s_smsLink.start);
+    char refs[SMS_MAX_LOGGED_PARTS * 4 + 1] = "";
+    size_t len = 0;
+    int i;
 
-    /* status = 1 means that FDN facility is active */
-    if (status != 1)
-        status = 0;
+    (void)at_send_command("AT+CMMS=0", NULL);
+    s_smsLink.held = false;
 
-finally:
-    at_response_free(atresponse);
-    return status;
+    for (i = 0; i < s_smsLink.parts && i < SMS_MAX_LOGGED_PARTS; i++)
+        reportAppend(refs, sizeof(refs), &len, " %d", s_smsLink.refs[i]);
+
+    LOGI("%s(): %d parts sent in %ld ms (%ld parts/s), message refs:%s",
+         __func__, s_smsLink.parts, ms,
+         ms > 0 ? s_smsLink.parts * 1000L / ms : 0L, refs);
 }
 
 /**
- * RIL_REQUEST_SEND_SMS
- *
- * Sends an SMS message.
+ * Send one SMS-SUBMIT with AT+CMGS and complete its request.
  */
-void requestSendSMS(void *data, size_t datalen, RIL_Token t)
+static void sendSMS(void *data, RIL_Token t, bool expectMore)
 {
     int err;
     const char *smsc;
     const char *pdu;
     char *line;
-    int tpLayerLength;
-    char *cmd1, *cmd2;
+    char cmd1[sizeof("AT+CMGS=") + 4];
+    char cmd2[SMS_MAX_PDU_HEX_LEN + 1];
     RIL_SMS_Response response;
     RIL_Errno ret = RIL_E_GENERIC_FAILURE;
     ATResponse *atresponse = NULL;
@@ -363,18 +421,31 @@ void requestSendSMS(void *data, size_t datalen, RIL_Token t)
     smsc = ((const char **) data)[0];
     pdu = ((const char **) data)[1];
 
-    tpLayerLength = strlen(pdu) / 2;
-
     /* NULL for default SMSC. */
     if (smsc == NULL)
         smsc = "00";
 
-    asprintf(&cmd1, "AT+CMGS=%d", tpLayerLength);
-    asprintf(&cmd2, "%s%s", smsc, pdu);
+    if (pdu == NULL ||
+        strlen(smsc) + strlen(pdu) >= sizeof(cmd2)) {
+        LOGE("%s(): PDU too long", __func__);
+        goto error;
+    }
+
+    snprintf(cmd1, sizeof(cmd1), "AT+CMGS=%d", (int) strlen(pdu) / 2);
+    snprintf(cmd2, sizeof(cmd2), "%s%s", smsc, pdu);
+
+    /* A message that never got its last part, the modem closed the link. */
+    if (s_smsLink.held &&
+        msSince(&s_smsLink.lastResponse) > SMS_LINK_MAX_TIMEOUT_MS)
+        s_smsLink.held = false;
+
+    if (expectMore)
+        holdSMSLink();
 
     err = at_send_command_sms(cmd1, cmd2, "+CMGS:", &atresponse);
-    free(cmd1);
-    free(cmd2);
+
+    if (s_smsLink.held)
+        gettimeofday(&s_smsLink.lastResponse, NULL);
 
     if (err != 0) {
         goto error;
@@ -410,10 +481,18 @@ void requestSendSMS(void *data, size_t datalen, RIL_Token t)
     if (err < 0)
         goto error;
 
+    if (s_smsLink.held && s_smsLink.parts < SMS_MAX_LOGGED_PARTS)
+        s_smsLink.refs[s_smsLink.parts] = response.messageRef;
+
     /* ackPDU is not supported */
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, &response, sizeof(response));
 finally:
+    if (s_smsLink.held) {
+        s_smsLink.parts++;
+        if (!expectMore)
+            releaseSMSLink();
+    }
     at_response_free(atresponse);
     return;
 
@@ -422,6 +501,39 @@ error:
     goto finally;
 }
 
+/**
+ * Send the parts of a multipart message that are already queued behind the
+ * current one right away, without a round through the request queue.
+ */
+static void sendQueuedSMSParts(void)
+{
+    RILRequest *r;
+    bool last = false;
+
+    while (!last) {
+        r = takeQueuedRequest(RIL_REQUEST_SEND_SMS_EXPECT_MORE);
+        if (r == NULL) {
+            r = takeQueuedRequest(RIL_REQUEST_SEND_SMS);
+            if (r == NULL)
+                break;
+            last = true;
+        }
+
+        sendSMS(r->data, r->token, !last);
+        freeQueuedRequest(r);
+    }
+}
+
+/**
+ * RIL_REQUEST_SEND_SMS
+ *
+ * Sends an SMS message.
+ */
+void requestSendSMS(void *data, size_t datalen, RIL_Token t)
+{
+    sendSMS(data, t, false);
+}
+
 /**
  * RIL_REQUEST_SEND_SMS_EXPECT_MORE
  *
@@ -431,11 +543,8 @@ error:
  */
 void requestSendSMSExpectMore(void *data, size_t datalen, RIL_Token t)
 {
-    /* Throw the command on the channel and ignore any errors, since we
-       need to send the SMS anyway and subsequent SMSes will be sent anyway. */
-    (void)at_send_command("AT+CMMS=1", NULL);
-
-    requestSendSMS(data, datalen, t);
+    sendSMS(data, t, true);
+    sendQueuedSMSParts();
 }
 
 /**
@@ -516,6 +625,7 @@ void requestWriteSmsToSim(void *data, size_t datalen, RIL_Token t)
     err = at_send_command_sms(cmd, pdu, "+CMGW:", &atresponse);
     free(cmd);
     free(pdu);
+    invalidateSmsOnSim();
 
     if (err < 0 || atresponse->success == 0)
         goto error;
@@ -558,6 +668,7 @@ void requestDeleteSmsOnSim(void *data, size_t datalen, RIL_Token t)
     asprintf(&cmd, "AT+CMGD=%d", ((int *) data)[0]);
     err = at_send_command(cmd, &atresponse);
     free(cmd);
+    invalidateSmsOnSim();
     if (err < 0 || atresponse->success == 0)
         RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
     else
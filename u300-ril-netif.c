@@ -26,9 +26,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <net/if.h>
 #include <net/if_arp.h>
+#include <netinet/in.h>
 #include <linux/rtnetlink.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <linux/caif/if_caif.h>
@@ -47,6 +52,19 @@
 #define MAX_PAD_SIZE 1024
 #define MAX_BUF_SIZE 4096
 
+/* IPv4 addresses of an interface that are replaced in one configuration */
+#define MAX_OLD_ADDRESSES 4
+
+/* How long to wait for the link to be running after configuration */
+#define LINK_RUNNING_WAIT_MS 1000
+
+/* How long to wait for the answers to a transaction */
+#define RTNL_RESPONSE_TIMEOUT_MS 5000
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
 struct iplink_req {
     struct nlmsghdr n;
     struct ifinfomsg i;
@@ -55,8 +73,66 @@ struct iplink_req {
     char ifname[MAX_IFNAME_LEN];
 };
 
+/*
+ * State of one netlink transaction: one or more requests sent at once,
+ * with sequence numbers first_seq up to first_seq + count - 1, each of
+ * which is answered by an ACK, or NLMSG_DONE for dumps.
+ */
+struct rtnl_txn {
+    __u32 first_seq;
+    int count;
+    int answered;
+    int error;
+
+    /* Link to report on: ifindex, or ifname when creating (ifindex 0) */
+    struct iplink_req *req;
+    int ifindex;
+    unsigned flags;
+    bool seen;
+
+    /* Addresses found by an address dump */
+    int num_addrs;
+    struct in_addr addrs[MAX_OLD_ADDRESSES];
+    unsigned char prefixlens[MAX_OLD_ADDRESSES];
+};
+
+/*
+ * One netlink route socket is kept open for the whole process.
+ * Transactions are serialized by s_rtnlMutex. The socket is only
+ * subscribed to link events during the transactions that need them (to
+ * find a created interface, or to tell when a link is running), so that
+ * events of other interfaces do not fill its receive buffer in between.
+ * Whatever is left in the buffer is dropped before each request.
+ */
+static int s_rtnlSocket = -1;
+static pthread_mutex_t s_rtnlMutex = PTHREAD_MUTEX_INITIALIZER;
 static __u32 ipconfig_seqnr = 1;
 
+/* Requests of a transaction are built here, with s_rtnlMutex held. */
+static uint8_t s_batch[MAX_BUF_SIZE];
+
+static void rtnl_lock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_rtnlMutex)) != 0) {
+        LOGE("%s() failed to take netlink mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void rtnl_unlock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_rtnlMutex)) != 0) {
+        LOGE("%s() failed to release netlink mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
 static bool get_ifname(struct ifinfomsg *msg, int bytes,
                       const char **ifname)
 {
@@ -76,41 +152,106 @@ static bool get_ifname(struct ifinfomsg *msg, int bytes,
     return false;
 }
 
-static void handle_rtnl_response(struct iplink_req *req, unsigned short type,
-                                 int index, unsigned flags, unsigned change,
-                                 struct ifinfomsg *msg, int bytes)
+static void handle_link_message(struct rtnl_txn *txn, struct ifinfomsg *msg,
+                                int bytes)
 {
     const char *ifname = NULL;
 
     get_ifname(msg, bytes, &ifname);
-    req->ifindex = index;
-    strncpy(req->ifname, ifname, sizeof(req->ifname));
-    req->ifname[sizeof(req->ifname)-1] = '\0';
+
+    if (txn->ifindex == 0 && txn->req != NULL && ifname != NULL) {
+        /* Interface being created, look for its name unless a pattern. */
+        if (strchr(txn->req->ifname, '%') == NULL &&
+            strncmp(txn->req->ifname, ifname, MAX_IFNAME_LEN) != 0)
+            return;
+
+        txn->ifindex = msg->ifi_index;
+        txn->req->ifindex = msg->ifi_index;
+        strncpy(txn->req->ifname, ifname, sizeof(txn->req->ifname));
+        txn->req->ifname[sizeof(txn->req->ifname) - 1] = '\0';
+    }
+
+    if (msg->ifi_index == txn->ifindex) {
+        txn->flags = msg->ifi_flags;
+        txn->seen = true;
+    }
+}
+
+static void handle_addr_message(struct rtnl_txn *txn, struct ifaddrmsg *msg,
+                                int bytes)
+{
+    struct rtattr *attr;
+
+    if (msg->ifa_family != AF_INET || (int) msg->ifa_index != txn->ifindex)
+        return;
+
+    for (attr = IFA_RTA(msg); RTA_OK(attr, bytes);
+         attr = RTA_NEXT(attr, bytes)) {
+        if (attr->rta_type != IFA_LOCAL ||
+            txn->num_addrs >= MAX_OLD_ADDRESSES)
+            continue;
+
+        memcpy(&txn->addrs[txn->num_addrs], RTA_DATA(attr),
+               sizeof(struct in_addr));
+        txn->prefixlens[txn->num_addrs] = msg->ifa_prefixlen;
+        txn->num_addrs++;
+    }
+}
+
+/*
+ * Drops anything left in the receive buffer, such as link events or
+ * answers to a failed transaction.
+ */
+static void drain_rtnl(int sk)
+{
+    uint8_t buf[MAX_BUF_SIZE];
+    int ret;
+
+    do {
+        ret = recv(sk, buf, sizeof(buf), MSG_DONTWAIT);
+    } while (ret > 0 || (ret < 0 && (errno == EINTR || errno == ENOBUFS)));
+}
+
+/**
+ * Subscribes to or unsubscribes from link events.
+ * Returns -1 and sets errno on errors.
+ */
+static int subscribe_link_events(int sk, bool subscribe)
+{
+    int group = RTNLGRP_LINK;
+
+    return setsockopt(sk, SOL_NETLINK, subscribe ? NETLINK_ADD_MEMBERSHIP :
+                      NETLINK_DROP_MEMBERSHIP, &group, sizeof(group));
 }
 
 /**
  * Returns -1 and sets errno on errors.
  */
-static int send_iplink_req(int sk, struct iplink_req *req)
+static int send_rtnl_messages(int sk, const void *buf, size_t len)
 {
     struct sockaddr_nl addr;
 
+    drain_rtnl(sk);
+
     memset(&addr, 0, sizeof(addr));
     addr.nl_family = AF_NETLINK;
 
-    return sendto(sk, req, req->n.nlmsg_len, 0,
-                  (struct sockaddr *) &addr, sizeof(addr));
+    return sendto(sk, buf, len, 0, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+static bool in_txn(const struct rtnl_txn *txn, __u32 seq)
+{
+    return seq - txn->first_seq < (__u32) txn->count;
 }
 
 /**
- * Returns 0 on receiving an ACK message;
- * Negative on error;
- * Positive otherwise.
+ * Handles the messages of one read. Answers to the transaction are counted
+ * and the first error kept; link events are used to follow the link.
+ * Returns 0 when all requests are answered, negative on error, positive
+ * otherwise.
  */
-static int parse_rtnl_message(uint8_t *buf, size_t len, struct iplink_req *req)
+static int parse_rtnl_message(uint8_t *buf, size_t len, struct rtnl_txn *txn)
 {
-    struct ifinfomsg *msg;
-
     while (len > 0) {
         struct nlmsghdr *hdr = (struct nlmsghdr *)buf;
         struct nlmsgerr *err;
@@ -118,54 +259,74 @@ static int parse_rtnl_message(uint8_t *buf, size_t len, struct iplink_req *req)
         if (!NLMSG_OK(hdr, len))
             return -EBADMSG;
 
-        if (hdr->nlmsg_type == NLMSG_ERROR) {
+        switch (hdr->nlmsg_type) {
+        case NLMSG_ERROR:
+            if (!in_txn(txn, hdr->nlmsg_seq))
+                break;
+
             err = NLMSG_DATA(hdr);
-            if (err->error)
+            if (err->error && txn->error == 0) {
                 LOGE("%s(): RTNL failed: seq:%d, error %d(%s)\n", __func__,
                       hdr->nlmsg_seq, err->error, strerror(-err->error));
+                txn->error = err->error;
+            }
+            txn->answered++;
+            break;
+
+        case NLMSG_DONE:
+            if (in_txn(txn, hdr->nlmsg_seq))
+                txn->answered++;
+            break;
 
-            return err->error;
-        } else if (hdr->nlmsg_type == RTM_NEWLINK ||
-                   hdr->nlmsg_type == RTM_DELLINK) {
-            msg = (struct ifinfomsg *) NLMSG_DATA(hdr);
-            handle_rtnl_response(req, msg->ifi_type,
-                                 msg->ifi_index, msg->ifi_flags,
-                                 msg->ifi_change, msg,
-                                 IFA_PAYLOAD(hdr));
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+            handle_link_message(txn, NLMSG_DATA(hdr), IFLA_PAYLOAD(hdr));
+            break;
+
+        case RTM_NEWADDR:
+            if (in_txn(txn, hdr->nlmsg_seq))
+                handle_addr_message(txn, NLMSG_DATA(hdr), IFA_PAYLOAD(hdr));
+            break;
+
+        default:
+            break;
         }
 
-        len -= hdr->nlmsg_len;
-        buf += hdr->nlmsg_len;
+        len -= NLMSG_ALIGN(hdr->nlmsg_len);
+        buf += NLMSG_ALIGN(hdr->nlmsg_len);
     }
 
-    return 1;
+    return txn->answered < txn->count ? 1 : 0;
 }
 
 /**
- * Returns 0 on success; On failure, errno is set and a negative value returned.
+ * Reads from the netlink socket for at most timeout_ms, -1 to block.
+ * Returns the number of bytes read, 0 on timeout; on failure, errno is set
+ * and -1 returned.
  */
-static int netlink_get_response(int sk, struct iplink_req *req)
+static int read_rtnl(int sk, uint8_t *buf, int timeout_ms)
 {
-    unsigned char *buf;
+    struct pollfd pfd;
     int ret;
 
-    buf = malloc(MAX_BUF_SIZE);
-    assert(buf != NULL);
+    for (;;) {
+        pfd.fd = sk;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return ret;
 
-    /*
-     * Loops until an ACK message is received (i.e. parse_rtnl_message
-     * returns 0) or an error occurs.
-     */
-    do {
         ret = read(sk, buf, MAX_BUF_SIZE);
-        if (ret < 0) {
-            if (errno == EINTR) {
-                ret = 1;
-                continue;
-            }
-            else
-                break;
-        }
+        if (ret < 0 && errno == EINTR)
+            continue;
+
+        /* Link events were dropped while idle, nothing to worry about. */
+        if (ret < 0 && errno == ENOBUFS)
+            continue;
 
         /*
          * EOF is treated as error. This may happen when no process
@@ -176,18 +337,101 @@ static int netlink_get_response(int sk, struct iplink_req *req)
             LOGW("EOF received.\n");
             errno = EIO;
             ret = -1;
-            break;
         }
 
-        ret = parse_rtnl_message(buf, ret, req);
+        return ret;
+    }
+}
+
+/**
+ * Waits until all requests of the transaction are answered, for at most
+ * RTNL_RESPONSE_TIMEOUT_MS. An answer may have been dropped by the kernel
+ * if the receive buffer was full, so the transaction fails with ETIMEDOUT
+ * rather than waiting forever, and the socket is reopened.
+ * Returns 0 on success; On failure, errno is set and a negative value
+ * returned.
+ */
+static int netlink_get_response(int sk, struct rtnl_txn *txn)
+{
+    struct timeval start, now;
+    uint8_t *buf;
+    int elapsed = 0;
+    int ret;
+
+    buf = malloc(MAX_BUF_SIZE);
+    assert(buf != NULL);
+
+    gettimeofday(&start, NULL);
+
+    do {
+        ret = read_rtnl(sk, buf, RTNL_RESPONSE_TIMEOUT_MS - elapsed);
+        if (ret == 0) {
+            LOGE("%s(): no answer from netlink, %d of %d requests "
+                 "answered\n", __func__, txn->answered, txn->count);
+            errno = ETIMEDOUT;
+            ret = -1;
+        }
         if (ret < 0)
+            goto exit;
+
+        gettimeofday(&now, NULL);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                  (now.tv_usec - start.tv_usec) / 1000;
+        if (elapsed > RTNL_RESPONSE_TIMEOUT_MS)
+            elapsed = RTNL_RESPONSE_TIMEOUT_MS;
+
+        ret = parse_rtnl_message(buf, ret, txn);
+        if (ret < 0) {
             errno = -ret;
+            goto exit;
+        }
     } while (ret > 0);
 
+    if (txn->error != 0) {
+        errno = -txn->error;
+        ret = txn->error;
+    }
+
+exit:
     free(buf);
     return ret;
 }
 
+/**
+ * Waits for the link of the transaction to be up and running, for at most
+ * timeout_ms. Returns true if it is.
+ */
+static bool wait_link_running(int sk, struct rtnl_txn *txn, int timeout_ms)
+{
+    struct timeval start, now;
+    uint8_t *buf;
+    int elapsed = 0;
+    int ret;
+
+    buf = malloc(MAX_BUF_SIZE);
+    assert(buf != NULL);
+
+    gettimeofday(&start, NULL);
+
+    while (!(txn->seen && (txn->flags & (IFF_UP | IFF_RUNNING)) ==
+                          (IFF_UP | IFF_RUNNING)) &&
+           elapsed < timeout_ms) {
+        ret = read_rtnl(sk, buf, timeout_ms - elapsed);
+        if (ret <= 0)
+            break;
+
+        (void) parse_rtnl_message(buf, ret, txn);
+
+        gettimeofday(&now, NULL);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                  (now.tv_usec - start.tv_usec) / 1000;
+    }
+
+    free(buf);
+    return txn->seen && (txn->flags & (IFF_UP | IFF_RUNNING)) ==
+                        (IFF_UP | IFF_RUNNING);
+}
+
 static void add_attribute(struct nlmsghdr *n, int maxlen, int type,
                          const void *data, int datalen)
 {
@@ -209,6 +453,82 @@ static void add_attribute(struct nlmsghdr *n, int maxlen, int type,
     return;
 }
 
+/**
+ * Appends a new message with a header of hdrlen bytes to a batch.
+ * Returns NULL if the batch is full.
+ */
+static struct nlmsghdr *add_message(uint8_t *batch, size_t *used,
+                                    int type, int flags, size_t hdrlen,
+                                    const void *hdr)
+{
+    struct nlmsghdr *n;
+
+    /* Leave room for a few attributes */
+    if (*used + NLMSG_SPACE(hdrlen) + 64 > MAX_BUF_SIZE)
+        return NULL;
+
+    n = (struct nlmsghdr *) (batch + *used);
+    memset(n, 0, NLMSG_SPACE(hdrlen));
+    n->nlmsg_len = NLMSG_LENGTH(hdrlen);
+    n->nlmsg_type = type;
+    n->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    n->nlmsg_seq = ipconfig_seqnr++;
+    memcpy(NLMSG_DATA(n), hdr, hdrlen);
+
+    return n;
+}
+
+static void end_message(uint8_t *batch, size_t *used, struct nlmsghdr *n)
+{
+    *used = ((uint8_t *) n - batch) + NLMSG_ALIGN(n->nlmsg_len);
+}
+
+static void add_link_flags(uint8_t *batch, size_t *used, int ifindex,
+                           bool up, int mtu)
+{
+    struct ifinfomsg ifi;
+    struct nlmsghdr *n;
+
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = ifindex;
+    ifi.ifi_change = IFF_UP;
+    ifi.ifi_flags = up ? IFF_UP : 0;
+
+    n = add_message(batch, used, RTM_NEWLINK, 0, sizeof(ifi), &ifi);
+    assert(n != NULL);
+
+    if (mtu > 0)
+        add_attribute(n, MAX_BUF_SIZE - ((uint8_t *) n - batch),
+                      IFLA_MTU, &mtu, sizeof(mtu));
+
+    end_message(batch, used, n);
+}
+
+static void add_address(uint8_t *batch, size_t *used, int type, int flags,
+                        int ifindex, struct in_addr addr,
+                        unsigned char prefixlen)
+{
+    struct ifaddrmsg ifa;
+    struct nlmsghdr *n;
+
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = AF_INET;
+    ifa.ifa_prefixlen = prefixlen;
+    ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+    ifa.ifa_index = ifindex;
+
+    n = add_message(batch, used, type, flags, sizeof(ifa), &ifa);
+    assert(n != NULL);
+
+    add_attribute(n, MAX_BUF_SIZE - ((uint8_t *) n - batch),
+                  IFA_LOCAL, &addr, sizeof(addr));
+    add_attribute(n, MAX_BUF_SIZE - ((uint8_t *) n - batch),
+                  IFA_ADDRESS, &addr, sizeof(addr));
+
+    end_message(batch, used, n);
+}
+
 /**
  * Sets errno and returns -1 on error.
  */
@@ -259,7 +579,10 @@ static int create_caif_interface(int sk, struct iplink_req *req,
 
     linkinfo->rta_len = (uint8_t *)NLMSG_TAIL(&req->n) - (uint8_t *)linkinfo;
 
-    return send_iplink_req(sk, req);
+    strncpy(req->ifname, ifname, sizeof(req->ifname));
+    req->ifname[sizeof(req->ifname) - 1] = '\0';
+
+    return send_rtnl_messages(sk, req, req->n.nlmsg_len);
 }
 
 static int destroy_caif_interface(int sk, struct iplink_req *req,
@@ -277,7 +600,7 @@ static int destroy_caif_interface(int sk, struct iplink_req *req,
         add_attribute(&req->n, sizeof(*req), IFLA_IFNAME,
                       ifname, strlen(ifname));
 
-    return send_iplink_req(sk, req);
+    return send_rtnl_messages(sk, req, req->n.nlmsg_len);
 }
 
 /**
@@ -296,7 +619,7 @@ static int rtnl_init(void)
 
     memset(&addr, 0, sizeof(addr));
     addr.nl_family = AF_NETLINK;
-    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE;
+    addr.nl_groups = 0;
 
     ret = bind(sk, (struct sockaddr *) &addr, sizeof(addr));
 
@@ -318,6 +641,49 @@ exit:
     return sk;
 }
 
+/*
+ * Returns the shared netlink socket, opening it if needed. Must be called
+ * with s_rtnlMutex held.
+ */
+static int rtnl_socket(void)
+{
+    if (s_rtnlSocket < 0)
+        s_rtnlSocket = rtnl_init();
+
+    return s_rtnlSocket;
+}
+
+/*
+ * Drops the shared socket after a failed transaction, so that no answers
+ * to it are left for the next one. A new socket is opened on next use.
+ * Otherwise link events are unsubscribed from, if the transaction needed
+ * them. Must be called with s_rtnlMutex held.
+ */
+static void rtnl_check_socket(int ret)
+{
+    if (ret >= 0 && s_rtnlSocket >= 0 &&
+        subscribe_link_events(s_rtnlSocket, false) < 0) {
+        LOGW("%s(): failed to unsubscribe from link events: %s", __func__,
+             strerror(errno));
+        ret = -1;
+    }
+
+    if (ret < 0 && s_rtnlSocket >= 0) {
+        /* errno may be clobbered by a successful close. */
+        int old_errno = errno;
+        close(s_rtnlSocket);
+        s_rtnlSocket = -1;
+        errno = old_errno;
+    }
+}
+
+static void txn_start(struct rtnl_txn *txn, int count)
+{
+    memset(txn, 0, sizeof(*txn));
+    txn->first_seq = ipconfig_seqnr;
+    txn->count = count;
+}
+
 /* Note ifname is in/out and must be minimum size 16 */
 int rtnl_create_caif_interface(int type, int conn_id,
                                char ifname[MAX_IFNAME_LEN],
@@ -325,21 +691,32 @@ int rtnl_create_caif_interface(int type, int conn_id,
 {
     int sk, ret;
     struct iplink_req *req;
+    struct rtnl_txn txn;
 
     req = malloc(sizeof(*req));
     assert(req != NULL);
     memset(req, 0, sizeof(*req));
 
-    sk = rtnl_init();
+    rtnl_lock();
+
+    sk = rtnl_socket();
     ret = sk;
     if (sk < 0)
         goto exit;
 
+    txn_start(&txn, 1);
+    txn.req = req;
+
+    /* The new interface is found from its link event. */
+    ret = subscribe_link_events(sk, true);
+    if (ret < 0)
+        goto exit;
+
     ret = create_caif_interface(sk, req, type, ifname, conn_id, loop);
     if (ret < 0)
         goto exit;
 
-    ret = netlink_get_response(sk, req);
+    ret = netlink_get_response(sk, &txn);
     if (ret < 0)
         goto exit;
 
@@ -348,7 +725,8 @@ int rtnl_create_caif_interface(int type, int conn_id,
     *ifindex = req->ifindex;
 
 exit:
-    close(sk);
+    rtnl_check_socket(ret);
+    rtnl_unlock();
     free(req);
     return ret;
 }
@@ -356,27 +734,200 @@ exit:
 int rtnl_delete_caif_interface(int ifid, char *name)
 {
     struct iplink_req req;
+    struct rtnl_txn txn;
     int sk, ret;
 
     memset(&req, 0, sizeof(req));
 
-    sk = rtnl_init();
-    ret = sk;
+    rtnl_lock();
 
+    sk = rtnl_socket();
+    ret = sk;
     if (sk < 0)
-        return ret;
+        goto exit;
+
+    txn_start(&txn, 1);
 
     ret = destroy_caif_interface(sk, &req, ifid, name);
     if (ret < 0)
         goto exit;
 
-    ret = netlink_get_response(sk, &req);
+    ret = netlink_get_response(sk, &txn);
     if (ret < 0)
         goto exit;
 
     ret = 0;
 
 exit:
-    close(sk);
+    rtnl_check_socket(ret);
+    rtnl_unlock();
+    return ret;
+}
+
+static unsigned char netmask_to_prefixlen(in_addr_t netmask)
+{
+    uint32_t mask = ntohl(netmask);
+    unsigned char len = 0;
+
+    while (mask & 0x80000000) {
+        len++;
+        mask <<= 1;
+    }
+
+    return len;
+}
+
+/*
+ * Finds the IPv4 addresses of an interface, to be replaced.
+ * Must be called with s_rtnlMutex held.
+ */
+static int get_ipv4_addresses(int sk, struct rtnl_txn *txn)
+{
+    struct ifaddrmsg ifa;
+    struct nlmsghdr *n;
+    int ret;
+
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = AF_INET;
+
+    txn->first_seq = ipconfig_seqnr;
+    txn->count = 1;
+    txn->answered = 0;
+
+    /* The dump is answered by NLMSG_DONE, not by an ACK. */
+    n = (struct nlmsghdr *) s_batch;
+    memset(n, 0, NLMSG_SPACE(sizeof(ifa)));
+    n->nlmsg_len = NLMSG_LENGTH(sizeof(ifa));
+    n->nlmsg_type = RTM_GETADDR;
+    n->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    n->nlmsg_seq = ipconfig_seqnr++;
+    memcpy(NLMSG_DATA(n), &ifa, sizeof(ifa));
+
+    ret = send_rtnl_messages(sk, s_batch, n->nlmsg_len);
+    if (ret < 0)
+        return ret;
+
+    return netlink_get_response(sk, txn);
+}
+
+/**
+ * Configures an interface for IPv4 in one netlink transaction: the link is
+ * taken down, old addresses are replaced with the new one, the MTU is set
+ * (if mtu > 0) and the link is brought up. Routes are left to the
+ * framework, which gets the gateway from the net.<ifname>.gw property.
+ *
+ * Returns 0 on success, sets errno and returns negative on error.
+ * *running is set if the link was up and running before returning.
+ */
+int rtnl_configure_ipv4(const char *ifname, in_addr_t address,
+                        in_addr_t netmask, int mtu, bool *running)
+{
+    size_t used = 0;
+    struct rtnl_txn txn;
+    struct in_addr addr;
+    unsigned char prefixlen = netmask_to_prefixlen(netmask);
+    int ifindex;
+    __u32 first_seq;
+    int sk, ret;
+    int i;
+
+    *running = false;
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+        return -1;
+
+    rtnl_lock();
+
+    sk = rtnl_socket();
+    ret = sk;
+    if (sk < 0)
+        goto exit;
+
+    txn_start(&txn, 0);
+    txn.ifindex = ifindex;
+
+    ret = get_ipv4_addresses(sk, &txn);
+    if (ret < 0)
+        goto exit;
+
+    first_seq = ipconfig_seqnr;
+
+    add_link_flags(s_batch, &used, ifindex, false, 0);
+
+    addr.s_addr = address;
+    for (i = 0; i < txn.num_addrs; i++)
+        if (txn.addrs[i].s_addr != address || txn.prefixlens[i] != prefixlen)
+            add_address(s_batch, &used, RTM_DELADDR, 0, ifindex,
+                        txn.addrs[i], txn.prefixlens[i]);
+
+    add_address(s_batch, &used, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+                ifindex, addr, prefixlen);
+
+    add_link_flags(s_batch, &used, ifindex, true, mtu);
+
+    txn.first_seq = first_seq;
+    txn.count = ipconfig_seqnr - first_seq;
+    txn.answered = 0;
+    txn.error = 0;
+
+    /* Link events tell when the link is running. */
+    ret = subscribe_link_events(sk, true);
+    if (ret < 0)
+        goto exit;
+
+    ret = send_rtnl_messages(sk, s_batch, used);
+    if (ret < 0)
+        goto exit;
+
+    ret = netlink_get_response(sk, &txn);
+    if (ret < 0)
+        goto exit;
+
+    *running = wait_link_running(sk, &txn, LINK_RUNNING_WAIT_MS);
+    ret = 0;
+
+exit:
+    rtnl_check_socket(ret);
+    rtnl_unlock();
+    return ret;
+}
+
+/**
+ * Brings a link up or down.
+ * Returns 0 on success, sets errno and returns negative on error.
+ */
+int rtnl_set_link_up(const char *ifname, bool up)
+{
+    size_t used = 0;
+    struct rtnl_txn txn;
+    int ifindex;
+    int sk, ret;
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+        return -1;
+
+    rtnl_lock();
+
+    sk = rtnl_socket();
+    ret = sk;
+    if (sk < 0)
+        goto exit;
+
+    txn_start(&txn, 1);
+    txn.ifindex = ifindex;
+
+    add_link_flags(s_batch, &used, ifindex, up, 0);
+
+    ret = send_rtnl_messages(sk, s_batch, used);
+    if (ret < 0)
+        goto exit;
+
+    ret = netlink_get_response(sk, &txn);
+
+exit:
+    rtnl_check_socket(ret);
+    rtnl_unlock();
     return ret;
 }
@@ -21,6 +21,9 @@
 #ifndef U300_RIL_NETIF_H
 #define U300_RIL_NETIF_H 1
 
+#include <stdbool.h>
+#include <netinet/in.h>
+
 /**
  * Returns 0 on success, sets errno and returns negative on error.
  * *ifindex is set on success, but not modified on error.
@@ -34,4 +37,18 @@ int rtnl_create_caif_interface(int type, int conn_id, char *ifname,
  */
 int rtnl_delete_caif_interface(int ifindex,char * ifname);
 
+/**
+ * Configures address, netmask and MTU of an interface and brings it up, in
+ * one netlink transaction. *running is set if the link is running when
+ * the function returns.
+ * Returns 0 on success, sets errno and returns negative on error.
+ */
+int rtnl_configure_ipv4(const char *ifname, in_addr_t address,
+                        in_addr_t netmask, int mtu, bool *running);
+
+/**
+ * Returns 0 on success, sets errno and returns negative on error.
+ */
+int rtnl_set_link_up(const char *ifname, bool up);
+
 #endif
\ No newline at end of file
@@ -79,6 +79,17 @@ enum CREG_AcT {
     CGREG_ACT_UTRAN_HSUPA_HSDPA = 6
 };
 
+/* at_tok_scan() mask bit of <AcT> in "[<n>,]<stat>[,<lac>,<ci>[,<AcT>]]" */
+#define CGREG_FIELD_ACT (1 << 4)
+
+/*
+ * at_tok_scan() mask bits in
+ * "[<n>,]<stat>[,<lac>,<ci>[,<AcT>[,<detailedReason>]]]"
+ */
+#define EREG_FIELD_LAC      (1 << 2)
+#define EREG_FIELD_ACT      (1 << 4)
+#define EREG_FIELD_REASON   (1 << 5)
+
 /**
  * Poll +COPS?, if operator is retrieved, returns success,
  * if registration is denied, returns RIL_E_ILLEGAL_SIM_OR_ME;
@@ -432,6 +443,9 @@ out:
     return status;
 }
 
+/* Last <stat> of +CREG and *EREG, only accessed from the reader thread */
+static int s_lastRegStatus = -1;
+
 /**
  * setupECCListAsyncAdapter: async adapter for enqueueRILEvent()
  */
@@ -462,11 +476,17 @@ void onNetworkStateChanged(const char *s)
         strncpy(buf, s, sizeof(buf) - 1);
         buf[sizeof(buf) - 1] = 0;
 
-        if (!at_tok_start(&tok) && !at_tok_nextint(&tok, &status))
-            if (status == 5) /* Registred, roaming */
-                /* Check for Japan extensions and update ECC list */
+        if (!at_tok_start(&tok) && !at_tok_nextint(&tok, &status)) {
+            /*
+             * Registered, roaming. Check for Japan extensions and update
+             * ECC list, once when roaming starts rather than on every
+             * report, so the list is settled before it is needed.
+             */
+            if (status == 5 && s_lastRegStatus != 5)
                 enqueueRILEvent(CMD_QUEUE_AUXILIARY,
                                 setupECCListAsyncAdapter, NULL, NULL);
+            s_lastRegStatus = status;
+        }
     }
 
     /* Always send network state change event */
@@ -854,7 +874,6 @@ void requestQueryAvailableNetworks(void *data, size_t datalen, RIL_Token t)
     char **responseArray = NULL;
     char *p;
     int n = 0, i = 0, j = 0, numStoredNetworks = 0;
-    char *s = NULL;
 
     err = at_send_command_multiline_with_timeout("AT+COPS=?", "+COPS:",
                                                  &atresponse,
@@ -879,14 +898,10 @@ void requestQueryAvailableNetworks(void *data, size_t datalen, RIL_Token t)
         char *longAlphaNumeric = NULL;
         char *shortAlphaNumeric = NULL;
         char *numeric = NULL;
-        char *remaining = NULL;
         bool continueOuterLoop = false;
 
-        s = line = getFirstElementValue(p, "(", ")", &remaining);
-        p = remaining;
-
-        if (line == NULL) {
-            LOGE("Null pointer while parsing COPS response. This should not "
+        if (nextElement(&p, '(', NULL, &line) < 0) {
+            LOGE("Operator tuple missing in COPS response. This should not "
                  "happen.");
             goto error;
         }
@@ -924,11 +939,8 @@ void requestQueryAvailableNetworks(void *data, size_t datalen, RIL_Token t)
                 break;
             }
 
-        if (continueOuterLoop) {
-            free(s);
-            s = NULL;
+        if (continueOuterLoop)
             continue; /* Skip storing this duplicate operator */
-        }
 
         responseArray[numStoredNetworks * QUERY_NW_NUM_PARAMS + 0] =
             alloca(strlen(longAlphaNumeric) + 1);
@@ -973,8 +985,6 @@ void requestQueryAvailableNetworks(void *data, size_t datalen, RIL_Token t)
                 "%s", statusTable[status]);
 
         numStoredNetworks++;
-        free(s);
-        s = NULL;
     }
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, responseArray, numStoredNetworks *
@@ -982,7 +992,6 @@ void requestQueryAvailableNetworks(void *data, size_t datalen, RIL_Token t)
     goto exit;
 
 error:
-    free(s);
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 
 exit:
@@ -1348,8 +1357,9 @@ void requestRegistrationState(void *data, size_t datalen, RIL_Token t)
     char *responseStr[15];
     ATResponse *atresponse = NULL;
     char *line;
-    int commas = 0;
-    int skip, tmp;
+    char *lac, *cid, *act;
+    int present;
+    int skip;
     int count = 3;
     int detailedReason;
     unsigned int i;
@@ -1395,9 +1405,9 @@ void requestRegistrationState(void *data, size_t datalen, RIL_Token t)
 
     /*
      * The solicited version of the *EREG response is
-     * *EREG: n, stat, [lac, cid [,<AcT>]]
+     * *EREG: n, stat, [lac, cid [,<AcT>[,<detailedReason>]]]
      * and the unsolicited version is
-     * *EREG: stat, [lac, cid [,<AcT>]]
+     * *EREG: stat, [lac, cid [,<AcT>[,<detailedReason>]]]
      * The <n> parameter is basically "is unsolicited creg on?"
      * which it should always be.
      *
@@ -1406,194 +1416,40 @@ void requestRegistrationState(void *data, size_t datalen, RIL_Token t)
      * so we have to handle both.
      *
      * Also since the LAC, CID and AcT are only reported when
-     * registered, we can have 1, 2, 3, 4 or 5 arguments here.
+     * registered, we can have 1 to 6 arguments here. <lac> is quoted or
+     * empty, which tells <n> from <stat>. <lac>, <cid> and <AcT> may be
+     * empty when <detailedReason> is given, so they are taken as strings.
      */
-
-    /* Count number of commas */
-    err = at_tok_charcounter(line, ',', &commas);
-
-    if (err < 0)
+    present = at_tok_scan(&line, "[_,]d[,s,s[,s[,d]]]", &response[0],
+                          &lac, &cid, &act, &detailedReason);
+    if (present < 0) {
+        LOGE("Invalid input.\r\n");
         goto error;
+    }
 
-    switch (commas) {
-    case 0:                    /* *EREG: <stat> */
-        err = at_tok_nextint(&line, &response[0]);
-
-        if (err < 0)
-            goto error;
-
-        break;
-
-    case 1:                    /* *EREG: <n>, <stat> */
-        err = at_tok_nextint(&line, &skip);
-
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nextint(&line, &response[0]);
-
-        if (err < 0)
-            goto error;
-
-        break;
-
-    case 2:                    /* *EREG: <stat>, <lac>, <cid> */
-        err = at_tok_nextint(&line, &response[0]);
-
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nexthexint(&line, &response[1]);
-
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nexthexint(&line, &response[2]);
-
-        if (err < 0)
-            goto error;
-
-        break;
-
-    case 3:
-        err = at_tok_nextint(&line, &tmp);
-
-        if (err < 0)
-            goto error;
-
-        /* We need to check if the second parameter is <lac> */
-        if (*(line) == '"') { /* *EREG: <stat>, <lac>, <cid>, <AcT> */
-            response[0] = tmp; /* <stat> */
-            err = at_tok_nexthexint(&line, &response[1]); /* <lac> */
-
-            if (err < 0)
-                goto error;
-
-            err = at_tok_nexthexint(&line, &response[2]); /* <cid> */
-
-            if (err < 0)
-                goto error;
-
-            err = at_tok_nextint(&line, &response[3]); /* <AcT> */
-
-            if (err < 0)
-                goto error;
-
-            count = 4;
-            getAcT = 1;
-        } else { /* *EREG: <n>, <stat>, <lac>, <cid> */
-            err = at_tok_nextint(&line, &response[0]); /* <stat> */
-
-            if (err < 0)
-                goto error;
-
-            err = at_tok_nexthexint(&line, &response[1]); /* <lac> */
-
-            if (err < 0)
-                goto error;
-
-            err = at_tok_nexthexint(&line, &response[2]); /* <cid> */
-
-            if (err < 0)
-                goto error;
+    if (present & EREG_FIELD_REASON) {
+        /* skip lac, cid and AcT if <stat> is 3, i.e. registration denied. */
+        if (response[0] == 3) {
+            /* In case of registration denied, set AcT to 0, i.e unknown */
+            response[3] = 0;
+            count = 14;
         }
-
-        break;
-
-    case 4:
-        err = at_tok_nextint(&line, &tmp); /* <n> */
-
-        if (err < 0)
+        /*
+         * Otherwise the modem might return detailedReason if <stat> is
+         * 0, 2, 3, 4. Not returning AcT.
+         */
+    } else if (present & EREG_FIELD_LAC) {
+        if (at_tok_nexthexint(&lac, &response[1]) < 0 ||
+            at_tok_nexthexint(&cid, &response[2]) < 0)
             goto error;
 
-        /* *EREG: <stat>, <lac>, <cid>, <AcT>, <detailedReason> */
-        if (*(line) == '"' || *(line) == ',') {
-            response[0] = tmp; /* <stat> */
-
-            /* skip lac, cid and AcT if <stat> is 3, i.e. registration denied. */
-            if (tmp == 3) {
-                (void)at_tok_nexthexint(&line, &skip); /* <lac> */
-                (void)at_tok_nexthexint(&line, &skip); /* <cid> */
-                (void)at_tok_nextint(&line, &skip); /* <AcT> */
-                err = at_tok_nextint(&line, &detailedReason); /*<detailedReason>*/
-
-                if (err < 0)
-                    goto error;
-
-                /* In case of registration denied, set AcT to 0, i.e unknown */
-                response[3] = 0;
-                count = 14;
-
-            } else {
-                /*
-                 * modem might return detailedReason if <stat> is 0, 2, 3, 4.
-                 * not returning AcT.
-                 */
-                count = 3;
-            }
-        } else { /* *EREG: <n>, <stat>, <lac>, <cid>, <AcT> */
-            err = at_tok_nextint(&line, &response[0]); /* <stat> */
-
-            if (err < 0)
-                goto error;
-
-            err = at_tok_nexthexint(&line, &response[1]); /* <lac> */
-
-            if (err < 0)
-                goto error;
-
-            err = at_tok_nexthexint(&line, &response[2]); /* <cid> */
-
-            if (err < 0)
-                goto error;
-
-            err = at_tok_nextint(&line, &response[3]); /* <AcT> */
-
-            if (err < 0)
+        if (present & EREG_FIELD_ACT) {
+            if (at_tok_nextint(&act, &response[3]) < 0)
                 goto error;
 
             count = 4;
             getAcT = 1;
         }
-
-        break;
-    case 5:     /* *EREG: <n>, <stat>, <lac>, <cid>, <AcT>, <detailedReason> */
-        err = at_tok_nextint(&line, &skip); /* <n> */
-
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nextint(&line, &response[0]); /* <stat> */
-
-        if (err < 0)
-            goto error;
-
-        /* skip lac, cid and AcT if registration denied. */
-        if (response[0] == 3) {
-            (void)at_tok_nexthexint(&line, &skip); /* <lac> */
-            (void)at_tok_nexthexint(&line, &skip); /* <cid> */
-            (void)at_tok_nextint(&line, &skip); /* <AcT> */
-            err = at_tok_nextint(&line, &detailedReason); /*<detailedReason>*/
-
-            if (err < 0)
-                goto error;
-
-            /* In case of registration denied, set AcT to 0, i.e Unknown */
-            response[3] = 0;
-            count = 14;
-
-        } else {
-            /*
-             * Modem might return detailedReason if <stat> is 0, 2, 3, 4.
-             * We should not return AcT.
-             */
-            count = 3;
-        }
-
-        break;
-    default:
-        LOGE("Invalid input.\r\n");
-        goto error;
     }
 
     /* Update stat value to enable the emergency dialer */
@@ -1697,69 +1553,10 @@ void requestRegistrationState(void *data, size_t datalen, RIL_Token t)
             if (err < 0)
                 goto wa_final;
 
-            /* Count number of commas */
-            commas = 0;
-            err = at_tok_charcounter(line, ',', &commas);
-
-            if (err < 0)
-                goto error;
-
-            /* +CGREG: <n>, <stat>, <lac>, <cid> */
-            if (commas == 3) {
-                /* +CGREG: <stat>, <lac>, <cid>, <AcT> */
-                err = at_tok_nextint(&line, &tmp);
-
-                if (err < 0)
-                    goto wa_final;
-
-                /* We need to check if the second parameter is <lac> */
-                if (*(line) == '"') {
-                    err = at_tok_nexthexint(&line, &skip); /* <lac> */
-
-                    if (err < 0)
-                        goto wa_final;
-
-                    err = at_tok_nexthexint(&line, &skip); /* <cid> */
-
-                    if (err < 0)
-                        goto wa_final;
-
-                    err = at_tok_nextint(&line, &cgregAcT); /* <AcT> */
-
-                    if (err < 0)
-                        goto wa_final;
-
-                    actSet = 1;
-                }
-            /* +CGREG: <n>, <stat>, <lac>, <cid>, <AcT> */
-            } else if (commas == 4) {
-                err = at_tok_nextint(&line, &skip); /* <n> */
-
-                if (err < 0)
-                    goto wa_final;
-
-                err = at_tok_nextint(&line, &skip); /* <stat> */
-
-                if (err < 0)
-                    goto wa_final;
-
-                err = at_tok_nexthexint(&line, &skip); /* <lac> */
-
-                if (err < 0)
-                    goto wa_final;
-
-                err = at_tok_nexthexint(&line, &skip); /* <cid> */
-
-                if (err < 0)
-                    goto wa_final;
-
-                err = at_tok_nextint(&line, &cgregAcT); /* <AcT> */
-
-                if (err < 0)
-                    goto wa_final;
-
+            /* +CGREG: [<n>, ]<stat>, <lac>, <cid>, <AcT> */
+            if (at_tok_scan(&line, "[_,]_,x,x,d", &skip, &skip,
+                            &cgregAcT) >= 0)
                 actSet = 1;
-            }
 
 wa_final:
             if (actSet) {
@@ -1875,9 +1672,8 @@ void requestGprsRegistrationState(void *data, size_t datalen, RIL_Token t)
     int response[4];
     char *responseStr[4];
     ATResponse *atresponse = NULL;
-    char *line, *p;
-    int commas = 0;
-    int skip, tmp;
+    char *line;
+    int present;
     int count = 3;
 
     /*
@@ -1916,81 +1712,18 @@ void requestGprsRegistrationState(void *data, size_t datalen, RIL_Token t)
      * so we have to handle both.
      *
      * Also since the LAC, CID and AcT are only reported when registered,
-     * we can have 1, 2, 3, 4 or 5 arguments here.
+     * we can have 1, 2, 3, 4 or 5 arguments here. <lac> is quoted, which
+     * tells "<n>, <stat>, <lac>, <cid>" from "<stat>, <lac>, <cid>, <AcT>".
      */
-    /* Count number of commas */
-    p = line;
-    err = at_tok_charcounter(line, ',', &commas);
-    if (err < 0) {
-        LOGE("at_tok_charcounter failed.\r\n");
+    present = at_tok_scan(&line, "[_,]d[,x,x[,d]]", &response[0],
+                          &response[1], &response[2], &response[3]);
+    if (present < 0) {
+        LOGE("Invalid input.\r\n");
         goto error;
     }
 
-    switch (commas) {
-    case 0:                    /* +CGREG: <stat> */
-        err = at_tok_nextint(&line, &response[0]);
-        if (err < 0) goto error;
-        break;
-
-    case 1:                    /* +CGREG: <n>, <stat> */
-        err = at_tok_nextint(&line, &skip);
-        if (err < 0) goto error;
-        err = at_tok_nextint(&line, &response[0]);
-        if (err < 0) goto error;
-        break;
-
-    case 2:                    /* +CGREG: <stat>, <lac>, <cid> */
-        err = at_tok_nextint(&line, &response[0]);
-        if (err < 0) goto error;
-        err = at_tok_nexthexint(&line, &response[1]);
-        if (err < 0) goto error;
-        err = at_tok_nexthexint(&line, &response[2]);
-        if (err < 0) goto error;
-        break;
-
-    case 3:                    /* +CGREG: <n>, <stat>, <lac>, <cid> */
-                               /* +CGREG: <stat>, <lac>, <cid>, <AcT> */
-        err = at_tok_nextint(&line, &tmp);
-        if (err < 0) goto error;
-
-        /* We need to check if the second parameter is <lac> */
-        if (*(line) == '"') {
-            response[0] = tmp; /* <stat> */
-            err = at_tok_nexthexint(&line, &response[1]); /* <lac> */
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[2]); /* <cid> */
-            if (err < 0) goto error;
-            err = at_tok_nextint(&line, &response[3]); /* <AcT> */
-            if (err < 0) goto error;
-            count = 4;
-        } else {
-            err = at_tok_nextint(&line, &response[0]); /* <stat> */
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[1]); /* <lac> */
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[2]); /* <cid> */
-            if (err < 0) goto error;
-        }
-        break;
-
-    case 4:                    /* +CGREG: <n>, <stat>, <lac>, <cid>, <AcT> */
-        err = at_tok_nextint(&line, &skip); /* <n> */
-        if (err < 0) goto error;
-        err = at_tok_nextint(&line, &response[0]); /* <stat> */
-        if (err < 0) goto error;
-        err = at_tok_nexthexint(&line, &response[1]); /* <lac> */
-        if (err < 0) goto error;
-        err = at_tok_nexthexint(&line, &response[2]); /* <cid> */
-        if (err < 0) goto error;
-        err = at_tok_nextint(&line, &response[3]); /* <AcT> */
-        if (err < 0) goto error;
+    if (present & CGREG_FIELD_ACT)
         count = 4;
-        break;
-
-    default:
-        LOGE("Invalid input.\r\n");
-        goto error;
-    }
 
     /* Converting to stringlist for Android */
     asprintf(&responseStr[0], "%d", response[0]); /* state */
@@ -44,6 +44,8 @@ enum u300_ril_oem_msg_id {
     U300_RIL_OEM_MSG_OPEN_LOGICAL_CHANNEL           = 5,
     U300_RIL_OEM_MSG_CLOSE_LOGICAL_CHANNEL          = 6,
     U300_RIL_OEM_MSG_SIM_COMMAND                    = 7,
+    U300_RIL_OEM_MSG_PDP_STATISTICS                 = 8,
+    U300_RIL_OEM_MSG_CALL_STATISTICS                = 9,
     U300_RIL_OEM_MSG_LAST, /* Should be last */
 };
 
@@ -92,4 +94,14 @@ struct u300_ril_oem_sim_command_request {
 struct u300_ril_oem_sim_command_response {
     android::String8 response_val_string;
 };
+
+/* pdp_statistics_request has no arguments */
+struct u300_ril_oem_pdp_statistics_response {
+    android::String8 report_string;
+};
+
+/* call_statistics_request has no arguments */
+struct u300_ril_oem_call_statistics_response {
+    android::String8 report_string;
+};
 #endif
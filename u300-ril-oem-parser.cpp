@@ -307,6 +307,38 @@ OemRilParser::writeSimCommandResponse(const struct
         status = writeString(response->response_val_string);
     return status;
 }
+
+android::status_t
+OemRilParser::writePdpStatisticsResponse(const struct
+                        u300_ril_oem_pdp_statistics_response *response)
+{
+    status_t status;
+    status = mParcel.setDataSize(0);
+    if (status != NO_ERROR)
+        return status;
+
+    status = writeHeader(U300_RIL_OEM_MSG_PDP_STATISTICS);
+    if (status != NO_ERROR)
+        return status;
+
+    return writeString(response->report_string);
+}
+
+android::status_t
+OemRilParser::writeCallStatisticsResponse(const struct
+                        u300_ril_oem_call_statistics_response *response)
+{
+    status_t status;
+    status = mParcel.setDataSize(0);
+    if (status != NO_ERROR)
+        return status;
+
+    status = writeHeader(U300_RIL_OEM_MSG_CALL_STATISTICS);
+    if (status != NO_ERROR)
+        return status;
+
+    return writeString(response->report_string);
+}
 /* TODO: Implement new writeXXX methods here */
 
 
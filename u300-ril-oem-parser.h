@@ -232,6 +232,28 @@ public:
      */
     status_t            writeSimCommandResponse(const struct
                                    u300_ril_oem_sim_command_response *response);
+
+    /** Build OEM PDP_STATISTICS response.
+     *
+     * \param response: [in] structure to be serialized.
+     *
+     * \retval          NO_ERROR indicates success.
+     * \retval          BAD_VALUE indicates invalid argument.
+     * \retval          NO_MEMORY indicates memory allocation error.
+     */
+    status_t            writePdpStatisticsResponse(const struct
+                                u300_ril_oem_pdp_statistics_response *response);
+
+    /** Build OEM CALL_STATISTICS response.
+     *
+     * \param response: [in] structure to be serialized.
+     *
+     * \retval          NO_ERROR indicates success.
+     * \retval          BAD_VALUE indicates invalid argument.
+     * \retval          NO_MEMORY indicates memory allocation error.
+     */
+    status_t            writeCallStatisticsResponse(const struct
+                               u300_ril_oem_call_statistics_response *response);
     /* TODO: Define new writeXXX methods here */
 
 private:
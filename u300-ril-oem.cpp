@@ -33,6 +33,10 @@
 #include "u300-ril.h"
 #include "u300-ril-oem.h"
 #include "u300-ril-oem-parser.h"
+#include "u300-ril-lchannel.h"
+#include "u300-ril-sim.h"
+#include "u300-ril-pdpstats.h"
+#include "u300-ril-calltimeline.h"
 #include "atchannel.h"
 #include "at_tok.h"
 #include "misc.h"
@@ -64,6 +68,10 @@ static android::status_t handleOemRequestCloseLogicalChannel (
                          u300_ril::OemRilParser &parser, RIL_Errno *ril_errno);
 static android::status_t handleOemRequestSimCommand (
                          u300_ril::OemRilParser &parser, RIL_Errno *ril_errno);
+static android::status_t handleOemRequestPdpStatistics(
+                         u300_ril::OemRilParser &parser, RIL_Errno *ril_errno);
+static android::status_t handleOemRequestCallStatistics(
+                         u300_ril::OemRilParser &parser, RIL_Errno *ril_errno);
 
 static void onFrequencyNotification(const char *str);
 
@@ -122,6 +130,12 @@ void requestOEMHookRaw(void *data, size_t datalen, RIL_Token t)
         case U300_RIL_OEM_MSG_SIM_COMMAND:
             status = handleOemRequestSimCommand(parser, &ril_errno);
             break;
+        case U300_RIL_OEM_MSG_PDP_STATISTICS:
+            status = handleOemRequestPdpStatistics(parser, &ril_errno);
+            break;
+        case U300_RIL_OEM_MSG_CALL_STATISTICS:
+            status = handleOemRequestCallStatistics(parser, &ril_errno);
+            break;
         default:
             status = NAME_NOT_FOUND;
             break;
@@ -349,42 +363,25 @@ static android::status_t handleOemRequestOpenLogicalChannel(
                          u300_ril::OemRilParser &parser, RIL_Errno *ril_errno)
 {
     int status = 0;
-    char *cmd = NULL;
-    char *line = NULL;
     int session_id = 0;
     u300_ril_oem_open_logical_channel_response response;
     u300_ril_oem_open_logical_channel_request req;
-    ATResponse *atresponse = NULL;
-    char *application_id_string_as_hex;
-    char *curr;
-    int i;
 
     status = parser.parseOpenLogicalChannelRequest(&req);
     if (status != NO_ERROR)
         return status;
 
-    asprintf(&cmd,"AT+CCHO=\"%s\"", req.application_id_string.string());
-    status = at_send_command_singleline(cmd, "+CCHO:", &atresponse);
-    if (status < 0 || atresponse->success == 0) {
-        goto error;
+    /*
+     * Channels are shared with other users of the same application through
+     * the channel pool. The returned id is a pool handle, which stays valid
+     * across SIM resets.
+     */
+    if (lchannelAcquire(req.application_id_string.string(), &session_id) < 0) {
+        session_id = 0;
+        *ril_errno = RIL_E_GENERIC_FAILURE;
     }
 
-    line = atresponse->p_intermediates->line;
-    status = at_tok_start(&line);
-    if (status < 0)
-        goto error;
-
-    status = at_tok_nextint(&line, &session_id);
-    if (status < 0)
-        goto error;
-
-    goto exit;
-error:
-    *ril_errno = RIL_E_GENERIC_FAILURE;
-exit:
     response.session_id = session_id;
-    at_response_free(atresponse);
-    free(cmd);
 
     return parser.writeOpenLogicalChannelResponse(&response);
 }
@@ -396,22 +393,16 @@ static android::status_t handleOemRequestCloseLogicalChannel(
                          u300_ril::OemRilParser &parser, RIL_Errno *ril_errno)
 {
     int status = 0;
-    char *cmd = NULL;
-    ATResponse *atresponse = NULL;
     u300_ril_oem_close_logical_channel_request req;
 
     status = parser.parseCloseLogicalChannelRequest(&req);
     if (status != NO_ERROR)
         return status;
 
-    asprintf(&cmd, "AT+CCHC=%d", req.channel_session_id);
-    status = at_send_command(cmd, &atresponse);
-    if (status < 0 || atresponse->success == 0)
+    /* The channel is kept open in the pool until its slot is needed. */
+    if (lchannelRelease(req.channel_session_id) < 0)
         *ril_errno = RIL_E_GENERIC_FAILURE;
 
-    at_response_free(atresponse);
-    free(cmd);
-
     return parser.writeCloseLogicalChannelResponse();
 }
 
@@ -422,6 +413,7 @@ static android::status_t handleOemRequestSimCommand(
                          u300_ril::OemRilParser &parser, RIL_Errno *ril_errno)
 {
     int status = 0;
+    int session = 0;
     int resplen = 0;
     char *resp = NULL;
     char *cmd = NULL;
@@ -436,11 +428,29 @@ static android::status_t handleOemRequestSimCommand(
     if (status != NO_ERROR)
         return status;
 
+    /*
+     * The channel may be shared with SIM I/O, which must not see another
+     * APDU between its SELECT and READ.
+     */
+    simIOLock();
+
+    status = lchannelResolve(req.channel_session_id_val_i32, &session, NULL);
+    if (status < 0) {
+        simIOUnlock();
+        goto error;
+    }
+
     asprintf(&cmd, "AT+CGLA=%d, %d, \"%s\"",
-             req.channel_session_id_val_i32,
+             session,
              req.command_val_string.length(),
              req.command_val_string.string());
     status = at_send_command_singleline(cmd, "+CGLA:", &atresponse);
+
+    /* The command may have changed what is selected on the channel. */
+    lchannelMarkDirty(req.channel_session_id_val_i32);
+
+    simIOUnlock();
+
     if (status < 0)
         goto error;
 
@@ -488,4 +498,49 @@ exit:
     at_response_free(atresponse);
     free(cmd);
     return parser.writeSimCommandResponse(response);
-}
\ No newline at end of file
+}
+
+/**
+ * OEM PDP_STATISTICS handler
+ *
+ * Returns a text report of the data plane statistics of the PDP contexts,
+ * see pdpStatsReport().
+ */
+static android::status_t handleOemRequestPdpStatistics(
+                         u300_ril::OemRilParser &parser, RIL_Errno *ril_errno)
+{
+    u300_ril_oem_pdp_statistics_response response;
+    char *report;
+
+    report = (char *) malloc(PDP_STATS_REPORT_MAX_LEN);
+    if (report == NULL || pdpStatsReport(report, PDP_STATS_REPORT_MAX_LEN) < 0)
+        *ril_errno = RIL_E_GENERIC_FAILURE;
+    else
+        response.report_string = report;
+
+    free(report);
+    return parser.writePdpStatisticsResponse(&response);
+}
+
+/**
+ * OEM CALL_STATISTICS handler
+ *
+ * Returns a text report of the call setup timelines and latencies, see
+ * callTimelineReport().
+ */
+static android::status_t handleOemRequestCallStatistics(
+                         u300_ril::OemRilParser &parser, RIL_Errno *ril_errno)
+{
+    u300_ril_oem_call_statistics_response response;
+    char *report;
+
+    report = (char *) malloc(CALL_TIMELINE_REPORT_MAX_LEN);
+    if (report == NULL ||
+        callTimelineReport(report, CALL_TIMELINE_REPORT_MAX_LEN) < 0)
+        *ril_errno = RIL_E_GENERIC_FAILURE;
+    else
+        response.report_string = report;
+
+    free(report);
+    return parser.writeCallStatisticsResponse(&response);
+}
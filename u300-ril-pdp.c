@@ -24,9 +24,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <assert.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -46,6 +50,11 @@
 #include "misc.h"
 #include "u300-ril.h"
 #include "u300-ril-pdp.h"
+#include "u300-ril-pdpstats.h"
+#include "u300-ril-dormancy.h"
+#ifndef CAIF_SOCKET_SUPPORT_DISABLED
+#include "u300-ril-netif.h"
+#endif
 
 #define LOG_TAG "RILV"
 #include <utils/Log.h>
@@ -65,16 +74,518 @@ typedef struct pdpContextEntry {
     int state;      /* free(0), in use(1), reserved(2) */
     int active;     /* deactivated(0), activated(1) */
     int pid;        /* Profil ID */
-    char *APN;      /* Access Point Name */
+    bool hasAPN;
+    char APN[PDP_MAX_APN_LEN + 1]; /* Access Point Name */
     int OEM;        /* locally created or external (OEM use) */
 } pdpContextEntry;
 
-/* Maintained list of PDP contexts */
-static pdpContextEntry pdpContextList[RIL_MAX_NUMBER_OF_PDP_CONTEXTS] =
-                        {{0,0,-1,NULL,-1},{0,0,-1,NULL,-1},{0,0,-1,NULL,-1},
-                         {0,0,-1,NULL,-1},{0,0,-1,NULL,-1},{0,0,-1,NULL,-1}};
+/*
+ * Maintained list of PDP contexts.
+ *
+ * Writers serialize on contextListMutex. Readers that only need a copy of
+ * the list use pdpListSnapshot(), which does not take the mutex but retries
+ * if contextListSeq changed while it was copying; the sequence is odd
+ * while an update is in progress. contextListCond is signalled when a
+ * reserved entry is released.
+ */
+static pdpContextEntry pdpContextList[RIL_MAX_NUMBER_OF_PDP_CONTEXTS];
+static volatile unsigned int contextListSeq = 0;
 
 static pthread_mutex_t contextListMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t contextListCond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * PDP accounts (AT+CGDCONT and AT*EIAAUW) set up in the modem, by list
+ * index. Accounts are left in the modem when their context is deactivated,
+ * so that a later setup with the same APN and credentials can go straight
+ * to AT*EPPSD. Protected by contextListMutex.
+ *
+ * known:      the parameters of the last account set up on the cid.
+ * configured: the account is present in the modem. Cleared when the modem
+ *             may have lost it; known accounts are provisioned again by
+ *             pdpProvisionAccounts() once the SIM is ready.
+ */
+typedef struct pdpAccount {
+    bool known;
+    bool configured;
+    char apn[PDP_MAX_APN_LEN + 1];
+    char username[PDP_MAX_AUTH_LEN + 1];
+    char password[PDP_MAX_AUTH_LEN + 1];
+    char auth[4];
+    unsigned long lastUsed;
+} pdpAccount;
+
+static pdpAccount s_accounts[RIL_MAX_NUMBER_OF_PDP_CONTEXTS];
+static unsigned long s_accountClock = 0;
+
+/* Latest data call setup times, with reused(1) or new(0) account. */
+#define PDP_SETUP_SAMPLES 32
+typedef struct setupLatency {
+    long samples[PDP_SETUP_SAMPLES];
+    int count;
+    int next;
+} setupLatency;
+
+static setupLatency s_setupLatency[2];
+
+/* IP configuration given by the modem in the AT*EPPSD response. */
+#define PDP_MAX_DNS_SERVERS 2
+
+typedef struct pdpIpConfig {
+    int family;     /* AF_INET or AF_INET6, from the address */
+    char address[INET6_ADDRSTRLEN];
+    char subnetMask[INET6_ADDRSTRLEN];
+    char gateway[INET6_ADDRSTRLEN];
+    char dns[PDP_MAX_DNS_SERVERS][INET6_ADDRSTRLEN];
+    int numDns;
+    int mtu;        /* 0 if not given */
+} pdpIpConfig;
+
+/*
+ * List index of each profile ID below PDP_PROFILE_INDEX_SIZE, -1 if none.
+ * Several entries may share a profile ID, the index then points to the
+ * first one as a scan of the list would find it. Larger profile IDs, which
+ * only OEM users set up, are looked up by scan.
+ */
+#define PDP_PROFILE_INDEX_SIZE 32
+static signed char profileIndex[PDP_PROFILE_INDEX_SIZE];
+static pthread_once_t contextListOnce = PTHREAD_ONCE_INIT;
+
+static void initContextList(void)
+{
+    int i;
+
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
+        pdpContextList[i].active = 0;
+        pdpContextList[i].pid = -1;
+        pdpContextList[i].OEM = -1;
+    }
+    memset(profileIndex, -1, sizeof(profileIndex));
+}
+
+static void lockContextList(void)
+{
+    int err;
+
+    pthread_once(&contextListOnce, initContextList);
+
+    if ((err = pthread_mutex_lock(&contextListMutex)) != 0) {
+        LOGE("%s() failed to take list mutex: %s!", __func__, strerror(err));
+        assert(0);
+    }
+}
+
+static void unlockContextList(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&contextListMutex)) != 0) {
+        LOGE("%s() failed to release list mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+/* Must be called with contextListMutex held, pairs with endListUpdate(). */
+static void beginListUpdate(void)
+{
+    contextListSeq++;
+    __sync_synchronize();
+}
+
+static void endListUpdate(void)
+{
+    __sync_synchronize();
+    contextListSeq++;
+}
+
+/*
+ * Points the index of a profile ID to the first entry in use with it.
+ * Must be called with contextListMutex held, after the entries changed.
+ */
+static void updateProfileIndex(int pid)
+{
+    int i;
+
+    if (pid < 0 || pid >= PDP_PROFILE_INDEX_SIZE)
+        return;
+
+    profileIndex[pid] = -1;
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++)
+        if (pdpContextList[i].state != 0 && pdpContextList[i].pid == pid) {
+            profileIndex[pid] = i;
+            break;
+        }
+}
+
+/*
+ * Returns the list index of the cid or profile ID (-1 is not evaluated),
+ * -1 if not found. Must be called with contextListMutex held.
+ */
+static int findContextIndex(int cidToFind, int profileToFind)
+{
+    int i;
+
+    if (cidToFind >= RIL_FIRST_CID_INDEX &&
+        cidToFind < RIL_FIRST_CID_INDEX + RIL_MAX_NUMBER_OF_PDP_CONTEXTS &&
+        pdpContextList[cidToFind - RIL_FIRST_CID_INDEX].state != 0)
+        return cidToFind - RIL_FIRST_CID_INDEX;
+
+    if (profileToFind < 0)
+        return -1;
+
+    if (profileToFind < PDP_PROFILE_INDEX_SIZE)
+        return profileIndex[profileToFind];
+
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++)
+        if (pdpContextList[i].state != 0 &&
+            pdpContextList[i].pid == profileToFind)
+            return i;
+
+    return -1;
+}
+
+static void getIfName(int index, char ifName[])
+{
+    (void)snprintf(ifName, MAX_IFNAME_LEN, "%s%d", ril_iface, index);
+    ifName[MAX_IFNAME_LEN - 1] = '\0';
+}
+
+/*
+ * Fills in an account from data call setup parameters. Returns false if
+ * the parameters are too long to be kept, the account is then set up for
+ * every call.
+ */
+static bool makeAccount(pdpAccount *a, const char *apn, const char *username,
+                        const char *password, const char *auth)
+{
+    memset(a, 0, sizeof(*a));
+
+    apn = apn != NULL ? apn : "";
+    username = username != NULL ? username : "";
+    password = password != NULL ? password : "";
+
+    if (strlen(apn) > PDP_MAX_APN_LEN ||
+        strlen(username) > PDP_MAX_AUTH_LEN ||
+        strlen(password) > PDP_MAX_AUTH_LEN ||
+        strlen(auth) >= sizeof(a->auth))
+        return false;
+
+    strcpy(a->apn, apn);
+    strcpy(a->username, username);
+    strcpy(a->password, password);
+    strcpy(a->auth, auth);
+    a->known = true;
+
+    return true;
+}
+
+/* Must be called with contextListMutex held. */
+static bool accountConfiguredLocked(int index, const pdpAccount *wanted)
+{
+    const pdpAccount *a = &s_accounts[index];
+
+    return wanted != NULL && a->known && a->configured &&
+           strcasecmp(a->apn, wanted->apn) == 0 &&
+           strcmp(a->username, wanted->username) == 0 &&
+           strcmp(a->password, wanted->password) == 0 &&
+           strcmp(a->auth, wanted->auth) == 0;
+}
+
+static bool accountConfigured(int index, const pdpAccount *wanted)
+{
+    bool configured;
+
+    lockContextList();
+    configured = accountConfiguredLocked(index, wanted);
+    unlockContextList();
+
+    return configured;
+}
+
+/* Returns true if the account of a list entry is kept in the modem. */
+static bool accountKept(int index)
+{
+    bool kept;
+
+    lockContextList();
+    kept = s_accounts[index].known && s_accounts[index].configured;
+    unlockContextList();
+
+    return kept;
+}
+
+/* Records the account set up on a list entry, NULL if it was removed. */
+static void storeAccount(int index, const pdpAccount *a)
+{
+    lockContextList();
+
+    if (a != NULL) {
+        s_accounts[index] = *a;
+        s_accounts[index].configured = true;
+        s_accounts[index].lastUsed = ++s_accountClock;
+    } else {
+        memset(&s_accounts[index], 0, sizeof(s_accounts[index]));
+    }
+
+    unlockContextList();
+}
+
+/* Marks the account of a list entry as used by a data call. */
+static void touchAccount(int index)
+{
+    lockContextList();
+    s_accounts[index].lastUsed = ++s_accountClock;
+    unlockContextList();
+}
+
+/*
+ * Sets up the PDP account of a cid in the modem. The account is removed
+ * again if the authentication parameters are not accepted.
+ * Returns 0 on success, -1 on failure.
+ */
+static int configureAccount(int cid, const char *apn, const char *username,
+                            const char *password, const char *auth)
+{
+    ATResponse *atresponse = NULL;
+    char *cmd = NULL;
+    int err;
+
+    /* AT+CGDCONT=<cid>,<PDP_type>,<APN>,<PDP_addr> */
+    asprintf(&cmd, "AT+CGDCONT=%d,\"IP\",\"%s\",\"\"",
+             cid, (apn ? apn : ""));
+    err = at_send_command(cmd, &atresponse);
+    free(cmd);
+
+    if (err < 0 || atresponse->success == 0)
+        goto error;
+
+    at_response_free(atresponse);
+    atresponse = NULL;
+
+    /* AT*EIAAUW=<cid>,<bearer_id>,<userid>,<password>,<auth_prot>,<ask4pwd> */
+    asprintf(&cmd, "AT*EIAAUW=%d,1,\"%s\",\"%s\",%s,0", cid,
+             (username ? username : ""), (password ? password : ""), auth);
+    err = at_send_command(cmd, &atresponse);
+    free(cmd);
+
+    if (err < 0 || atresponse->success == 0) {
+        asprintf(&cmd, "AT*EIAD=%d,1", cid);
+        (void) at_send_command(cmd, NULL);
+        free(cmd);
+        goto error;
+    }
+
+    at_response_free(atresponse);
+    return 0;
+
+error:
+    at_response_free(atresponse);
+    return -1;
+}
+
+static int compareLong(const void *a, const void *b)
+{
+    long x = *(const long *) a;
+    long y = *(const long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Logs the time a data call setup took, along with recent percentiles.
+ * Returns the time in ms.
+ */
+static long recordSetupLatency(bool reused, const struct timeval *start)
+{
+    setupLatency *l = &s_setupLatency[reused ? 1 : 0];
+    long sorted[PDP_SETUP_SAMPLES];
+    struct timeval end;
+    long ms;
+    int count;
+
+    gettimeofday(&end, NULL);
+    ms = (end.tv_sec - start->tv_sec) * 1000 +
+         (end.tv_usec - start->tv_usec) / 1000;
+
+    lockContextList();
+    l->samples[l->next] = ms;
+    l->next = (l->next + 1) % PDP_SETUP_SAMPLES;
+    if (l->count < PDP_SETUP_SAMPLES)
+        l->count++;
+    count = l->count;
+    memcpy(sorted, l->samples, count * sizeof(long));
+    unlockContextList();
+
+    qsort(sorted, count, sizeof(long), compareLong);
+
+    LOGI("%s(): data call set up in %ld ms with %s account "
+         "(last %d: p50 %ld ms, p90 %ld ms)", __func__, ms,
+         reused ? "reused" : "new", count, sorted[count / 2],
+         sorted[(count * 9) / 10 < count ? (count * 9) / 10 : count - 1]);
+
+    return ms;
+}
+
+static void copyAddress(char dest[INET6_ADDRSTRLEN], const char *value)
+{
+    strncpy(dest, value, INET6_ADDRSTRLEN - 1);
+    dest[INET6_ADDRSTRLEN - 1] = '\0';
+}
+
+/*
+ * Fills in the IP configuration from the XML lines of an AT*EPPSD
+ * response, walking each line once. The lines are modified.
+ */
+static void parseIpConfig(ATLine *lines, pdpIpConfig *cfg)
+{
+    ATLine *cursor;
+    char *line;
+    char *name;
+    char *value;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->family = AF_UNSPEC;
+
+    for (cursor = lines; cursor != NULL; cursor = cursor->p_next) {
+        line = cursor->line;
+
+        while (nextElement(&line, '<', &name, &value) == 0) {
+            if (strcmp(name, "ip_address") == 0) {
+                copyAddress(cfg->address, value);
+                cfg->family = strchr(value, ':') != NULL ? AF_INET6 : AF_INET;
+            } else if (strcmp(name, "subnet_mask") == 0) {
+                copyAddress(cfg->subnetMask, value);
+            } else if (strcmp(name, "gateway") == 0) {
+                copyAddress(cfg->gateway, value);
+            } else if (strcmp(name, "dns_server") == 0) {
+                if (cfg->numDns < PDP_MAX_DNS_SERVERS)
+                    copyAddress(cfg->dns[cfg->numDns++], value);
+            } else if (strcmp(name, "mtu") == 0) {
+                cfg->mtu = atoi(value);
+            }
+        }
+    }
+}
+
+/*
+ * Clears the gateway and DNS properties of a network interface. The
+ * framework reads them on data call setup only, so this is not waited for.
+ */
+static void clearInterfaceProperties(const char *ifName)
+{
+    struct property_batch props;
+
+    property_batch_init(&props);
+    (void)property_batch_add(&props, "", "net.%s.gw", ifName);
+    (void)property_batch_add(&props, "", "net.%s.dns1", ifName);
+    (void)property_batch_add(&props, "", "net.%s.dns2", ifName);
+    (void)property_batch_apply(&props);
+}
+
+/* Brings a network interface down. Returns 0 on success. */
+static int takeDownInterface(const char *ifName)
+{
+#ifndef CAIF_SOCKET_SUPPORT_DISABLED
+    return rtnl_set_link_up(ifName, false);
+#else
+    int err;
+
+    if (ifc_init()) {
+        LOGE("%s() failed to set up ifc!", __func__);
+        return -1;
+    }
+
+    err = ifc_down(ifName);
+    ifc_close();
+
+    return err;
+#endif
+}
+
+/*
+ * Replaces the address and netmask of a network interface, sets the MTU if
+ * mtu > 0 and brings the interface up. Returns 0 on success.
+ */
+static int configureInterface(const char *ifName, in_addr_t addr,
+                              in_addr_t mask, int mtu)
+{
+#ifndef CAIF_SOCKET_SUPPORT_DISABLED
+    bool running;
+
+    /* One netlink transaction, see rtnl_configure_ipv4(). */
+    if (rtnl_configure_ipv4(ifName, addr, mask, mtu, &running) < 0) {
+        LOGE("%s() failed to configure %s: %s!", __func__, ifName,
+             strerror(errno));
+        return -1;
+    }
+
+    if (!running)
+        LOGW("%s() %s is up but not running yet", __func__, ifName);
+
+    return 0;
+#else
+    int err = -1;
+
+    if (ifc_init()) {
+        LOGE("%s() failed to set up ifc!", __func__);
+        return -1;
+    }
+
+    if (ifc_down(ifName)) {
+        LOGE("%s() failed to bring down %s!", __func__, ifName);
+        goto exit;
+    }
+
+    /* Setup interface address and subnet using libnetutils. */
+    if (ifc_set_addr(ifName, addr)) {
+        LOGE("%s() failed to setup address for interface %s!", __func__,
+            ifName);
+        goto exit;
+    }
+
+    /* We should have ifc_set_mtu()... */
+    if (mtu > 0) {
+        int ifc_ctl_sock;
+        struct ifreq ifr;
+
+        memset(&ifr, 0, sizeof(ifr));
+        strcpy(ifr.ifr_name, ifName);
+        ifr.ifr_mtu = mtu;
+
+        ifc_ctl_sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+        if (ifc_ctl_sock < 0) {
+            LOGE("%s() failed to obtain ifc control socket", __func__);
+            goto exit;
+        }
+
+        if (ioctl(ifc_ctl_sock, SIOCSIFMTU, &ifr)) {
+            LOGE("%s() failed to set MTU to %d!", __func__, mtu);
+            close(ifc_ctl_sock);
+            goto exit;
+        }
+
+        close(ifc_ctl_sock);
+    }
+
+    if (ifc_set_mask(ifName, mask)) {
+        LOGE("%s() failed to set subnet mask!", __func__);
+        goto exit;
+    }
+
+    if (ifc_up(ifName)) {
+        LOGE("%s() failed to bring up %s!", __func__, ifName);
+        goto exit;
+    }
+
+    err = 0;
+
+exit:
+    ifc_close();
+    return err;
+#endif
+}
 
 /* convertAuthenticationMethod */
 static char* convertAuthenticationMethod(const char *authentication)
@@ -109,10 +620,119 @@ static char* convertAuthenticationMethod(const char *authentication)
     return NULL;
 }
 
+/*
+ * Current packet switched bearer as reported by *EPSB, so that it does not
+ * have to be queried with AT*EPSB? each time it is needed. The state is
+ * only kept up to date while *EPSB reporting is enabled, see
+ * pdpSetBearerReporting(). Written from the AT reader thread, which never
+ * holds s_bearerMutex while waiting for the modem.
+ */
+static struct {
+    bool reporting;         /* *EPSB unsolicited reporting enabled */
+    bool known;             /* bearer is valid */
+    int bearer;             /* <curr_bearer>, 0 if no bearer */
+    struct timeval updated; /* when bearer was last set */
+    unsigned long changes;  /* *EPSB reports and reporting changes */
+} s_bearer;
+static pthread_mutex_t s_bearerMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void lockBearer(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_bearerMutex)) != 0) {
+        LOGE("%s() failed to take bearer mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void unlockBearer(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_bearerMutex)) != 0) {
+        LOGE("%s() failed to release bearer mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+/**
+ * Sets the current bearer from an *EPSB report and returns the previous
+ * one, or -1 if it was not known.
+ */
+static int setBearer(int bearer)
+{
+    int previous;
+
+    lockBearer();
+    previous = s_bearer.known ? s_bearer.bearer : -1;
+    s_bearer.known = true;
+    s_bearer.bearer = bearer;
+    s_bearer.changes++;
+    gettimeofday(&s_bearer.updated, NULL);
+    unlockBearer();
+
+    return previous;
+}
+
+/**
+ * Stores a bearer queried with AT*EPSB?, unless an *EPSB report or a
+ * reporting change arrived since the query was sent, as the queried
+ * value would then be older than what is kept.
+ */
+static void setQueriedBearer(int bearer, unsigned long changes)
+{
+    lockBearer();
+    if (s_bearer.reporting && s_bearer.changes == changes) {
+        s_bearer.known = true;
+        s_bearer.bearer = bearer;
+        gettimeofday(&s_bearer.updated, NULL);
+    } else
+        LOGD("%s(): bearer changed during query, not stored", __func__);
+    unlockBearer();
+}
+
+/**
+ * pdpSetBearerReporting()
+ *
+ * To be called when *EPSB reporting has been enabled (AT*EPSB=1) or
+ * disabled (AT*EPSB=0), or is lost because the modem restarted. The
+ * bearer is queried again on next use, as the modem does not report it
+ * when reporting is enabled.
+ */
+void pdpSetBearerReporting(bool enabled)
+{
+    lockBearer();
+    s_bearer.reporting = enabled;
+    s_bearer.known = false;
+    s_bearer.changes++;
+    unlockBearer();
+}
+
+/**
+ * pdpReportedBearer()
+ *
+ * Returns the bearer last reported by *EPSB, or -1 if it is not known.
+ * Never queries the modem.
+ */
+int pdpReportedBearer(void)
+{
+    int bearer;
+
+    lockBearer();
+    bearer = s_bearer.reporting && s_bearer.known ? s_bearer.bearer : -1;
+    unlockBearer();
+
+    return bearer;
+}
+
 /**
  * getCurrentPacketSwitchedBearer
  *
- * Queries the status of current packet switched bearer.
+ * Gets the current packet switched bearer, from *EPSB reports if they are
+ * enabled and one has been received, otherwise by querying the modem.
  * It returns 1 if the bearer is found, 0 if not.
  */
 static int getCurrentPacketSwitchedBearer(int *curr_bearer)
@@ -121,14 +741,37 @@ static int getCurrentPacketSwitchedBearer(int *curr_bearer)
     char *line = NULL;
     int err, success = 0;
     int temp;
+    bool reporting;
+    unsigned long changes;
 
     if (curr_bearer == NULL) {
         LOGE("%s called with invalid input parameters!", __func__);
         return 0;
     }
 
-    (void)at_send_command("AT*EPSB=1", NULL);
+    lockBearer();
+    reporting = s_bearer.reporting;
+    changes = s_bearer.changes;
+    if (reporting && s_bearer.known) {
+        struct timeval now;
+
+        gettimeofday(&now, NULL);
+        *curr_bearer = s_bearer.bearer;
+        LOGD("%s(): bearer %d, reported %ld ms ago", __func__,
+             s_bearer.bearer,
+             (now.tv_sec - s_bearer.updated.tv_sec) * 1000 +
+             (now.tv_usec - s_bearer.updated.tv_usec) / 1000);
+        success = 1;
+    }
+    unlockBearer();
+
+    if (success)
+        return 1;
 
+    /*
+     * Reporting is not toggled here, as that would interfere with the
+     * subscription made for the screen state.
+     */
     err = at_send_command_singleline("AT*EPSB?", "*EPSB:", &atresponse);
     if (err < 0 || atresponse->success == 0)
         goto error;
@@ -139,6 +782,7 @@ static int getCurrentPacketSwitchedBearer(int *curr_bearer)
     if (err < 0)
         goto error;
 
+    /* *EPSB: <mode>,<curr_bearer> */
     err = at_tok_nextint(&line, &temp);
     if (err < 0)
         goto error;
@@ -152,13 +796,17 @@ static int getCurrentPacketSwitchedBearer(int *curr_bearer)
 
     *curr_bearer = temp;
     success = 1;
+
+    /* Later *EPSB reports keep it up to date. */
+    if (reporting)
+        setQueriedBearer(temp, changes);
+
     goto exit;
 
 error:
     LOGE("%s failed to execute AT*EPSB correctly, check AT log", __func__);
 
 exit:
-    (void)at_send_command("AT*EPSB=0", NULL);
     at_response_free(atresponse);
 
     return success;
@@ -174,27 +822,34 @@ exit:
 static void cleanupPDPContextList(RIL_Data_Call_Response *list, int entries)
 {
     int i;
+    int index;
+    pdpContextInfo snapshot[RIL_MAX_NUMBER_OF_PDP_CONTEXTS];
     int profileId = -1;
     int oem = 0;
     int active = 0;
     int handle = 0;
     char *cmd = NULL;
     char curIfName[MAX_IFNAME_LEN] = "";
-    char *property = NULL;
 
     if (list == NULL)
         return; /* TODO: clean all entries? */
 
+    /* Only entries that are active in the RIL list need to be reserved. */
+    pdpListSnapshot(snapshot);
+
     /* Match deactivated entries with pdpcontext list */
     for (i = 0; i < entries; i++) {
         /* Find non activated entries in modem list */
         if (list[i].active > 0)
             continue;
 
+        index = list[i].cid - RIL_FIRST_CID_INDEX;
+        if (index < 0 || index >= RIL_MAX_NUMBER_OF_PDP_CONTEXTS ||
+            !snapshot[index].inUse || snapshot[index].active != 1)
+            continue;
+
         /* Find corresponding active entry in RIL list */
-        char cidStr[3];
-        (void)snprintf(cidStr, 3, "%d", list[i].cid);
-        handle = pdpListGet(cidStr, NULL,
+        handle = pdpListGet(list[i].cid, -1,
                             NULL, &profileId, curIfName, NULL, &active, &oem);
         if (handle < 0)
             continue;
@@ -215,33 +870,22 @@ static void cleanupPDPContextList(RIL_Data_Call_Response *list, int entries)
             continue;
         }
 
-        /*  -> from modem */
-        asprintf(&cmd, "AT*EIAD=%d,1", list[i].cid);
-        (void)at_send_command(cmd, NULL);
-        free(cmd);
+        /*  -> from modem, unless the account is kept for reuse */
+        if (!accountKept(index)) {
+            asprintf(&cmd, "AT*EIAD=%d,1", list[i].cid);
+            (void)at_send_command(cmd, NULL);
+            free(cmd);
+        }
+
+        /*  -> from statistics */
+        pdpStatsContextDown(list[i].cid);
 
         /*  -> from interfaces (DOWN) */
-        if (!ifc_init()) {
-            if (ifc_down(curIfName))
-                LOGE("%s() failed to bring down %s!", __func__, curIfName);
-            ifc_close();
-        } else {
-            LOGE("%s() failed to set up ifc. Can not bring down interface %s!",
-                 __func__, curIfName);
-        }
+        if (takeDownInterface(curIfName))
+            LOGE("%s() failed to bring down %s!", __func__, curIfName);
 
         /*  -> from properties */
-        if (curIfName != NULL) {
-            asprintf(&property, "net.%s.gw", curIfName);
-            (void)property_set(property, "");
-            free(property);
-            asprintf(&property, "net.%s.dns1", curIfName);
-            (void)property_set(property, "");
-            free(property);
-            asprintf(&property, "net.%s.dns2", curIfName);
-            (void)property_set(property, "");
-            free(property);
-        }
+        clearInterfaceProperties(curIfName);
 
         /*  -> from OEM framework */
         if (pdpOemDeativatedCB != NULL && oem) {
@@ -250,6 +894,106 @@ static void cleanupPDPContextList(RIL_Data_Call_Response *list, int entries)
     }
 }
 
+/*
+ * Copy of the data call list last sent to the framework, used to drop
+ * RIL_UNSOL_DATA_CALL_LIST_CHANGED reports that would not tell it anything
+ * new. Only accessed from requestOrSendPDPContextList(), which runs on the
+ * AUXILIARY queue (or the DEFAULT queue if that is the only one in use).
+ */
+#define PDP_MAX_REPORTED_CONTEXTS           16
+#define PDP_MAX_REPORTED_TYPE_LEN           16
+#define PDP_MAX_REPORTED_ADDRESS_LEN        64
+
+/* Window in which +CGEV and *EPSB indications are merged into one report */
+#define PDP_LIST_CHANGED_COALESCE_MS        200
+
+typedef struct reportedContext {
+    int cid;
+    int active;
+    char type[PDP_MAX_REPORTED_TYPE_LEN + 1];
+    char apn[PDP_MAX_APN_LEN + 1];
+    char address[PDP_MAX_REPORTED_ADDRESS_LEN + 1];
+} reportedContext;
+
+static reportedContext s_reported[PDP_MAX_REPORTED_CONTEXTS];
+static int s_numReported = -1;  /* -1 if nothing reliable was reported */
+
+static volatile int s_listChangedPending = 0;
+
+static struct {
+    unsigned long events;       /* +CGEV and *EPSB indications handled */
+    unsigned long coalesced;    /* merged into an already pending report */
+    unsigned long ignored;      /* +CGEV NW/ME CLASS, no report needed */
+    unsigned long sent;         /* RIL_UNSOL_DATA_CALL_LIST_CHANGED sent */
+    unsigned long suppressed;   /* list unchanged since last report */
+} s_listChangedStats;
+
+static bool sameField(const char *reported, const char *current)
+{
+    return strcmp(reported, current != NULL ? current : "") == 0;
+}
+
+static void copyField(char *dst, size_t size, const char *src)
+{
+    strncpy(dst, src != NULL ? src : "", size - 1);
+    dst[size - 1] = '\0';
+}
+
+/**
+ * Compares a data call list with the one last reported, and remembers it
+ * as reported.
+ *
+ * \return true if the list differs from the last reported one, or if it can
+ *         not be compared.
+ */
+static bool updateReportedList(const RIL_Data_Call_Response *responses,
+                               int count)
+{
+    bool changed = false;
+    int i;
+
+    if (count > PDP_MAX_REPORTED_CONTEXTS) {
+        s_numReported = -1;
+        return true;
+    }
+
+    if (count != s_numReported)
+        changed = true;
+
+    for (i = 0; i < count; i++) {
+        const RIL_Data_Call_Response *r = &responses[i];
+        reportedContext *c = &s_reported[i];
+
+        if (!changed && c->cid == r->cid && c->active == r->active &&
+            sameField(c->type, r->type) && sameField(c->apn, r->apn) &&
+            sameField(c->address, r->address))
+            continue;
+
+        changed = true;
+        c->cid = r->cid;
+        c->active = r->active;
+        copyField(c->type, sizeof(c->type), r->type);
+        copyField(c->apn, sizeof(c->apn), r->apn);
+        copyField(c->address, sizeof(c->address), r->address);
+    }
+
+    /* Longer strings are truncated above and can not be told apart. */
+    for (i = 0; i < count; i++) {
+        if ((responses[i].type != NULL &&
+             strlen(responses[i].type) > PDP_MAX_REPORTED_TYPE_LEN) ||
+            (responses[i].apn != NULL &&
+             strlen(responses[i].apn) > PDP_MAX_APN_LEN) ||
+            (responses[i].address != NULL &&
+             strlen(responses[i].address) > PDP_MAX_REPORTED_ADDRESS_LEN)) {
+            s_numReported = -1;
+            return true;
+        }
+    }
+
+    s_numReported = count;
+    return changed;
+}
+
 /* requestOrSendPDPContextList */
 static void requestOrSendPDPContextList(RIL_Token *token)
 {
@@ -260,6 +1004,7 @@ static void requestOrSendPDPContextList(RIL_Token *token)
     int number_of_contexts = 0;
     int i = 0;
     int curr_bearer, fetched;
+    bool changed;
     char *out;
 
     /* Read the activation states */
@@ -277,7 +1022,7 @@ static void requestOrSendPDPContextList(RIL_Token *token)
         goto finally;
 
     responses = alloca(number_of_contexts * sizeof(RIL_Data_Call_Response));
-    memset(responses, 0, sizeof(responses));
+    memset(responses, 0, number_of_contexts * sizeof(RIL_Data_Call_Response));
 
     for (i = 0; i < number_of_contexts; i++) {
         responses[i].cid = -1;
@@ -377,12 +1122,27 @@ static void requestOrSendPDPContextList(RIL_Token *token)
     }
 
 finally:
+    /*
+     * The framework sees the list in solicited responses too, so those
+     * count as reported, but they are always sent.
+     */
+    changed = updateReportedList(responses, number_of_contexts);
+
     if (token != NULL)
         RIL_onRequestComplete(*token, RIL_E_SUCCESS, responses,
                            number_of_contexts * sizeof(RIL_Data_Call_Response));
-    else
+    else if (changed) {
+        s_listChangedStats.sent++;
         RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED, responses,
                            number_of_contexts * sizeof(RIL_Data_Call_Response));
+    } else {
+        s_listChangedStats.suppressed++;
+        LOGD("%s(): list unchanged, not reported (events %lu, coalesced %lu, "
+             "ignored %lu, sent %lu, suppressed %lu)", __func__,
+             s_listChangedStats.events, s_listChangedStats.coalesced,
+             s_listChangedStats.ignored, s_listChangedStats.sent,
+             s_listChangedStats.suppressed);
+    }
 
     /*
      * To keep internal list up to date all deactivated contexts are removed
@@ -393,20 +1153,60 @@ finally:
     goto exit;
 
 error:
+    /* What the framework has now is unknown, report the next list. */
+    s_numReported = -1;
+
     if (token != NULL)
         RIL_onRequestComplete(*token, RIL_E_GENERIC_FAILURE, NULL, 0);
-    else
+    else {
+        s_listChangedStats.sent++;
         RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED, NULL, 0);
+    }
 
 exit:
     at_response_free(atresponse);
 }
 
+/**
+ * pdpListSnapshot()
+ *
+ * Copies a consistent view of the PDP context list without taking the list
+ * mutex, so that data call list queries do not wait for data call setup or
+ * deactivation. Entry i of the list has cid i + RIL_FIRST_CID_INDEX.
+ */
+void pdpListSnapshot(pdpContextInfo list[RIL_MAX_NUMBER_OF_PDP_CONTEXTS])
+{
+    pdpContextEntry copy[RIL_MAX_NUMBER_OF_PDP_CONTEXTS];
+    unsigned int seq;
+    int i;
+
+    pthread_once(&contextListOnce, initContextList);
+
+    do {
+        while ((seq = contextListSeq) & 1)
+            sched_yield();
+        __sync_synchronize();
+        memcpy(copy, pdpContextList, sizeof(copy));
+        __sync_synchronize();
+    } while (seq != contextListSeq);
+
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
+        list[i].cid = i + RIL_FIRST_CID_INDEX;
+        list[i].inUse = copy[i].state != 0;
+        list[i].active = copy[i].active;
+        list[i].profile = copy[i].pid;
+        list[i].oem = copy[i].OEM;
+        copy[i].APN[PDP_MAX_APN_LEN] = '\0';
+        strcpy(list[i].apn, copy[i].hasAPN ? copy[i].APN : "");
+        getIfName(i, list[i].ifName);
+    }
+}
+
 /**
  * pdpListExist()
  *
- * Looks for matching existing indexes of Connection ID, APN and Profile ID in
- * pdp context list. Note that cid/profileId set to NULL will not be
+ * Looks for matching existing indexes of Connection ID and Profile ID in
+ * pdp context list. Note that cid/profileId set to -1 will not be
  * evaluated.
  *
  * Fills cid, ifName, profileid, active and oem if given and entry exists.
@@ -414,225 +1214,246 @@ exit:
  *
  * Returns true if found, false if not found.
  */
-bool pdpListExist(const char *cidToFind, const char *profileToFind,
+bool pdpListExist(int cidToFind, int profileToFind,
                   int *cid, int *profile, char ifName[], int *active, int *oem)
 {
     int i;
-    char *end = NULL;
-    bool found = false;
-    int err;
 
-    if ((err = pthread_mutex_lock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to take list mutex: %s!", __func__, strerror(err));
-        assert(0);
+    lockContextList();
+
+    i = findContextIndex(cidToFind, profileToFind);
+    if (i >= 0) {
+        if (cid != NULL)
+            *cid = i + RIL_FIRST_CID_INDEX;
+        if (profile != NULL)
+            *profile = pdpContextList[i].pid;
+        if (active != NULL)
+            *active = pdpContextList[i].active;
+        if (oem != NULL)
+            *oem = pdpContextList[i].OEM;
+        if (ifName != NULL)
+            getIfName(i, ifName);
     }
 
-    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
-        if ((cidToFind != NULL &&
-             strtol(cidToFind, &end, 10) == i + RIL_FIRST_CID_INDEX) ||
-            (profileToFind != NULL &&
-             strtol(profileToFind, &end, 10) == pdpContextList[i].pid)) {
-
-            found = true;
-            if (cid != NULL)
-                *cid = i + RIL_FIRST_CID_INDEX;
-            if (profile != NULL)
-                *profile = pdpContextList[i].pid;
-            if (active != NULL)
-                *active = pdpContextList[i].active;
-            if (oem != NULL)
-                *oem = pdpContextList[i].OEM;
-            if (ifName != NULL) {
-                (void)snprintf(ifName, MAX_IFNAME_LEN, "%s%d", ril_iface, i);
-                ifName[MAX_IFNAME_LEN - 1] = '\0';
-            }
-
-            break;
-        }
-    }
-
-    if ((err = pthread_mutex_unlock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to release state mutex: %s", __func__, strerror(err));
-        assert(0);
-    }
+    unlockContextList();
 
-    return found;
+    return i >= 0;
 }
 
 
-/**
- * pdpListGet()
- *
- * Looks for matching indexes of Connection ID and Profile ID in pdp
- * context list. Note that cid/profileId set to NULL will not be evaluated.
- *
- * Fills cid, profile, ifName, apn, active and oem if given and entry is found.
- * (can be set to NULL if not needed)
- *
- * Note that if entry is found and a handle is returned the handle needs to be
- * released later through put/undo/free!
- *
- * Returns
- *  pdplistentry handle if found,
- *  -1 if not found.
- *  -2 if already reserved
+/*
+ * Finds the entry of a cid or profile ID and RESERVES it, see pdpListGet().
+ * If the entry is reserved and wait is set, waits until it is released
+ * instead of failing. Must not be called while holding a reservation of
+ * the same entry.
  */
-int pdpListGet(const char *cidToFind, const char *profileIdToFind,
-               int *cid, int *profile, char ifName[], char **apn, int *active,
-               int *oem)
+static int getEntry(int cidToFind, int profileIdToFind,
+                    int *cid, int *profile, char ifName[], const char **apn,
+                    int *active, int *oem, bool wait)
 {
     int i;
     int pdpListHandle = -1;
-    char *end = NULL;
-    int err;
-
-    if ((err = pthread_mutex_lock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to take list mutex: %s!", __func__, strerror(err));
-        assert(0);
-    }
-
-    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
 
-        if (pdpContextList[i].state == 0)
-            continue;
+    lockContextList();
 
-        if ((cidToFind != NULL &&
-             strtol(cidToFind, &end, 10) == i + RIL_FIRST_CID_INDEX) ||
-            (profileIdToFind != NULL &&
-             strtol(profileIdToFind, &end, 10) == pdpContextList[i].pid)) {
+    for (;;) {
+        i = findContextIndex(cidToFind, profileIdToFind);
+        if (i < 0 || pdpContextList[i].state == 0)
+            goto exit;
 
-            if (pdpContextList[i].state != 1) {
-                LOGD("%s() attempted on already reserved index", __func__);
-                pdpListHandle = -2;
-                break;
-            }
-
-            /* Entry found */
-            pdpContextList[i].state = 2; /* Reserved */
-            pdpListHandle = i;
-
-            if (cid != NULL)
-                *cid = i + RIL_FIRST_CID_INDEX;
-            if (profile != NULL)
-                *profile = pdpContextList[i].pid;
-            if (apn != NULL)
-                *apn = pdpContextList[i].APN;
-            if (active != NULL)
-                *active = pdpContextList[i].active;
-            if (oem != NULL)
-                *oem = pdpContextList[i].OEM;
-            if (ifName != NULL) {
-                (void)snprintf(ifName, MAX_IFNAME_LEN, "%s%d", ril_iface, i);
-                ifName[MAX_IFNAME_LEN - 1] = '\0';
-            }
+        if (pdpContextList[i].state == 1)
             break;
+
+        if (!wait) {
+            LOGD("%s() attempted on already reserved index", __func__);
+            pdpListHandle = -2;
+            goto exit;
         }
-    }
 
-    if ((err = pthread_mutex_unlock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to release state mutex: %s", __func__,
-             strerror(err));
-        assert(0);
+        LOGD("%s() waiting for reserved index %d", __func__, i);
+        pthread_cond_wait(&contextListCond, &contextListMutex);
     }
 
+    /* Entry found */
+    beginListUpdate();
+    pdpContextList[i].state = 2; /* Reserved */
+    endListUpdate();
+    pdpListHandle = i;
+
+    if (cid != NULL)
+        *cid = i + RIL_FIRST_CID_INDEX;
+    if (profile != NULL)
+        *profile = pdpContextList[i].pid;
+    if (apn != NULL)
+        *apn = pdpContextList[i].hasAPN ? pdpContextList[i].APN : NULL;
+    if (active != NULL)
+        *active = pdpContextList[i].active;
+    if (oem != NULL)
+        *oem = pdpContextList[i].OEM;
+    if (ifName != NULL)
+        getIfName(i, ifName);
+
+exit:
+    unlockContextList();
+
     return pdpListHandle;
 }
 
 /**
- * pdpListGetFree()
+ * pdpListGet()
  *
- * Finds a free entry in the pdp context list and RESERVES it.
+ * Looks for matching indexes of Connection ID and Profile ID in pdp
+ * context list. Note that cid/profileId set to -1 will not be evaluated.
  *
- * cid cannot be NULL and will always be set in successful case.
- * ifName will be set in case of success and if it is not NULL.
+ * Fills cid, profile, ifName, apn, active and oem if given and entry is found.
+ * (can be set to NULL if not needed)
+ * apn points into the entry and stays valid while the entry is reserved.
  *
- * Returns handle to entry if found, -1 if not found.
+ * Note that if entry is found and a handle is returned the handle needs to be
+ * released later through put/undo/free!
+ *
+ * Returns
+ *  pdplistentry handle if found,
+ *  -1 if not found.
+ *  -2 if already reserved
  */
-int pdpListGetFree(int *cid, char ifName[])
+int pdpListGet(int cidToFind, int profileIdToFind,
+               int *cid, int *profile, char ifName[], const char **apn,
+               int *active, int *oem)
+{
+    return getEntry(cidToFind, profileIdToFind, cid, profile, ifName, apn,
+                    active, oem, false);
+}
+
+/*
+ * Finds a free entry in the pdp context list for an account and RESERVES
+ * it. Prefers the entry that already has the wanted account in the modem,
+ * then entries without any account, and then the least recently used
+ * account. configured is set if the account can be reused as is.
+ */
+static int getFreeForAccount(const pdpAccount *wanted, int *cid,
+                             char ifName[], bool *configured)
 {
-    int i = -1;
+    int i;
+    int best = -1;
     bool found = false;
-    int err;
 
     if (cid == NULL)
-        goto exit;
+        return -1;
 
-    if ((err = pthread_mutex_lock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to take list mutex: %s!", __func__, strerror(err));
-        assert(0);
-    }
+    lockContextList();
 
     for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
-        if (pdpContextList[i].state == 0) {
+        if (pdpContextList[i].state != 0)
+            continue;
+
+        if (accountConfiguredLocked(i, wanted)) {
+            best = i;
             found = true;
             break;
         }
+
+        if (best < 0 ||
+            (s_accounts[best].known &&
+             (!s_accounts[i].known ||
+              s_accounts[i].lastUsed < s_accounts[best].lastUsed)))
+            best = i;
     }
 
-    if (found) {
+    if (configured != NULL)
+        *configured = found;
+
+    i = best;
+    if (i >= 0) {
         /*
          * Generating:
          *  Connection ID (array index + first cid index)
          *  Interface Name (ril_iface(Connection ID - 1))
          */
         *cid = i + RIL_FIRST_CID_INDEX;
-        if (ifName != NULL) {
-            (void) snprintf(ifName, MAX_IFNAME_LEN, "%s%d", ril_iface, i);
-            ifName[MAX_IFNAME_LEN -1] = '\0';
-        }
+        if (ifName != NULL)
+            getIfName(i, ifName);
+        beginListUpdate();
         pdpContextList[i].state = 2; /* reserved */
-    } else {
-        i = -1;
+        endListUpdate();
     }
 
-    if ((err = pthread_mutex_unlock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to release state mutex: %s", __func__,
-             strerror(err));
-        assert(0);
-    }
+    unlockContextList();
 
-exit: /* Note: label does not release lock, use with caution */
     return i;
 }
 
+/**
+ * pdpListGetFree()
+ *
+ * Finds a free entry in the pdp context list and RESERVES it.
+ *
+ * cid cannot be NULL and will always be set in successful case.
+ * ifName will be set in case of success and if it is not NULL.
+ *
+ * Returns handle to entry if found, -1 if not found.
+ */
+int pdpListGetFree(int *cid, char ifName[])
+{
+    return getFreeForAccount(NULL, cid, ifName, NULL);
+}
+
+/* Must be called with contextListMutex held. */
+static bool isReserved(int pdpListHandle)
+{
+    if (pdpListHandle < 0 || pdpListHandle >= RIL_MAX_NUMBER_OF_PDP_CONTEXTS ||
+        pdpContextList[pdpListHandle].state != 2) {
+        LOGD("%s() attempted on a non-reserved list entry, error!", __func__);
+        return false;
+    }
+    return true;
+}
+
 /**
  * pdpListPut()
  *
  * Sets an entry in the PDP context list and UNRESERVES it.
+ * apn may point to the APN returned by pdpListGet() for the entry.
  * Returns true if successful, false if unsuccessful.
  */
 bool pdpListPut(int pdpListHandle, int profile, const char *apn, int activated,
                 int oem)
 {
-    bool success = true;
-    int err;
+    bool success;
+    pdpContextEntry *e;
 
-    if ((err = pthread_mutex_lock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to take list mutex: %s!", __func__, strerror(err));
-        assert(0);
-    }
+    lockContextList();
 
-    if (pdpListHandle < 0 || pdpListHandle >= RIL_MAX_NUMBER_OF_PDP_CONTEXTS ||
-        pdpContextList[pdpListHandle].state != 2) {
-        LOGD("%s() attempted on a non-reserved list entry, error!", __func__);
+    success = isReserved(pdpListHandle);
+    if (success && apn != NULL && strlen(apn) > PDP_MAX_APN_LEN) {
+        LOGE("%s() APN too long", __func__);
         success = false;
     }
 
     if (success) {
-        pdpContextList[pdpListHandle].pid = profile;
-        if (apn != NULL)
-            pdpContextList[pdpListHandle].APN = strdup(apn);
-        pdpContextList[pdpListHandle].OEM = oem;
-        pdpContextList[pdpListHandle].active = activated;
-        pdpContextList[pdpListHandle].state = 1; /* in use */
-    }
+        e = &pdpContextList[pdpListHandle];
 
-    if ((err = pthread_mutex_unlock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to release state mutex: %s", __func__,
-             strerror(err));
-        assert(0);
+        beginListUpdate();
+        if (e->pid != profile) {
+            int previous = e->pid;
+
+            e->pid = profile;
+            updateProfileIndex(previous);
+            updateProfileIndex(profile);
+        }
+        if (apn != NULL && apn != e->APN) {
+            strcpy(e->APN, apn);
+            e->hasAPN = true;
+        }
+        e->OEM = oem;
+        e->active = activated;
+        e->state = 1; /* in use */
+        endListUpdate();
+        pthread_cond_broadcast(&contextListCond);
     }
 
+    unlockContextList();
+
     return success;
 }
 
@@ -644,34 +1465,31 @@ bool pdpListPut(int pdpListHandle, int profile, const char *apn, int activated,
  */
 bool pdpListFree(int pdpListHandle)
 {
-    bool success = true;
-    int err;
+    bool success;
+    pdpContextEntry *e;
+    int previous;
 
-    if ((err = pthread_mutex_lock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to take list mutex: %s!", __func__, strerror(err));
-        assert(0);
-    }
+    lockContextList();
 
-    if (pdpListHandle < 0 || pdpListHandle >= RIL_MAX_NUMBER_OF_PDP_CONTEXTS ||
-        pdpContextList[pdpListHandle].state != 2) {
-        LOGD("%s() attempted on a non-reserved list entry, error!", __func__);
-        success = false;
-    }
+    success = isReserved(pdpListHandle);
 
     if (success) {
-        pdpContextList[pdpListHandle].state = 0; /* free */
-        pdpContextList[pdpListHandle].active = -1;
-        pdpContextList[pdpListHandle].pid = -1;
-        free(pdpContextList[pdpListHandle].APN);
-        pdpContextList[pdpListHandle].APN = NULL;
-        pdpContextList[pdpListHandle].OEM = -1;
+        e = &pdpContextList[pdpListHandle];
+        previous = e->pid;
+
+        beginListUpdate();
+        e->state = 0; /* free */
+        e->active = -1;
+        e->pid = -1;
+        e->hasAPN = false;
+        e->APN[0] = '\0';
+        e->OEM = -1;
+        updateProfileIndex(previous);
+        endListUpdate();
+        pthread_cond_broadcast(&contextListCond);
     }
 
-    if ((err = pthread_mutex_unlock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to release state mutex: %s", __func__,
-             strerror(err));
-        assert(0);
-    }
+    unlockContextList();
 
     return success;
 }
@@ -685,50 +1503,124 @@ bool pdpListFree(int pdpListHandle)
  */
 bool pdpListUndo(int pdpListHandle)
 {
-    bool success = true;
-    int err;
+    bool success;
+    pdpContextEntry *e;
 
-    if ((err = pthread_mutex_lock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to take list mutex: %s!", __func__, strerror(err));
-        assert(0);
-    }
+    lockContextList();
 
-    if (pdpListHandle < 0 || pdpListHandle >= RIL_MAX_NUMBER_OF_PDP_CONTEXTS ||
-        pdpContextList[pdpListHandle].state != 2) {
-        LOGD("%s() attempted on a non-reserved list entry, error!", __func__);
-        success = false;
-    }
+    success = isReserved(pdpListHandle);
 
     if (success) {
+        e = &pdpContextList[pdpListHandle];
+
+        beginListUpdate();
         /* if just created... set free */
-        if (pdpContextList[pdpListHandle].APN == NULL &&
-            pdpContextList[pdpListHandle].pid == -1)
-            pdpContextList[pdpListHandle].state = 0; /* free */
+        if (!e->hasAPN && e->pid == -1)
+            e->state = 0; /* free */
         else
-            pdpContextList[pdpListHandle].state = 1; /* in use */
+            e->state = 1; /* in use */
+        endListUpdate();
+        pthread_cond_broadcast(&contextListCond);
     }
 
-    if ((err = pthread_mutex_unlock(&contextListMutex)) != 0) {
-        LOGE("%s() failed to release state mutex: %s", __func__,
-             strerror(err));
-        assert(0);
-    }
+    unlockContextList();
 
     return success;
 }
 
+/**
+ * pdpProvisionAccounts()
+ *
+ * Sets up known PDP accounts that the modem may have lost, so that data
+ * calls using them can be activated right away. Run once the SIM is ready.
+ */
+void pdpProvisionAccounts(void *param)
+{
+    pdpAccount account;
+    int i;
+    int handle;
+    int provisioned = 0;
+
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
+        handle = -1;
+
+        lockContextList();
+        if (pdpContextList[i].state == 0 && s_accounts[i].known &&
+            !s_accounts[i].configured) {
+            beginListUpdate();
+            pdpContextList[i].state = 2; /* reserved */
+            endListUpdate();
+            account = s_accounts[i];
+            handle = i;
+        }
+        unlockContextList();
+
+        if (handle < 0)
+            continue;
+
+        if (configureAccount(handle + RIL_FIRST_CID_INDEX, account.apn,
+                             account.username, account.password,
+                             account.auth) == 0) {
+            storeAccount(handle, &account);
+            provisioned++;
+        } else {
+            storeAccount(handle, NULL);
+        }
+
+        (void)pdpListUndo(handle);
+    }
+
+    if (provisioned > 0)
+        LOGI("%s(): %d PDP account(s) set up", __func__, provisioned);
+}
+
+/**
+ * pdpInvalidateAccounts()
+ *
+ * Marks all PDP accounts as lost, e.g. when the modem is restarted. They
+ * are set up again by pdpProvisionAccounts().
+ */
+void pdpInvalidateAccounts(void)
+{
+    int i;
+
+    lockContextList();
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++)
+        s_accounts[i].configured = false;
+    unlockContextList();
+}
+
+/**
+ * Reads the PDP context list shortly, merging indications that arrive
+ * before that into the same read. Safe to call from the AT reader thread.
+ */
+static void scheduleListChanged(void)
+{
+    static const struct timeval coalesce =
+        { 0, PDP_LIST_CHANGED_COALESCE_MS * 1000 };
+
+    s_listChangedStats.events++;
+
+    if (__sync_lock_test_and_set(&s_listChangedPending, 1)) {
+        s_listChangedStats.coalesced++;
+        return;
+    }
+
+    enqueueRILEvent(CMD_QUEUE_AUXILIARY, onPDPContextListChanged,
+                    NULL, &coalesce);
+}
+
 /**
  * onEPSBReceived()
  * Handling of unsolicited event *EPSB
  */
 void onEPSBReceived(const char *s)
 {
-    static int lastBearer = -1;
-
     char *line;
     char *tok;
     int err;
     int currBearer;
+    int lastBearer;
 
     /*
      * Checking if there was a change in dormancy if so report
@@ -746,6 +1638,12 @@ void onEPSBReceived(const char *s)
     if (err < 0)
         goto error;
 
+    lastBearer = setBearer(currBearer);
+    if (lastBearer != currBearer)
+        pdpStatsBearerChanged(currBearer);
+    if (lastBearer != -1)
+        lastBearer = (lastBearer?1:0);
+
     currBearer = (currBearer?1:0);
     /*
      * curr   last (send event)
@@ -757,15 +1655,11 @@ void onEPSBReceived(const char *s)
      *   1  ^  1  =  -
      */
     if (lastBearer^currBearer) {
-        lastBearer = currBearer;
         /*
-         * Note: There is a small chance that the bearer change again before
-         * we get to send the changelist. In this case we might end up sending
-         * the same info two time in contextlistchanged event.
-         * This is not considered to be a problem for Android.
+         * If the bearer changes back before the list is read, the list is
+         * unchanged and no report is sent.
          */
-        enqueueRILEvent(CMD_QUEUE_AUXILIARY, onPDPContextListChanged,
-                        NULL, NULL);
+        scheduleListChanged();
     }
 
 finally:
@@ -787,9 +1681,29 @@ error:
  */
 void onPDPContextListChanged(void *param)
 {
+    /* Indications from here on need a new read of the list. */
+    __sync_lock_release(&s_listChangedPending);
+
     requestOrSendPDPContextList(NULL);
 }
 
+/**
+ * +CGEV: <event>
+ *
+ * Packet domain event. NW CLASS and ME CLASS events report a change of
+ * the mobile station class and do not affect the PDP context list.
+ */
+void onCGEVReceived(const char *s)
+{
+    if (strStartsWith(s, "+CGEV: NW CLASS") ||
+        strStartsWith(s, "+CGEV: ME CLASS")) {
+        s_listChangedStats.ignored++;
+        return;
+    }
+
+    scheduleListChanged();
+}
+
 /**
  * RIL_REQUEST_DATA_CALL_LIST
  *
@@ -820,16 +1734,13 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
 
     char *cmd = NULL;
     ATResponse *atresponse = NULL;
-    ATLine *currentLine = NULL;
     char *auth = NULL;
     char *end = NULL;
     int err;
 
-    char *property = NULL;
-    char *ipAddrStr = NULL;
-    char *subnetMaskStr = NULL;
     char *defaultGatewayStr = NULL;
-    char *mtuStr = NULL;
+    pdpIpConfig ipConfig;
+    struct property_batch props;
     char **rilResponse = NULL;
     in_addr_t addr, subaddr;
 
@@ -838,8 +1749,17 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
     int curCid = -1;
     int curActive = -1;
     int curOem = -1;
-    char *curApn = NULL;
+    const char *curApn = NULL;
     int pdpListHandle = -1;
+    int pid;
+    pdpAccount account;
+    bool cacheable;
+    bool reuseAccount = false;
+    struct timeval start, activated, now;
+    int mtu;
+    int i;
+
+    gettimeofday(&start, NULL);
 
     /* Assigning parameters */
     radioTech = ((const char **) data)[0];
@@ -848,6 +1768,7 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
     username = ((const char **) data)[3];
     password = ((const char **) data)[4];
     authentication = ((const char **) data)[5];
+    pid = dataProfile != NULL ? strtol(dataProfile, &end, 10) : -1;
 
     /* Check type, only GSM/WCDMA support */
     if (!strtol(radioTech, &end, 10))
@@ -860,9 +1781,13 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
     /* ---------------------------------------------------------------------- *
      * ------------------ FINDING AVAILABLE CONNECTION ID ------------------- *
      * ---------------------------------------------------------------------- */
-    /* Check for already existing entry to use (configured via OEM) */
-    pdpListHandle = pdpListGet(NULL, dataProfile, &curCid, NULL, curIfName,
-                               &curApn, &curActive, &curOem);
+    /*
+     * Check for already existing entry to use (configured via OEM). The
+     * context list cleanup on the AUXILIARY queue may have it reserved
+     * for a moment when this runs on the DATA queue.
+     */
+    pdpListHandle = getEntry(-1, pid, &curCid, NULL, curIfName,
+                             &curApn, &curActive, &curOem, true);
     if (pdpListHandle >= 0) {
         /* Found existing entry in internal list */
         if (curActive == 1) {
@@ -876,12 +1801,20 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
         if (APN == NULL)
             APN = curApn;
 
+        cacheable = makeAccount(&account, APN, username, password, auth);
+        reuseAccount = accountConfigured(pdpListHandle,
+                                         cacheable ? &account : NULL);
+
         LOGI("%s() using existing but not activated Connection ID (%d) and "
              "Interface Name (%s)", __func__, curCid, curIfName);
 
     } else {
-        /* Finding free entry in PDP List */
-        if ((pdpListHandle = pdpListGetFree(&curCid, curIfName)) < 0) {
+        cacheable = makeAccount(&account, APN, username, password, auth);
+
+        /* Finding free entry in PDP List, preferably with the same account */
+        if ((pdpListHandle = getFreeForAccount(cacheable ? &account : NULL,
+                                               &curCid, curIfName,
+                                               &reuseAccount)) < 0) {
             LOGE("%s() was called with already maximum number of activated PDP "
                  "contexts. Rejecting data call setup.", __func__);
             goto error;
@@ -899,29 +1832,19 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
     /* ---------------------------------------------------------------------- *
      * ----------------- SETTING UP PDP ACCOUNT IN MODEM -------------------- *
      * ---------------------------------------------------------------------- */
-    /* AT+CGDCONT=<cid>,<PDP_type>,<APN>,<PDP_addr> */
-    asprintf(&cmd, "AT+CGDCONT=%d,\"IP\",\"%s\",\"\"",
-             curCid, (APN ? APN : ""));
-    err = at_send_command(cmd, &atresponse);
-    free(cmd);
-
-    if (err < 0 || atresponse->success == 0)
-        goto error__unreserve_list_entry;
-
-    at_response_free(atresponse);
-    atresponse = NULL;
-
-    /* AT*EIAAUW=<cid>,<bearer_id>,<userid>,<password>,<auth_prot>,<ask4pwd> */
-    asprintf(&cmd, "AT*EIAAUW=%d,1,\"%s\",\"%s\",%s,0", curCid,
-             (username ? username : ""), (password ? password : ""), auth);
-    err = at_send_command(cmd, &atresponse);
-    free(cmd);
+    if (reuseAccount) {
+        LOGI("%s() PDP account of cid %d already set up", __func__, curCid);
+        touchAccount(pdpListHandle);
+    } else {
+        /* The old account of the cid is overwritten */
+        storeAccount(pdpListHandle, NULL);
 
-    if (err < 0 || atresponse->success == 0)
-        goto error__delete_account;
+        if (configureAccount(curCid, APN, username, password, auth) < 0)
+            goto error__unreserve_list_entry;
 
-    at_response_free(atresponse);
-    atresponse = NULL;
+        if (cacheable)
+            storeAccount(pdpListHandle, &account);
+    }
 
     /* ---------------------------------------------------------------------- *
      * ---------------------- ACTIVATING PDP CONTEXT ------------------------ *
@@ -952,126 +1875,51 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
         goto error__delete_account;
     }
 
-    /* Parse response from EPPSD */
-    int buflen = 0;
-    int pos = 0;
-    char *doc = NULL;
-    char *docTail = NULL;
-    char *line = NULL;
-    char *value = NULL;
-
-    /* Loop once to calculate buffer length. */
-    for (currentLine = atresponse->p_intermediates;
-         currentLine != NULL; currentLine = currentLine->p_next) {
-        char *line = currentLine->line;
-        if (line != NULL)
-            buflen += strlen(line);
-    }
-    if (buflen > 0) {
-        doc = malloc(buflen + 1);
-        assert(doc != NULL);
-
-        /* Build the buffer containing all lines. */
-        for (currentLine = atresponse->p_intermediates;
-             currentLine != NULL; currentLine = currentLine->p_next) {
-            line = currentLine->line;
-            if (line != NULL) {
-                strcpy(doc + pos, line);
-                pos += strlen(line);
-            }
-        }
-
-        /* Get IP address */
-        value = getFirstElementValue(doc,"<ip_address>","</ip_address>", NULL);
-        if (value != NULL) {
-            LOGI("IP Address: %s", value);
-            ipAddrStr = value;
-            value = NULL;
-        }
-
-        /* Get Subnet */
-        value = getFirstElementValue(doc, "<subnet_mask>","</subnet_mask>",
-                                     NULL);
-        if (value != NULL) {
-            LOGI("Subnet Mask: %s", value);
-            subnetMaskStr = value;
-            value = NULL;
-        }
-
-        /* Get mtu */
-        value = getFirstElementValue(doc, "<mtu>", "</mtu>", NULL);
-        if (value != NULL) {
-            LOGI("MTU: %s", value);
-            mtuStr = value;
-            value = NULL;
-        }
+    gettimeofday(&activated, NULL);
 
-        /* We support two DNS servers */
-        docTail = NULL;
-        value = getFirstElementValue(doc,"<dns_server>","</dns_server>",
-                                     &docTail);
-        if (value != NULL) {
-            asprintf(&property, "net.%s.dns1", curIfName);
-            LOGI("1st DNS Server: %s", value);
-            if (property_set_verified(property, value) < 0)
-                LOGE("FAILED to set dns1 property!");
-            free(value);
-            free(property);
-            value = NULL;
-        }
+    /* Parse response from EPPSD */
+    parseIpConfig(atresponse->p_intermediates, &ipConfig);
 
-        if (docTail != NULL) {
-            /* One more DNS server found */
-            value = getFirstElementValue(docTail,"<dns_server>",
-                                         "</dns_server>", NULL);
-            if (value != NULL) {
-                asprintf(&property, "net.%s.dns2", curIfName);
-                LOGI("2nd DNS Server: %s", value);
-                if (property_set_verified(property, value) < 0)
-                    LOGE("FAILED to set dns2 property!");
-                free(value);
-                free(property);
-                value = NULL;
-            }
-        }
+    LOGI("IP Address: %s", ipConfig.address);
+    LOGI("Subnet Mask: %s", ipConfig.subnetMask);
+    if (ipConfig.mtu > 0)
+        LOGI("MTU: %d", ipConfig.mtu);
 
-        /* Note GW is not fetched. Default GW is calculated later. */
-        free(doc);
+    /*
+     * We support two DNS servers. Properties are set together with the
+     * gateway below and verified before the data call is reported.
+     */
+    property_batch_init(&props);
+    for (i = 0; i < ipConfig.numDns; i++) {
+        LOGI("DNS Server %d: %s", i + 1, ipConfig.dns[i]);
+        if (property_batch_add(&props, ipConfig.dns[i], "net.%s.dns%d",
+                               curIfName, i + 1) < 0)
+            LOGE("FAILED to set dns%d property!", i + 1);
     }
 
+    /* Note GW is not used. Default GW is calculated later. */
+
     at_response_free(atresponse);
     atresponse = NULL;
 
     /* ---------------------------------------------------------------------- *
      * -------------------- CONFIGURING NET INTERFACE ----------------------- *
      * ---------------------------------------------------------------------- */
-    /* Disabling any existing old interface with same ID */
-    if (ifc_init()) {
-        LOGE("%s() failed to set up ifc!", __func__);
-        goto error__deactivate_pdp;
-    }
-
-    if (ifc_down(curIfName)) {
-        LOGE("%s() failed to bring down %s!", __func__, curIfName);
+    /* Any existing old interface with same ID is replaced. */
+    if (ipConfig.family != AF_INET) {
+        LOGE("%s() no IPv4 address given (%s)!", __func__, ipConfig.address);
         goto error__deactivate_pdp;
     }
 
-    /* Setup interface address and subnet using libnetutils. */
-    if (inet_pton(AF_INET, ipAddrStr, &addr) <= 0) {
+    if (inet_pton(AF_INET, ipConfig.address, &addr) <= 0) {
         LOGE("%s() failed when calling inet_pton() for %s!", __func__,
-            ipAddrStr);
-        goto error__deactivate_pdp;
-    }
-
-    if (ifc_set_addr(curIfName, addr)) {
-        LOGE("%s() failed to setup address for interface %s!", __func__,
-            curIfName);
+            ipConfig.address);
         goto error__deactivate_pdp;
     }
 
-    if (inet_pton(AF_INET, subnetMaskStr, &subaddr) <= 0) {
+    if (inet_pton(AF_INET, ipConfig.subnetMask, &subaddr) <= 0) {
         LOGE("%s() failed when calling inet_pton() for %s!", __func__,
-             subnetMaskStr);
+             ipConfig.subnetMask);
         goto error__deactivate_pdp;
     }
 
@@ -1091,59 +1939,32 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
 
         defaultGatewayStr = strdup(inet_ntoa(gwaddr));
 
-        asprintf(&property, "net.%s.gw", curIfName);
-        if (property_set_verified(property, defaultGatewayStr) < 0)
-            LOGE("%s() failed to set fake %s.", __func__, property);
-        free(property);
+        if (property_batch_add(&props, defaultGatewayStr, "net.%s.gw",
+                               curIfName) < 0)
+            LOGE("%s() failed to set fake net.%s.gw.", __func__, curIfName);
 
         LOGI("%s generated new fake /31 subnet with gw: %s", __func__,
             defaultGatewayStr);
     }
 
-    /* We should have ifc_set_mtu()... */
-    if (mtuStr != NULL) {
-        int ifc_ctl_sock;
-        int mtu = 0;
-
-        mtu = atoi(mtuStr);
-        /* Default value of RIL_MAX_MTU is 1500, see Android.mk for details */
-        if (mtu > RIL_MAX_MTU) {
-            mtu = RIL_MAX_MTU;
-            LOGI("%s(): MTU is overridden and limited to %d!", __func__, mtu);
-        }
-
-        if (mtu > 1) {
-            struct ifreq ifr;
-            memset(&ifr, 0, sizeof(ifr));
-
-            strcpy(ifr.ifr_name, curIfName);
-            ifr.ifr_mtu = mtu;
-
-            ifc_ctl_sock = socket(AF_INET, SOCK_DGRAM, 0);
-
-            if (ifc_ctl_sock < 0) {
-                LOGE("%s() failed to obtain ifc control socket", __func__);
-                goto error__deactivate_pdp;
-            }
-
-            if (ioctl(ifc_ctl_sock, SIOCSIFMTU, &ifr)) {
-                LOGE("%s() failed to set MTU to %d!", __func__, mtu);
-                goto error__deactivate_pdp;
-            }
-
-            close(ifc_ctl_sock);
-        }
+    mtu = ipConfig.mtu;
+    /* Default value of RIL_MAX_MTU is 1500, see Android.mk for details */
+    if (mtu > RIL_MAX_MTU) {
+        mtu = RIL_MAX_MTU;
+        LOGI("%s(): MTU is overridden and limited to %d!", __func__, mtu);
     }
 
-    if (ifc_set_mask(curIfName, subaddr)) {
-        LOGE("%s() failed to set subnet mask!", __func__);
-        goto error__deactivate_pdp;
-    }
+    /* Properties take effect while the interface is configured. */
+    if (property_batch_apply(&props) < 0)
+        LOGE("%s() failed to set properties of %s!", __func__, curIfName);
 
-    if (ifc_up(curIfName)) {
-        LOGE("%s() failed to bring up %s!", __func__, curIfName);
-        goto error__deactivate_pdp;
-    }
+    if (configureInterface(curIfName, addr, subaddr, mtu > 1 ? mtu : 0) < 0)
+        goto error__netdev_down;
+
+    gettimeofday(&now, NULL);
+    LOGI("%s() %s usable %ld ms after activation", __func__, curIfName,
+         (long) ((now.tv_sec - activated.tv_sec) * 1000 +
+                 (now.tv_usec - activated.tv_usec) / 1000));
 
     if (defaultGatewayStr != NULL) {
         in_addr_t gw;
@@ -1155,45 +1976,42 @@ void requestSetupDataCall(void *data, size_t datalen, RIL_Token t)
     }
 
     /* Create new entry in Contextlist */
-    int pid = strtol(dataProfile, &end, 10);
     if (!pdpListPut(pdpListHandle, pid, APN, 1, 0)) {
         LOGE("%s() failed to add PDP to context list", __func__);
         goto error__netdev_down;
     }
 
+    /* The framework reads the properties as soon as the call is set up. */
+    if (property_batch_verify(&props) < 0)
+        LOGE("%s() properties of %s not verified!", __func__, curIfName);
+
     /* Allocate and fill in response */
     asprintf(&curCidStr, "%d", curCid);
     rilResponse = alloca(3 * sizeof(char *));
     rilResponse[0] = curCidStr;
     rilResponse[1] = curIfName;
-    rilResponse[2] = ipAddrStr;
+    rilResponse[2] = ipConfig.address;
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, rilResponse, 3 * sizeof(char *));
     free(curCidStr);
 
+    pdpStatsContextUp(curCid, curIfName,
+                      recordSetupLatency(reuseAccount, &start));
+    dormancyStart();
+
     goto exit;
 
 error__netdev_down: /* Only goto if ifc have been initiated */
     LOGD("%s() errorhandler: Trying to take down net interface", __func__);
 
-    if (ifc_down(curIfName))
+    if (takeDownInterface(curIfName))
         LOGE("%s() failed to bring down %s!", __func__, curIfName);
 
 error__deactivate_pdp:
     LOGD("%s() errorhandler: Trying to disconnect pdp context", __func__);
 
     /* remove any set properties */
-    if (curIfName != NULL) {
-        asprintf(&property, "net.%s.gw", curIfName);
-        (void)property_set(property, "");
-        free(property);
-        asprintf(&property, "net.%s.dns1", curIfName);
-        (void)property_set(property, "");
-        free(property);
-        asprintf(&property, "net.%s.dns2", curIfName);
-        (void)property_set(property, "");
-        free(property);
-    }
+    clearInterfaceProperties(curIfName);
 
     asprintf(&cmd, "AT*EPPSD=0,%d,%d", curCid, curCid);
     err = at_send_command(cmd, &atresponse);
@@ -1211,6 +2029,7 @@ error__delete_account:
     asprintf(&cmd, "AT*EIAD=%d,1", curCid);
     (void) at_send_command(cmd, NULL);
     free(cmd);
+    storeAccount(pdpListHandle, NULL);
 
 error__unreserve_list_entry:
     LOGD("%s() errorhandler: Trying to unreserve list entry", __func__);
@@ -1220,12 +2039,8 @@ error:
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 
 exit:
-    free(ipAddrStr);
-    free(subnetMaskStr);
-    free(mtuStr);
     free(defaultGatewayStr);
     at_response_free(atresponse);
-    ifc_close();
 }
 
 /**
@@ -1241,15 +2056,15 @@ void requestDeactivateDataCall(void *data, size_t datalen, RIL_Token t)
     int pdpListHandle = -1;
     char *cmd = NULL;
     ATResponse *atresponse = NULL;
-    char *property = NULL;
     int err;
+    bool deactivated = false;
     char curIfName[MAX_IFNAME_LEN] = "";
 
     cidStr = ((const char **) data)[0];
 
-    /* Finding element */
-    pdpListHandle = pdpListGet(cidStr, NULL,
-                               NULL, NULL, curIfName, NULL, NULL, NULL);
+    /* Finding element, waiting for the context list cleanup if needed */
+    pdpListHandle = getEntry(strtol(cidStr, NULL, 10), -1,
+                             NULL, NULL, curIfName, NULL, NULL, NULL, true);
     if (pdpListHandle < 0) {
         LOGD("%s() issued with non existing Connection ID (cid(%s))",
              __func__, cidStr);
@@ -1273,34 +2088,20 @@ void requestDeactivateDataCall(void *data, size_t datalen, RIL_Token t)
     free(cmd);
     if (err < 0 || atresponse->success == 0)
         LOGE("%s() failed sending AT*EPPSD for cid %s!", __func__, cidStr);
+    else
+        deactivated = true;
+
+    pdpStatsContextDown(strtol(cidStr, NULL, 10));
 
     /* remove any set properties for the given interface name */
-    if (curIfName != NULL) {
-        asprintf(&property, "net.%s.gw", curIfName);
-        (void)property_set(property, "");
-        free(property);
-        asprintf(&property, "net.%s.dns1", curIfName);
-        (void)property_set(property, "");
-        free(property);
-        asprintf(&property, "net.%s.dns2", curIfName);
-        (void)property_set(property, "");
-        free(property);
-    }
+    clearInterfaceProperties(curIfName);
 
     /* Bringing down the interface */
-    if (ifc_init()) {
-        LOGE("%s() failed to set up ifc!", __func__);
-        goto error;
-    }
-
-    if (ifc_down(curIfName)) {
+    if (takeDownInterface(curIfName)) {
         LOGE("%s() failed to bring down %s!", __func__, curIfName);
-        ifc_close();
         goto error;
     }
 
-    ifc_close();
-
     RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
     goto exit_remove_account;
 
@@ -1309,10 +2110,16 @@ error:
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 
 exit_remove_account:
-    /* regardless of outcome we remove the entry */
-    asprintf(&cmd, "AT*EIAD=%s,1", cidStr);
-    (void) at_send_command(cmd, NULL);
-    free(cmd);
+    /*
+     * Regardless of outcome we remove the entry. The account is kept in the
+     * modem for reuse if the context was deactivated.
+     */
+    if (!deactivated || !accountKept(pdpListHandle)) {
+        asprintf(&cmd, "AT*EIAD=%s,1", cidStr);
+        (void) at_send_command(cmd, NULL);
+        free(cmd);
+        storeAccount(pdpListHandle, NULL);
+    }
 
     pdpListFree(pdpListHandle);
 
@@ -24,6 +24,8 @@
 #ifndef U300_RIL_PDP_H
 #define U300_RIL_PDP_H 1
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -36,6 +38,23 @@ extern "C" {
 #define RIL_FIRST_CID_INDEX                 1   /* Note: must be > 0 */
 #define RIL_MAX_NUMBER_OF_PDP_CONTEXTS      6
 
+/* Longest APN, see 3GPP TS 23.003 9.1 */
+#define PDP_MAX_APN_LEN                     100
+
+/* Longest user name and password of a PDP account kept for reuse */
+#define PDP_MAX_AUTH_LEN                    64
+
+/* Copy of a PDP context list entry, see pdpListSnapshot() */
+typedef struct pdpContextInfo {
+    int cid;
+    bool inUse;
+    int active;     /* deactivated(0), activated(1) */
+    int profile;
+    int oem;
+    char apn[PDP_MAX_APN_LEN + 1];
+    char ifName[MAX_IFNAME_LEN];
+} pdpContextInfo;
+
 void onPDPContextListChanged(void *param);
 void requestPDPContextList(void *data, size_t datalen, RIL_Token t);
 void requestSetupDataCall(void *data, size_t datalen, RIL_Token t);
@@ -43,6 +62,12 @@ void requestDeactivateDataCall(void *data, size_t datalen, RIL_Token t);
 void requestLastPDPFailCause(void *data, size_t datalen, RIL_Token t);
 
 void onEPSBReceived(const char *s);
+void onCGEVReceived(const char *s);
+void pdpSetBearerReporting(bool enabled);
+int pdpReportedBearer(void);
+
+void pdpProvisionAccounts(void *param);
+void pdpInvalidateAccounts(void);
 
 /*
  * Used to set OEM's framework callback to deactivated PDP context indications.
@@ -53,12 +78,13 @@ void onEPSBReceived(const char *s);
  */
 void pdpSetOnOemDeactivated(void (*onOemDeactivated)(int profileId));
 
-bool pdpListExist(const char *cidToFind, const char *profileToFind,
+void pdpListSnapshot(pdpContextInfo list[RIL_MAX_NUMBER_OF_PDP_CONTEXTS]);
+bool pdpListExist(int cidToFind, int profileToFind,
                   int *cid, int *profile, char ifName[], int *active, int *oem);
 int  pdpListGetFree(int *cid, char ifName[]);
-int  pdpListGet(const char *cidToFind, const char *profileIdToFind,
-                int *cid, int *profile, char ifName[], char **apn, int *active,
-                int *oem);
+int  pdpListGet(int cidToFind, int profileIdToFind,
+                int *cid, int *profile, char ifName[], const char **apn,
+                int *active, int *oem);
 bool pdpListPut(int pdpListHandle, int profile, const char *apn, int activated,
                 int oem);
 bool pdpListFree(int pdpListHandle);
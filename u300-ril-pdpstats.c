@@ -0,0 +1,438 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <telephony/ril.h>
+
+#include "misc.h"
+#include "u300-ril.h"
+#include "u300-ril-pdp.h"
+#include "u300-ril-pdpstats.h"
+
+#define LOG_TAG "RILV"
+#include <utils/Log.h>
+
+/*
+ * Data plane statistics of PDP contexts.
+ *
+ * The netdev counters of the interface of each active context are read
+ * from sysfs when the context is set up, periodically on the AUXILIARY
+ * queue, on *EPSB bearer changes and when the context is deactivated.
+ * Traffic between two samples is credited to the bearer that was current
+ * at the first of them. Only the difference between samples is used, so
+ * counters left on a reused interface, or reset when it is recreated, do
+ * not show up in the statistics.
+ *
+ * Called from the request queues and from the AT reader thread, so all
+ * access is serialized by s_statsMutex. It is never held while waiting
+ * for the modem.
+ */
+enum {
+    COUNTER_RX_BYTES,
+    COUNTER_TX_BYTES,
+    COUNTER_RX_PACKETS,
+    COUNTER_TX_PACKETS,
+    COUNTER_RX_DROPPED,
+    COUNTER_TX_DROPPED,
+    COUNTER_RX_ERRORS,
+    COUNTER_TX_ERRORS,
+    NUM_COUNTERS
+};
+
+static const char *s_counterNames[NUM_COUNTERS] = {
+    "rx_bytes", "tx_bytes", "rx_packets", "tx_packets",
+    "rx_dropped", "tx_dropped", "rx_errors", "tx_errors"
+};
+
+/* Upper bounds of the histogram buckets, the last bucket has none. */
+static const long s_setupBounds[] = { 250, 500, 1000, 2000, 5000 };   /* ms */
+static const long s_lifetimeBounds[] = { 10, 60, 600, 3600 };         /* s */
+
+typedef struct windowSample {
+    struct timeval when;
+    unsigned long long rxBytes;
+    unsigned long long txBytes;
+} windowSample;
+
+typedef struct contextStats {
+    bool active;
+    char ifName[MAX_IFNAME_LEN];
+    struct timeval up;
+    long setupMs;
+    bool sampled;                           /* last is valid */
+    unsigned long long last[NUM_COUNTERS];  /* counters at last sample */
+    unsigned long long total[NUM_COUNTERS]; /* since context was set up */
+    windowSample window[PDP_STATS_WINDOW];
+    int windowNext;
+    int windowCount;
+    /* Bytes per bearer, the extra entry is for an unknown bearer. */
+    unsigned long long bearerBytes[PDP_STATS_MAX_BEARERS + 1];
+    unsigned long bearerChanges;
+} contextStats;
+
+static contextStats s_contexts[RIL_MAX_NUMBER_OF_PDP_CONTEXTS];
+static int s_bearer = -1;
+static unsigned long s_setupHistogram[NUM_ELEMS(s_setupBounds) + 1];
+static unsigned long s_lifetimeHistogram[NUM_ELEMS(s_lifetimeBounds) + 1];
+static unsigned long s_contextsUp = 0;
+static bool s_sampleScheduled = false;
+static pthread_mutex_t s_statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct timeval TIMEVAL_SAMPLE =
+    { PDP_STATS_SAMPLE_INTERVAL_S, 0 };
+
+static void statsLock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_statsMutex)) != 0) {
+        LOGE("%s() failed to take stats mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void statsUnlock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_statsMutex)) != 0) {
+        LOGE("%s() failed to release stats mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static long elapsedMs(const struct timeval *from, const struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000 +
+           (to->tv_usec - from->tv_usec) / 1000;
+}
+
+static int bearerIndex(int bearer)
+{
+    if (bearer < 0)
+        return PDP_STATS_MAX_BEARERS;
+    if (bearer >= PDP_STATS_MAX_BEARERS)
+        return PDP_STATS_MAX_BEARERS - 1;
+    return bearer;
+}
+
+/**
+ * Read one netdev counter of an interface, e.g. "rx_packets".
+ *
+ * \return 0 on success, -1 if the interface or counter does not exist.
+ */
+int pdpStatsReadCounter(const char *ifName, const char *counter,
+                        unsigned long long *value)
+{
+    char path[64 + MAX_IFNAME_LEN];
+    FILE *f;
+    int n;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s",
+             ifName, counter);
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    n = fscanf(f, "%llu", value);
+    fclose(f);
+
+    return n == 1 ? 0 : -1;
+}
+
+static int readCounters(const char *ifName,
+                        unsigned long long counters[NUM_COUNTERS])
+{
+    int i;
+
+    for (i = 0; i < NUM_COUNTERS; i++)
+        if (pdpStatsReadCounter(ifName, s_counterNames[i], &counters[i]) < 0)
+            return -1;
+
+    return 0;
+}
+
+/* Must be called with s_statsMutex held. */
+static void sampleLocked(contextStats *c, const struct timeval *now)
+{
+    unsigned long long counters[NUM_COUNTERS];
+    unsigned long long delta;
+    unsigned long long bytes = 0;
+    windowSample *w;
+    int i;
+
+    if (readCounters(c->ifName, counters) < 0) {
+        LOGD("%s(): no counters for %s", __func__, c->ifName);
+        return;
+    }
+
+    if (c->sampled) {
+        for (i = 0; i < NUM_COUNTERS; i++) {
+            /* Counters restart from zero if the interface is recreated. */
+            if (counters[i] >= c->last[i])
+                delta = counters[i] - c->last[i];
+            else
+                delta = counters[i];
+
+            c->total[i] += delta;
+            if (i == COUNTER_RX_BYTES || i == COUNTER_TX_BYTES)
+                bytes += delta;
+        }
+        c->bearerBytes[bearerIndex(s_bearer)] += bytes;
+    }
+
+    memcpy(c->last, counters, sizeof(counters));
+    c->sampled = true;
+
+    w = &c->window[c->windowNext];
+    w->when = *now;
+    w->rxBytes = c->total[COUNTER_RX_BYTES];
+    w->txBytes = c->total[COUNTER_TX_BYTES];
+    c->windowNext = (c->windowNext + 1) % PDP_STATS_WINDOW;
+    if (c->windowCount < PDP_STATS_WINDOW)
+        c->windowCount++;
+}
+
+/* Called on the AUXILIARY queue every PDP_STATS_SAMPLE_INTERVAL_S. */
+static void sampleContexts(void *param)
+{
+    struct timeval now;
+    bool active = false;
+    int i;
+
+    statsLock();
+
+    gettimeofday(&now, NULL);
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
+        if (!s_contexts[i].active)
+            continue;
+        sampleLocked(&s_contexts[i], &now);
+        active = true;
+    }
+
+    s_sampleScheduled = active;
+
+    statsUnlock();
+
+    if (active)
+        enqueueRILEvent(CMD_QUEUE_AUXILIARY, sampleContexts, NULL,
+                        &TIMEVAL_SAMPLE);
+}
+
+/**
+ * Start collecting statistics for a context that has been set up.
+ *
+ * \param setupMs: time taken to set up the context.
+ */
+void pdpStatsContextUp(int cid, const char *ifName, long setupMs)
+{
+    int index = cid - RIL_FIRST_CID_INDEX;
+    contextStats *c;
+    bool schedule = false;
+
+    if (index < 0 || index >= RIL_MAX_NUMBER_OF_PDP_CONTEXTS ||
+        ifName == NULL || strlen(ifName) >= MAX_IFNAME_LEN)
+        return;
+
+    statsLock();
+
+    c = &s_contexts[index];
+    memset(c, 0, sizeof(*c));
+    c->active = true;
+    strcpy(c->ifName, ifName);
+    c->setupMs = setupMs;
+    gettimeofday(&c->up, NULL);
+    sampleLocked(c, &c->up);
+
+    addToHistogram(s_setupHistogram, s_setupBounds,
+                   NUM_ELEMS(s_setupBounds), setupMs);
+    s_contextsUp++;
+
+    if (!s_sampleScheduled) {
+        s_sampleScheduled = true;
+        schedule = true;
+    }
+
+    statsUnlock();
+
+    if (schedule)
+        enqueueRILEvent(CMD_QUEUE_AUXILIARY, sampleContexts, NULL,
+                        &TIMEVAL_SAMPLE);
+}
+
+/**
+ * Take the final sample of a context that is being deactivated. Must be
+ * called before its interface is taken down.
+ */
+void pdpStatsContextDown(int cid)
+{
+    int index = cid - RIL_FIRST_CID_INDEX;
+    contextStats *c;
+    struct timeval now;
+    long lifetime;
+
+    if (index < 0 || index >= RIL_MAX_NUMBER_OF_PDP_CONTEXTS)
+        return;
+
+    statsLock();
+
+    c = &s_contexts[index];
+    if (!c->active)
+        goto exit;
+
+    gettimeofday(&now, NULL);
+    sampleLocked(c, &now);
+    c->active = false;
+
+    lifetime = elapsedMs(&c->up, &now) / 1000;
+    addToHistogram(s_lifetimeHistogram, s_lifetimeBounds,
+                   NUM_ELEMS(s_lifetimeBounds), lifetime);
+
+    LOGI("%s(): cid %d on %s down after %ld s, rx %llu B, tx %llu B, "
+         "%lu bearer changes", __func__, cid, c->ifName, lifetime,
+         c->total[COUNTER_RX_BYTES], c->total[COUNTER_TX_BYTES],
+         c->bearerChanges);
+
+exit:
+    statsUnlock();
+}
+
+/**
+ * Packet switched bearer changed, see *EPSB. Traffic up to now is credited
+ * to the previous bearer. Safe to call from the AT reader thread.
+ */
+void pdpStatsBearerChanged(int bearer)
+{
+    struct timeval now;
+    int i;
+
+    statsLock();
+
+    if (bearer == s_bearer)
+        goto exit;
+
+    gettimeofday(&now, NULL);
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
+        if (!s_contexts[i].active)
+            continue;
+        sampleLocked(&s_contexts[i], &now);
+        s_contexts[i].bearerChanges++;
+    }
+    s_bearer = bearer;
+
+exit:
+    statsUnlock();
+}
+
+/**
+ * Write a text report of the statistics: for each active context its
+ * lifetime, setup time, counters, rates over the last samples and traffic
+ * per bearer, followed by histograms of setup times and lifetimes.
+ *
+ * \return length of the report, which is truncated to fit size.
+ */
+int pdpStatsReport(char *buf, size_t size)
+{
+    struct timeval now;
+    size_t len = 0;
+    int i;
+    int j;
+
+    if (buf == NULL || size == 0)
+        return -1;
+
+    buf[0] = '\0';
+
+    statsLock();
+
+    gettimeofday(&now, NULL);
+
+    reportAppend(buf, size, &len, "bearer %d, contexts set up %lu\n",
+                 s_bearer, s_contextsUp);
+
+    for (i = 0; i < RIL_MAX_NUMBER_OF_PDP_CONTEXTS; i++) {
+        contextStats *c = &s_contexts[i];
+        const unsigned long long *t = c->total;
+
+        if (!c->active)
+            continue;
+
+        reportAppend(buf, size, &len, "cid %d %s up %ld s, setup %ld ms, "
+                     "%lu bearer changes\n", i + RIL_FIRST_CID_INDEX,
+                     c->ifName, elapsedMs(&c->up, &now) / 1000, c->setupMs,
+                     c->bearerChanges);
+        reportAppend(buf, size, &len,
+                     " rx %llu B %llu pkts %llu drops %llu errs\n",
+                     t[COUNTER_RX_BYTES], t[COUNTER_RX_PACKETS],
+                     t[COUNTER_RX_DROPPED], t[COUNTER_RX_ERRORS]);
+        reportAppend(buf, size, &len,
+                     " tx %llu B %llu pkts %llu drops %llu errs\n",
+                     t[COUNTER_TX_BYTES], t[COUNTER_TX_PACKETS],
+                     t[COUNTER_TX_DROPPED], t[COUNTER_TX_ERRORS]);
+
+        if (c->windowCount > 1) {
+            const windowSample *first = &c->window[
+                (c->windowNext - c->windowCount + PDP_STATS_WINDOW) %
+                PDP_STATS_WINDOW];
+            const windowSample *last = &c->window[
+                (c->windowNext - 1 + PDP_STATS_WINDOW) % PDP_STATS_WINDOW];
+            long ms = elapsedMs(&first->when, &last->when);
+
+            if (ms > 0)
+                reportAppend(buf, size, &len, " rate rx %llu B/s "
+                             "tx %llu B/s over %ld s\n",
+                             (last->rxBytes - first->rxBytes) * 1000 / ms,
+                             (last->txBytes - first->txBytes) * 1000 / ms,
+                             ms / 1000);
+        }
+
+        reportAppend(buf, size, &len, " bytes per bearer");
+        for (j = 0; j < PDP_STATS_MAX_BEARERS; j++)
+            if (c->bearerBytes[j] > 0)
+                reportAppend(buf, size, &len, " %d:%llu", j,
+                             c->bearerBytes[j]);
+        if (c->bearerBytes[PDP_STATS_MAX_BEARERS] > 0)
+            reportAppend(buf, size, &len, " unknown:%llu",
+                         c->bearerBytes[PDP_STATS_MAX_BEARERS]);
+        reportAppend(buf, size, &len, "\n");
+    }
+
+    reportAppendHistogram(buf, size, &len, "setup", "ms", s_setupHistogram,
+                          s_setupBounds, NUM_ELEMS(s_setupBounds));
+    reportAppendHistogram(buf, size, &len, "lifetime", "s",
+                          s_lifetimeHistogram, s_lifetimeBounds,
+                          NUM_ELEMS(s_lifetimeBounds));
+
+    statsUnlock();
+
+    return len;
+}
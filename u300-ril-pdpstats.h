@@ -0,0 +1,56 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#ifndef U300_RIL_PDPSTATS_H
+#define U300_RIL_PDPSTATS_H 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Interval between samples of the interface counters of active contexts */
+#define PDP_STATS_SAMPLE_INTERVAL_S         5
+
+/* Samples the rolling rates are computed over */
+#define PDP_STATS_WINDOW                    12
+
+/* *EPSB <curr_bearer> values kept apart, higher values share the last one */
+#define PDP_STATS_MAX_BEARERS               8
+
+/* Size of the buffer needed by pdpStatsReport() */
+#define PDP_STATS_REPORT_MAX_LEN            4096
+
+void pdpStatsContextUp(int cid, const char *ifName, long setupMs);
+void pdpStatsContextDown(int cid);
+void pdpStatsBearerChanged(int bearer);
+
+int pdpStatsReport(char *buf, size_t size);
+
+int pdpStatsReadCounter(const char *ifName, const char *counter,
+                        unsigned long long *value);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
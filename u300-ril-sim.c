@@ -29,12 +29,16 @@
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "atchannel.h"
 #include "at_tok.h"
 #include "fcp_parser.h"
 #include "u300-ril.h"
 #include "u300-ril-sim.h"
+#include "u300-ril-simcache.h"
+#include "u300-ril-lchannel.h"
 #include "u300-ril-network.h"
 #include "misc.h"
 
@@ -296,6 +300,117 @@ static const int ef_usim_files[] = {
     0x6FD7, 0x6FD8, 0x6FD9, 0x6FDA, 0x6FDB,
 };
 
+/* Linear fixed files whose records are read ahead after GET RESPONSE */
+static const int ef_prefetch_files[] = {
+    0x6F3A, /* EF_ADN */
+    0x6F3B, /* EF_FDN */
+    0x6F3C, /* EF_SMS */
+    0x6F49, /* EF_SDN */
+    0x6F4A, /* EF_EXT1 */
+    0x6F4B, /* EF_EXT2 */
+    0x6F4C, /* EF_EXT3 */
+    0x6F4E, /* EF_EXT5 */
+};
+
+/* GET RESPONSE in TS 51.011 9.2.1 format, see struct ts_51011_921_resp */
+#define TS_51011_RESP_LEN           15
+
+/* Records read ahead by one prefetch event before giving the queue back */
+#define SIM_PREFETCH_CHUNK          8
+
+/* Parameters of a record read ahead, owned by the prefetch event */
+typedef struct simPrefetchJob {
+    int app;
+    int fileid;
+    char *path;
+    int numRecords;
+    int recordSize;
+    unsigned long generation;
+    int nextRecord;
+    int fetched;
+    struct timeval start;
+} simPrefetchJob;
+
+/*
+ * SIM I/O may be issued from both request queues and from the record
+ * prefetch. The CGLA path keeps the selected file in the modem, so only
+ * one SIM I/O command sequence may be in progress at a time.
+ */
+static pthread_mutex_t s_simIOMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Serializes a SIM I/O command sequence with all others. Also to be taken
+ * around APDUs sent on the pooled logical channels from elsewhere, since
+ * they may change what is selected on them.
+ */
+void simIOLock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_simIOMutex)) != 0) {
+        LOGE("%s() failed to take SIM I/O mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+void simIOUnlock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_simIOMutex)) != 0) {
+        LOGE("%s() failed to release SIM I/O mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+/* Longest path (in hex characters) tracked in the selection model */
+#define SIM_IO_MAX_PATH_LEN 40
+
+/*
+ * Model of what is currently selected on the logical channel used for CGLA
+ * access, so that consecutive accesses only select what differs. Protected
+ * by s_simIOMutex. The AT reader thread can not take that mutex, so it only
+ * marks the model stale through s_lcSelectionStale. The model is also
+ * dropped when the channel pool reports a new epoch for the channel.
+ */
+static struct {
+    int handle;                             /* channel the model refers to */
+    unsigned long epoch;                    /* channel epoch of the model */
+    char df[SIM_IO_MAX_PATH_LEN + 1];       /* path of the current DF */
+    unsigned short ef;                      /* selected EF, 0 if none */
+} s_lcSelection;
+static volatile int s_lcSelectionStale = 0;
+
+/* Id of the (U)SIM application used for CGLA access, empty if unknown */
+static char s_simAid[LCHANNEL_MAX_AID_LEN + 1];
+
+/*
+ * SIM state model. The SIM status and card type are queried from the modem
+ * once and then served from memory until an event (*ESIMSR, *EPEV, PIN
+ * operations, REFRESH or radio off) invalidates them. Invalidation may come
+ * from the AT reader thread, so it only atomically bumps
+ * s_simModelGeneration; a query result is stored only if no invalidation
+ * happened while it was running.
+ */
+static SIM_Status s_simStatus = SIM_NOT_READY;
+static UICC_Type s_uiccType = UICC_TYPE_UNKNOWN;
+static volatile unsigned int s_simModelGeneration = 1;
+static unsigned int s_simStatusGeneration = 0;  /* 0 means not valid */
+static unsigned int s_uiccTypeGeneration = 0;   /* 0 means not valid */
+
+/* Facility lock cache, valid for one generation of the SIM state model */
+typedef struct facilityLockEntry {
+    char facility[3];
+    int response;
+    unsigned int generation;            /* 0 means not valid */
+} facilityLockEntry;
+
+static facilityLockEntry s_facilityLocks[8];
+static size_t s_facilityLockNext = 0;
+static pthread_mutex_t s_facilityLockMutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* Returns true if SIM is absent */
 bool isSimAbsent()
 {
@@ -373,6 +488,11 @@ void onSimStateChanged(const char *s)
     char *line = tok = strdup(s);
     assert(tok != NULL);
 
+    /* The card may have been removed, swapped or reset. */
+    invalidateSIMState();
+    simCacheInvalidateAll("SIM state changed");
+    simIOInvalidateChannels();
+
     RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED, NULL,
                               0);
 
@@ -453,7 +573,18 @@ exit:
 }
 
 /** Returns one of SIM_*. Returns SIM_NOT_READY on error. */
-static SIM_Status getSIMStatus()
+/**
+ * Mark the SIM status and card type as unknown. They are queried from the
+ * modem on next use. Safe to call from the AT reader thread.
+ */
+void invalidateSIMState(void)
+{
+    /* Bumped from several threads, an increment must not be lost. */
+    if (__sync_add_and_fetch(&s_simModelGeneration, 1) == 0)
+        (void)__sync_add_and_fetch(&s_simModelGeneration, 1);
+}
+
+static SIM_Status querySIMStatus()
 {
     ATResponse *atresponse = NULL;
     SIM_Status ret = SIM_ABSENT;
@@ -461,12 +592,6 @@ static SIM_Status getSIMStatus()
     char *cpinResult = NULL;
     ATCmeError cme_error_code;
 
-    if (getCurrentState() == RADIO_STATE_OFF ||
-        getCurrentState() == RADIO_STATE_UNAVAILABLE) {
-        ret = SIM_NOT_READY;
-        goto exit;
-    }
-
     if (at_send_command_singleline("AT+CPIN?", "+CPIN:", &atresponse) != 0) {
         ret = SIM_NOT_READY;
         goto exit;
@@ -582,6 +707,34 @@ exit:
     return ret;
 }
 
+/**
+ * Get the SIM status from the SIM state model, querying the modem only if
+ * an event has invalidated it. Transient states are never stored.
+ */
+static SIM_Status getSIMStatus()
+{
+    unsigned int generation = s_simModelGeneration;
+    SIM_Status status;
+
+    if (getCurrentState() == RADIO_STATE_OFF ||
+        getCurrentState() == RADIO_STATE_UNAVAILABLE) {
+        invalidateSIMState();
+        return SIM_NOT_READY;
+    }
+
+    if (s_simStatusGeneration == generation)
+        return s_simStatus;
+
+    status = querySIMStatus();
+
+    if (status != SIM_NOT_READY && generation == s_simModelGeneration) {
+        s_simStatus = status;
+        s_simStatusGeneration = generation;
+    }
+
+    return status;
+}
+
 /**
  * Fetch information about UICC card type (SIM/USIM)
  *
@@ -590,20 +743,23 @@ exit:
 static UICC_Type getUICCType()
 {
     ATResponse *atresponse = NULL;
-    static UICC_Type UiccType = UICC_TYPE_UNKNOWN; /* FIXME: Static variable */
+    UICC_Type UiccType = UICC_TYPE_UNKNOWN;
+    unsigned int generation = s_simModelGeneration;
     int err;
     char *line = NULL;
     char *dir = NULL;
 
     if (getCurrentState() == RADIO_STATE_OFF ||
         getCurrentState() == RADIO_STATE_UNAVAILABLE) {
-        UiccType = UICC_TYPE_UNKNOWN;
+        invalidateSIMState();
         goto exit;
     }
 
     /* No need to get type again, it is stored */
-    if (UiccType != UICC_TYPE_UNKNOWN)
+    if (s_uiccTypeGeneration == generation) {
+        UiccType = s_uiccType;
         goto exit;
+    }
 
     /* AT+CUAD will respond with the contents of the EF_DIR file on the SIM */
     err = at_send_command_multiline("AT+CUAD", "+CUAD:", &atresponse);
@@ -629,12 +785,18 @@ static UICC_Type getUICCType()
         if (strstr(dir, "A000000087") != NULL) {
             UiccType = UICC_TYPE_USIM;
             LOGI("Detected card type USIM - stored");
-            goto finally;
+            goto store;
         }
     }
 
     UiccType = UICC_TYPE_SIM;
     LOGI("Detected card type SIM - stored");
+
+store:
+    if (generation == s_simModelGeneration) {
+        s_uiccType = UiccType;
+        s_uiccTypeGeneration = generation;
+    }
     goto finally;
 
 error:
@@ -767,102 +929,80 @@ void requestGetSimStatus(void *data, size_t datalen, RIL_Token t)
     return;
 }
 
-static int simIOGetLogicalChannel()
+/**
+ * Get the id of the (U)SIM application, the first application listed in
+ * EF_DIR. The id is kept until the SIM state changes.
+ */
+static const char *simIOGetApplicationId(void)
 {
     ATResponse *atresponse = NULL;
-    static int g_lc = 0;
-    char *cmd = NULL;
-    int err = 0;
-
-    if (g_lc == 0) {
-        struct tlv tlvApp, tlvAppId;
-        char *line;
-        char *resp;
-
-        err = at_send_command_singleline("AT+CUAD", "+CUAD:", &atresponse);
-        if (err < 0)
-            goto error;
-        if (atresponse->success == 0) {
-            err = -1;
-            goto error;
-        }
-
-        line = atresponse->p_intermediates->line;
-        err = at_tok_start(&line);
-        if (err < 0)
-            goto error;
+    struct tlv tlvApp, tlvAppId;
+    char *line;
+    char *resp;
+    int err;
 
-        err = at_tok_nextstr(&line, &resp);
-        if (err < 0)
-            goto error;
+    if (s_simAid[0] != '\0')
+        return s_simAid;
 
-        err = parseTlv(resp, &resp[strlen(resp)], &tlvApp);
-        if (err < 0)
-            goto error;
-        if (tlvApp.tag != 0x61) { /* Application */
-            err = -1;
-            goto error;
-        }
+    err = at_send_command_singleline("AT+CUAD", "+CUAD:", &atresponse);
+    if (err < 0 || atresponse->success == 0)
+        goto error;
 
-        err = parseTlv(tlvApp.data, tlvApp.end, &tlvAppId);
-        if (err < 0)
-            goto error;
-        if (tlvAppId.tag != 0x4F) { /* Application ID */
-            err = -1;
-            goto error;
-        }
+    line = atresponse->p_intermediates->line;
+    err = at_tok_start(&line);
+    if (err < 0)
+        goto error;
 
-        asprintf(&cmd, "AT+CCHO=\"%.*s\"",
-            (int)(tlvAppId.end - tlvAppId.data), tlvAppId.data);
-        if (cmd == NULL) {
-            err = -1;
-            goto error;
-        }
+    err = at_tok_nextstr(&line, &resp);
+    if (err < 0)
+        goto error;
 
-        at_response_free(atresponse);
-        err = at_send_command_singleline(cmd, "+CCHO:", &atresponse);
-        if (err < 0)
-            goto error;
+    err = parseTlv(resp, &resp[strlen(resp)], &tlvApp);
+    if (err < 0 || tlvApp.tag != 0x61) /* Application */
+        goto error;
 
-        if (atresponse->success == 0) {
-            err = -1;
-            goto error;
-        }
+    err = parseTlv(tlvApp.data, tlvApp.end, &tlvAppId);
+    if (err < 0 || tlvAppId.tag != 0x4F) /* Application ID */
+        goto error;
 
-        line = atresponse->p_intermediates->line;
-        err = at_tok_start(&line);
-        if (err < 0)
-            goto error;
+    if (tlvAppId.end - tlvAppId.data > LCHANNEL_MAX_AID_LEN)
+        goto error;
 
-        err = at_tok_nextint(&line, &g_lc);
-        if (err < 0)
-            goto error;
-    }
+    snprintf(s_simAid, sizeof(s_simAid), "%.*s",
+             (int)(tlvAppId.end - tlvAppId.data), tlvAppId.data);
 
 finally:
     at_response_free(atresponse);
-    free(cmd);
-    return g_lc;
+    return s_simAid[0] != '\0' ? s_simAid : NULL;
 
 error:
+    LOGE("%s(): failed to read application id from EF_DIR", __func__);
     goto finally;
 }
 
-static int simIOSelectFile(unsigned short fileid)
+/**
+ * Acquire the logical channel of the (U)SIM application from the channel
+ * pool. Returns 0 and the channel handle on success.
+ */
+static int simIOGetLogicalChannel(int *handle)
+{
+    const char *aid = simIOGetApplicationId();
+
+    if (aid == NULL)
+        return -1;
+
+    return lchannelAcquire(aid, handle);
+}
+
+static int simIOSelectFile(int lc, unsigned short fileid)
 {
     int err = 0;
     char *cmd = NULL;
-    unsigned short lc = simIOGetLogicalChannel();
     ATResponse *atresponse = NULL;
     char *line = NULL;
     char *resp = NULL;
     int resplen;
 
-    if (lc == 0) {
-        err = -1;
-        goto error;
-    }
-
     asprintf(&cmd, "AT+CGLA=%d,14,\"00A4000C02%.4X\"",
         lc, fileid);
     if (cmd == NULL) {
@@ -906,13 +1046,47 @@ error:
     goto finally;
 }
 
-static int simIOSelectPath(const char *path, unsigned short fileid)
+/**
+ * Forget what is selected on the logical channel. Safe to call from the AT
+ * reader thread; the model is reset before the next CGLA access.
+ */
+void simIOInvalidateSelection(void)
+{
+    s_lcSelectionStale = 1;
+}
+
+/**
+ * Forget the logical channels and the application id, e.g. after a SIM
+ * reset. Safe to call from the AT reader thread.
+ */
+void simIOInvalidateChannels(void)
+{
+    s_simAid[0] = '\0';
+    lchannelInvalidateAll();
+    simIOInvalidateSelection();
+}
+
+static void resetSelection(int handle, unsigned long epoch)
+{
+    s_lcSelection.handle = handle;
+    s_lcSelection.epoch = epoch;
+    s_lcSelection.df[0] = '\0';
+    s_lcSelection.ef = 0;
+}
+
+/**
+ * Select path and file on the logical channel. Only the path components
+ * below the current DF, and the EF if it differs, are selected. Any other
+ * path is walked from the MF.
+ */
+static int simIOSelectPath(int handle, int lc, unsigned long epoch,
+                           const char *path, unsigned short fileid)
 {
     int err = 0;
     size_t path_len = 0;
-    size_t pos;
-    static char cashed_path[4 * 10 + 1] = {0};
-    static unsigned short cashed_fileid = 0;
+    size_t df_len;
+    size_t pos = 0;
+    bool track;
 
     if (path == NULL) {
         path = "3F00";
@@ -924,31 +1098,53 @@ static int simIOSelectPath(const char *path, unsigned short fileid)
         goto error;
     }
 
-    if ((fileid != cashed_fileid) || (strcmp(path, cashed_path) != 0)) {
-        for (pos = 0; pos < path_len; pos += 4) {
-            unsigned val;
-            if (sscanf(&path[pos], "%4X", &val) != 1) {
-                err = -1;
-                goto error;
-            }
-            err = simIOSelectFile(val);
-            if (err < 0)
-                goto error;
-        }
-        err = simIOSelectFile(fileid);
+    if (s_lcSelectionStale || s_lcSelection.handle != handle ||
+        s_lcSelection.epoch != epoch) {
+        s_lcSelectionStale = 0;
+        resetSelection(handle, epoch);
     }
-    if (path_len < sizeof(cashed_path)) {
-        strcpy(cashed_path, path);
-        cashed_fileid = fileid;
-    } else {
-        cashed_path[0] = 0;
-        cashed_fileid = 0;
+
+    track = (path_len <= SIM_IO_MAX_PATH_LEN);
+    df_len = strlen(s_lcSelection.df);
+
+    if (track && df_len > 0 && df_len <= path_len &&
+        strncasecmp(path, s_lcSelection.df, df_len) == 0) {
+        /* Current DF is on the path, only walk down from it. */
+        pos = df_len;
+        if (pos == path_len && s_lcSelection.ef == fileid)
+            goto finally;
+    } else
+        resetSelection(handle, epoch);
+
+    for (; pos < path_len; pos += 4) {
+        unsigned val;
+        if (sscanf(&path[pos], "%4X", &val) != 1) {
+            err = -1;
+            goto error;
+        }
+        err = simIOSelectFile(lc, val);
+        if (err < 0)
+            goto error;
+
+        if (track) {
+            strncpy(s_lcSelection.df, path, pos + 4);
+            s_lcSelection.df[pos + 4] = '\0';
+            s_lcSelection.ef = 0;
+        }
     }
 
+    err = simIOSelectFile(lc, fileid);
+    if (err < 0)
+        goto error;
+
+    if (track)
+        s_lcSelection.ef = fileid;
+
 finally:
     return err;
 
 error:
+    resetSelection(handle, epoch);
     goto finally;
 }
 
@@ -958,10 +1154,18 @@ int sendSimIOCmdUICC(const RIL_SIM_IO *ioargs, ATResponse **atresponse, RIL_SIM_
     int resplen;
     char *line = NULL, *resp = NULL;
     char *cmd = NULL, *data = NULL;
-    unsigned short lc = simIOGetLogicalChannel();
+    int handle = -1;
+    int lc = 0;
+    unsigned long epoch = 0;
     unsigned char sw1, sw2;
 
-    if (lc == 0) {
+    if (simIOGetLogicalChannel(&handle) < 0) {
+        handle = -1;
+        err = -1;
+        goto error;
+    }
+
+    if (lchannelResolve(handle, &lc, &epoch) < 0) {
         err = -1;
         goto error;
     }
@@ -1013,7 +1217,7 @@ int sendSimIOCmdUICC(const RIL_SIM_IO *ioargs, ATResponse **atresponse, RIL_SIM_
         goto error;
     }
 
-    err = simIOSelectPath(ioargs->path, ioargs->fileid);
+    err = simIOSelectPath(handle, lc, epoch, ioargs->path, ioargs->fileid);
     if (err < 0)
         goto error;
 
@@ -1058,12 +1262,19 @@ int sendSimIOCmdUICC(const RIL_SIM_IO *ioargs, ATResponse **atresponse, RIL_SIM_
     resp[resplen - 4] = 0;
     sr->simResponse = resp;
 
+    /* A failed APDU may have left another file selected. */
+    if (sw1 != 0x90 && sw1 != 0x91)
+        resetSelection(handle, epoch);
+
 finally:
+    if (handle >= 0)
+        lchannelRelease(handle);
     free(cmd);
     free(data);
     return err;
 
 error:
+    resetSelection(handle, epoch);
     goto finally;
 
 }
@@ -1147,6 +1358,8 @@ static int sendSimIOCmd(const RIL_SIM_IO *ioargs, ATResponse **atresponse, RIL_S
     if (sr == NULL)
         return -1;
 
+    simIOLock();
+
     /* Detect card type to determine which SIM access command to use */
     UiccType = getUICCType();
 
@@ -1188,28 +1401,59 @@ static int sendSimIOCmd(const RIL_SIM_IO *ioargs, ATResponse **atresponse, RIL_S
     } */
 
 exit:
+    simIOUnlock();
     return err;
 }
 
-static int convertSimIoFcp(RIL_SIM_IO_Response *sr, char **cvt)
+/**
+ * Decode the FCP template of a GET RESPONSE from a 3G card. buf must hold
+ * FCP_MAX_SIZE bytes and outlive info, which refers into it.
+ */
+static int decodeSimIoFcp(const char *response, uint8_t *buf,
+                          struct fcp_info *info)
 {
-    int err = 0;
     size_t fcplen;
+
+    if (!response)
+        return -1;
+
+    fcplen = strlen(response);
+    if ((fcplen == 0) || (fcplen & 1) || fcplen / 2 > FCP_MAX_SIZE)
+        return -1;
+
+    if (stringToBinary(response, fcplen, buf) < 0)
+        return -1;
+
+    return fcp_decode(buf, fcplen / 2, info) < 0 ? -1 : 0;
+}
+
+/**
+ * Describe the GET RESPONSE of a 2G card in the same terms as a decoded
+ * FCP template.
+ */
+static int decodeSimIoTs51011(const char *response, struct fcp_info *info)
+{
+    unsigned char resp[TS_51011_RESP_LEN];
+
+    if (!response || strlen(response) < TS_51011_RESP_LEN * 2 ||
+        stringToBinary(response, TS_51011_RESP_LEN * 2, resp) < 0)
+        return -1;
+
+    return ts_51011_to_fcp_info(resp, sizeof(resp), info) < 0 ? -1 : 0;
+}
+
+static int convertSimIoFcp(const struct fcp_info *info, char **cvt)
+{
+    int err = 0;
     struct ts_51011_921_resp resp;
     void *cvt_buf = NULL;
 
-    if (!sr->simResponse || !cvt) {
+    if (!cvt) {
         err = -1;
         goto error;
     }
 
-    fcplen = strlen(sr->simResponse);
-    if ((fcplen == 0) || (fcplen & 1)) {
-        err = -1;
-        goto error;
-    }
-
-    err = fcp_to_ts_51011(sr->simResponse, fcplen, &resp);
+    err = fcp_info_to_ts_51011(info, &resp);
     if (err < 0)
         goto error;
 
@@ -1236,6 +1480,137 @@ error:
     goto finally;
 }
 
+/**
+ * Read all records of a linear fixed file into the SIM I/O cache.
+ * Runs as events on the auxiliary queue, SIM_PREFETCH_CHUNK records at a
+ * time, so that requests queued meanwhile are served in between. Stops as
+ * soon as the cache is invalidated or a record cannot be read.
+ */
+static void prefetchSimRecords(void *param)
+{
+    simPrefetchJob *job = (simPrefetchJob *) param;
+    RIL_SIM_IO ioargs;
+    RIL_SIM_IO_Response sr;
+    ATResponse *atresponse = NULL;
+    struct timeval end;
+    int record;
+    int last;
+    bool done = false;
+    int err;
+
+    memset(&ioargs, 0, sizeof(ioargs));
+    ioargs.command = 0xB2; /* Read record */
+    ioargs.fileid = job->fileid;
+    ioargs.path = job->path;
+    ioargs.p2 = 4; /* Absolute mode, as used by the framework */
+    ioargs.p3 = job->recordSize;
+
+    last = job->nextRecord + SIM_PREFETCH_CHUNK - 1;
+    if (last >= job->numRecords) {
+        last = job->numRecords;
+        done = true;
+    }
+
+    for (record = job->nextRecord; record <= last; record++) {
+        ioargs.p1 = record;
+
+        if (simCacheGeneration() != job->generation) {
+            done = true;
+            break;
+        }
+
+        memset(&sr, 0, sizeof(sr));
+        if (simCacheLookup(job->app, &ioargs, &sr)) {
+            free(sr.simResponse);
+            continue;
+        }
+
+        err = sendSimIOCmd(&ioargs, &atresponse, &sr);
+        if (err < 0 || atresponse->success == 0 ||
+            sr.sw1 != 0x90 || sr.sw2 != 0x00) {
+            LOGD("%s(): EF %.4X record %d not readable, stopping", __func__,
+                 job->fileid, record);
+            done = true;
+            break;
+        }
+
+        /* Content read before an invalidation must not be stored. */
+        if (simCacheGeneration() != job->generation) {
+            done = true;
+            break;
+        }
+
+        simCacheStore(job->app, &ioargs, &sr);
+        job->fetched++;
+
+        at_response_free(atresponse);
+        atresponse = NULL;
+    }
+
+    at_response_free(atresponse);
+
+    if (!done) {
+        job->nextRecord = last + 1;
+        enqueueRILEvent(CMD_QUEUE_AUXILIARY, prefetchSimRecords, job, NULL);
+        return;
+    }
+
+    gettimeofday(&end, NULL);
+    LOGD("%s(): EF %.4X, %d of %d records read ahead in %ld ms", __func__,
+         job->fileid, job->fetched, job->numRecords,
+         (long) ((end.tv_sec - job->start.tv_sec) * 1000 +
+                 (end.tv_usec - job->start.tv_usec) / 1000));
+
+    free(job->path);
+    free(job);
+}
+
+/**
+ * Schedule read ahead of all records of a linear fixed file, based on the
+ * GET RESPONSE the framework just received for it.
+ */
+static void schedulePrefetchSimRecords(int app, const RIL_SIM_IO *ioargs,
+                                       const struct fcp_info *info,
+                                       unsigned long generation)
+{
+    simPrefetchJob *job = NULL;
+    size_t i;
+
+    for (i = 0; i < NUM_ELEMS(ef_prefetch_files); i++)
+        if (ef_prefetch_files[i] == ioargs->fileid)
+            break;
+
+    if (i == NUM_ELEMS(ef_prefetch_files))
+        return;
+
+    if (info->file_type != FCP_FILE_TYPE_EF ||
+        info->structure != FCP_EF_LINEAR_FIXED ||
+        info->record_size == 0 || info->record_size > 0xFF ||
+        info->num_records <= 1)
+        return;
+
+    job = malloc(sizeof(*job));
+    if (job == NULL)
+        return;
+
+    job->app = app;
+    job->fileid = ioargs->fileid;
+    job->path = ioargs->path != NULL ? strdup(ioargs->path) : NULL;
+    job->numRecords = info->num_records;
+    job->recordSize = info->record_size;
+    job->generation = generation;
+    job->nextRecord = 1;
+    job->fetched = 0;
+    gettimeofday(&job->start, NULL);
+
+    if (ioargs->path != NULL && job->path == NULL) {
+        free(job);
+        return;
+    }
+
+    enqueueRILEvent(CMD_QUEUE_AUXILIARY, prefetchSimRecords, job, NULL);
+}
+
 /**
  * enterSimPIN() - Enter PIN to pass PIN(2) verification
  *
@@ -1256,6 +1631,7 @@ static int enterSimPin(char *pin2) {
 
     asprintf(&cmd, "AT+CPIN=\"%s\"", pin2);
     err = at_send_command(cmd, &atresponse);
+    invalidateSIMState();
 
     if (err < 0)
         goto exit;
@@ -1327,6 +1703,10 @@ void requestSIM_IO(void *data, size_t datalen, RIL_Token t)
     bool pinTried = false;
     ATCmeError cme_error_code = -1;
     bool pathReplaced = false;
+    uint8_t fcp[FCP_MAX_SIZE];
+    struct fcp_info fcpInfo;
+    bool haveFcpInfo = false;
+    unsigned long generation;
 
     /*
      * Android telephony framework does not support USIM cards properly,
@@ -1370,6 +1750,15 @@ void requestSIM_IO(void *data, size_t datalen, RIL_Token t)
     }
 #endif
 
+    /* Repeated reads of unchanged files are answered from the cache. */
+    if (simCacheLookup(getUICCType(), &ioargsDup, &sr)) {
+        cvt_done = 1; /* sr.simResponse is a copy that needs to be freed */
+        goto respond;
+    }
+
+    /* Content read across an invalidation must not be cached. */
+    generation = simCacheGeneration();
+
     do {
         /* Reset values for file access */
         rilErrorCode = RIL_E_GENERIC_FAILURE;
@@ -1403,6 +1792,8 @@ void requestSIM_IO(void *data, size_t datalen, RIL_Token t)
         }
         /* Sw1, Sw2 Error Check (0x6982 = Access conditions not fulfilled) */
         else if (sr.sw1 == 0x69 && sr.sw2 == 0x82) {
+            /* PIN2/PUK2 state is only reported after such an access. */
+            invalidateSIMState();
             SIM_Status simState = getSIMStatus();
             if (simState == SIM_PIN2)
                 rilErrorCode = RIL_E_SIM_PIN2;
@@ -1460,13 +1851,27 @@ void requestSIM_IO(void *data, size_t datalen, RIL_Token t)
      * conversion to 2G FCP is required
      */
     if (ioargsDup.command == 0xC0 && getUICCType() != UICC_TYPE_SIM) {
-        if (convertSimIoFcp(&sr, &sr.simResponse) < 0) {
+        if (decodeSimIoFcp(sr.simResponse, fcp, &fcpInfo) < 0 ||
+            convertSimIoFcp(&fcpInfo, &sr.simResponse) < 0) {
             rilErrorCode = RIL_E_GENERIC_FAILURE;
             goto error;
         }
         cvt_done = 1; /* sr.simResponse needs to be freed */
-    }
+        haveFcpInfo = true;
+    } else if (ioargsDup.command == 0xC0)
+        haveFcpInfo = decodeSimIoTs51011(sr.simResponse, &fcpInfo) == 0;
+
+    if (simCacheIsCacheable(ioargsDup.command)) {
+        if (simCacheGeneration() == generation) {
+            simCacheStore(getUICCType(), &ioargsDup, &sr);
+            if (haveFcpInfo)
+                schedulePrefetchSimRecords(getUICCType(), &ioargsDup,
+                                           &fcpInfo, generation);
+        }
+    } else
+        simCacheInvalidateFile(ioargsDup.fileid);
 
+respond:
     /* Finally send response to Android */
     RIL_onRequestComplete(t, RIL_E_SUCCESS, &sr, sizeof(sr));
     goto exit;
@@ -1536,6 +1941,9 @@ void requestEnterSimPin(void *data, size_t datalen, RIL_Token t, int request)
     err = at_send_command(cmd, &atresponse);
     free(cmd);
 
+    /* Whatever the result, the PIN state has changed or must be confirmed. */
+    invalidateSIMState();
+
     if (err < 0) {
         goto error;
     }
@@ -1596,6 +2004,7 @@ static void requestChangePassword(char *facility, void *data, size_t datalen,
 
     err = at_send_command(cmd, &atresponse);
     free(cmd);
+    invalidateSIMState();
 
     num_retries = getNumRetries(request);
 
@@ -1733,6 +2142,7 @@ void requestSetFacilityLock(void *data, size_t datalen, RIL_Token t)
 
     err = at_send_command(cmd, &atresponse);
     free(cmd);
+    invalidateSIMState();
     if (err < 0) {
         goto exit;
     }
@@ -1797,61 +2207,29 @@ exit:
 
 
 /**
- * RIL_REQUEST_QUERY_FACILITY_LOCK
+ * Query the status of a facility lock from the modem.
  *
- * Query the status of a facility lock state.
+ * \param facility: two letter facility, e.g. "SC", "FD" or "AO".
+ * \param classx: service class, 255 for all classes.
+ * \param barring: true for call barring facilities, which report one
+ *                 status per service class.
+ * \param response: sum of the locked service classes for call barring,
+ *                  7 if locked otherwise, 0 if not locked.
+ * \return 0 on success.
  */
-void requestQueryFacilityLock(void *data, size_t datalen, RIL_Token t)
+static int queryFacilityLock(const char *facility, int classx, bool barring,
+                             int *response)
 {
-    int err, response = 0;
+    int err;
     ATResponse *atresponse = NULL;
     char *cmd = NULL;
     char *line = NULL;
-    char *facility_string = NULL;
-    char *facility_class = NULL;
-    int classx;
     ATLine *cursor;
-    size_t i;
-    bool barring_service = false;
-
-    /*
-     * The following barring services may return multiple lines of intermediate
-     * result codes and will return two parameters in the +CLCK response.
-     *
-     *  "AO": barr All Outgoing calls
-     *  "OI": barr Outgoing International calls
-     *  "AI": barr All Incomming calls
-     *  "IR": barr Incoming calls when Roaming outside the home country
-     *  "OX": barr Outgoing international calls eXcept to home country
-     */
-    char *barr_facilities[] = {"AO", "OI", "AI", "IR", "OX", NULL};
-
-    assert(datalen >= (3 * sizeof(char **)));
-
-    facility_string = ((char **) data)[0];
-    facility_class = ((char **) data)[2];
-    classx = atoi(facility_class);
-
-    /*
-     * Android send class 0 for USSD strings that didn't contain a class.
-     * Class 0 is not considered a valid value and according to 3GPP 24.080 a
-     * missing BasicService (BS) parameter in the Supplementary Service string
-     * indicates all BS'es.
-     *
-     * Therefore we convert a class of 0 into 255 (all classes) before sending
-     * the AT command.
-     */
-    if (classx == 0)
-        classx = 255;
 
-    for (i = 0; barr_facilities[i] != NULL; i++) {
-        if (!strncmp(facility_string, barr_facilities[i], 2)) {
-            barring_service = true;
-        }
-    }
+    *response = 0;
 
     /* password is not needed for query of facility lock. */
-    asprintf(&cmd, "AT+CLCK=\"%s\",2,,%d", facility_string, classx);
+    asprintf(&cmd, "AT+CLCK=\"%s\",2,,%d", facility, classx);
 
     err = at_send_command_multiline(cmd, "+CLCK:", &atresponse);
     free(cmd);
@@ -1874,22 +2252,22 @@ void requestQueryFacilityLock(void *data, size_t datalen, RIL_Token t)
         if (err < 0)
             goto error;
 
-        if (barring_service) {
+        if (barring) {
             err = at_tok_nextint(&line, &classx);
 
             if (err < 0)
                 goto error;
 
             if (status == 1)
-                response += classx;
+                *response += classx;
         } else {
             switch (status) {
             case 1:
                 /* Default value including voice, data and fax services */
-                response = 7;
+                *response = 7;
                 break;
             default:
-                response = 0;
+                *response = 0;
             }
             /*
              * There will be only 1 line of intermediate result codes when <fac>
@@ -1899,17 +2277,191 @@ void requestQueryFacilityLock(void *data, size_t datalen, RIL_Token t)
         }
     }
 
-    RIL_onRequestComplete(t, RIL_E_SUCCESS, &response, sizeof(int *));
+    err = 0;
 
 finally:
     at_response_free(atresponse);
-    return;
+    return err;
 
 error:
-    RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+    err = -1;
     goto finally;
 }
 
+/**
+ * Get the status of a facility lock from the facility lock cache, querying
+ * the modem on a miss. Entries are valid for the current generation of the
+ * SIM state model, so every event that invalidates the SIM state (PIN and
+ * PIN2 operations, facility lock changes, REFRESH, SIM state changes) also
+ * invalidates the cache.
+ *
+ * Only facilities held on the SIM are cached. Call barring and other network
+ * facilities can be changed with SS dial strings or by the network without
+ * the SIM state model noticing, so those are always queried from the modem.
+ */
+int getFacilityLock(const char *facility, int classx, int *response)
+{
+    /*
+     * The following barring services may return multiple lines of intermediate
+     * result codes and will return two parameters in the +CLCK response.
+     *
+     *  "AO": barr All Outgoing calls
+     *  "OI": barr Outgoing International calls
+     *  "AI": barr All Incomming calls
+     *  "IR": barr Incoming calls when Roaming outside the home country
+     *  "OX": barr Outgoing international calls eXcept to home country
+     */
+    static const char *barr_facilities[] = {"AO", "OI", "AI", "IR", "OX",
+        NULL};
+    /*
+     * Facilities whose lock status is stored on the SIM and does not depend
+     * on the service class.
+     */
+    static const char *sim_facilities[] = {"SC", "FD", "PS", "PF", "PN", "PU",
+        "PP", "PC", NULL};
+    unsigned int generation = s_simModelGeneration;
+    facilityLockEntry *slot = NULL;
+    bool barring = false;
+    bool cacheable = false;
+    int err;
+    size_t i;
+
+    if (facility == NULL || strlen(facility) != 2)
+        return -1;
+
+    for (i = 0; barr_facilities[i] != NULL; i++) {
+        if (!strncmp(facility, barr_facilities[i], 2)) {
+            barring = true;
+        }
+    }
+
+    for (i = 0; sim_facilities[i] != NULL; i++) {
+        if (!strncmp(facility, sim_facilities[i], 2)) {
+            cacheable = true;
+        }
+    }
+
+    if (!cacheable)
+        return queryFacilityLock(facility, classx, barring, response);
+
+    if ((err = pthread_mutex_lock(&s_facilityLockMutex)) != 0) {
+        LOGE("%s() failed to take facility lock mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+
+    for (i = 0; i < NUM_ELEMS(s_facilityLocks); i++) {
+        facilityLockEntry *e = &s_facilityLocks[i];
+
+        if (e->generation == generation &&
+            strncmp(e->facility, facility, 2) == 0) {
+            *response = e->response;
+            slot = e;
+            break;
+        }
+    }
+
+    if ((err = pthread_mutex_unlock(&s_facilityLockMutex)) != 0) {
+        LOGE("%s() failed to release facility lock mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+
+    if (slot != NULL)
+        return 0;
+
+    if (queryFacilityLock(facility, classx, barring, response) < 0)
+        return -1;
+
+    if ((err = pthread_mutex_lock(&s_facilityLockMutex)) != 0) {
+        LOGE("%s() failed to take facility lock mutex: %s!", __func__,
+             strerror(err));
+        assert(0);
+    }
+
+    /* Reuse an entry of an earlier generation, or replace round robin. */
+    if (generation == s_simModelGeneration) {
+        for (i = 0; i < NUM_ELEMS(s_facilityLocks); i++) {
+            if (s_facilityLocks[i].generation != generation) {
+                slot = &s_facilityLocks[i];
+                break;
+            }
+        }
+        if (slot == NULL) {
+            slot = &s_facilityLocks[s_facilityLockNext];
+            s_facilityLockNext = (s_facilityLockNext + 1) %
+                                 NUM_ELEMS(s_facilityLocks);
+        }
+
+        strncpy(slot->facility, facility, 2);
+        slot->facility[2] = '\0';
+        slot->response = *response;
+        slot->generation = generation;
+    }
+
+    if ((err = pthread_mutex_unlock(&s_facilityLockMutex)) != 0) {
+        LOGE("%s() failed to release facility lock mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+
+    return 0;
+}
+
+/**
+ * Returns false if FDN is not active, not available or failed to get result
+ * for AT+CLCK, true if FDN is enabled.
+ */
+bool isFdnEnabled(void)
+{
+    int response = 0;
+
+    if (getFacilityLock("FD", 7, &response) < 0) {
+        LOGE("%s(): Failed to get FDN facility status.\n", __func__);
+        return false;
+    }
+
+    return response != 0;
+}
+
+/**
+ * RIL_REQUEST_QUERY_FACILITY_LOCK
+ *
+ * Query the status of a facility lock state.
+ */
+void requestQueryFacilityLock(void *data, size_t datalen, RIL_Token t)
+{
+    int response = 0;
+    char *facility_string = NULL;
+    char *facility_class = NULL;
+    int classx;
+
+    assert(datalen >= (3 * sizeof(char **)));
+
+    facility_string = ((char **) data)[0];
+    facility_class = ((char **) data)[2];
+    classx = atoi(facility_class);
+
+    /*
+     * Android send class 0 for USSD strings that didn't contain a class.
+     * Class 0 is not considered a valid value and according to 3GPP 24.080 a
+     * missing BasicService (BS) parameter in the Supplementary Service string
+     * indicates all BS'es.
+     *
+     * Therefore we convert a class of 0 into 255 (all classes) before sending
+     * the AT command.
+     */
+    if (classx == 0)
+        classx = 255;
+
+    if (getFacilityLock(facility_string, classx, &response) < 0) {
+        RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+        return;
+    }
+
+    RIL_onRequestComplete(t, RIL_E_SUCCESS, &response, sizeof(int *));
+}
+
 /**
  * Check if string array contains the passed string.
  *
@@ -1989,6 +2541,78 @@ static char bcdToAscii(const unsigned char bcd)
     }
 }
 
+/*
+ * Copy of the emergency numbers in ril.ecclist, kept so that dial requests
+ * can be classified without reading the property.
+ */
+static char s_emergencyNumbers[PROPERTY_VALUE_MAX] = DEFAULT_EMERGENCY_LIST;
+static pthread_mutex_t s_emergencyNumbersMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void lockEmergencyNumbers(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_emergencyNumbersMutex)) != 0) {
+        LOGE("%s() failed to take emergency numbers mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void unlockEmergencyNumbers(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_emergencyNumbersMutex)) != 0) {
+        LOGE("%s() failed to release emergency numbers mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+/**
+ * Sets the emergency numbers, a comma-separated list, in the r/w ECC list
+ * property (ril.ecclist) and in the in-memory copy used by
+ * isEmergencyNumber().
+ */
+void setEmergencyNumbers(const char *list)
+{
+    lockEmergencyNumbers();
+    strncpy(s_emergencyNumbers, list, sizeof(s_emergencyNumbers) - 1);
+    s_emergencyNumbers[sizeof(s_emergencyNumbers) - 1] = '\0';
+    unlockEmergencyNumbers();
+
+    if (property_set(PROP_EMERGENCY_LIST_RW, list) < 0)
+        LOGE("[ECC]: Setting emergency list %s failed!",
+             PROP_EMERGENCY_LIST_RW);
+}
+
+/**
+ * Returns true if \a number is one of the current emergency numbers.
+ */
+bool isEmergencyNumber(const char *number)
+{
+    const char *p;
+    size_t len;
+    bool found = false;
+
+    if (number == NULL || (len = strlen(number)) == 0)
+        return false;
+
+    lockEmergencyNumbers();
+    for (p = s_emergencyNumbers; *p != '\0'; p++) {
+        if ((p == s_emergencyNumbers || p[-1] == ',') &&
+            strncmp(p, number, len) == 0 &&
+            (p[len] == ',' || p[len] == '\0')) {
+            found = true;
+            break;
+        }
+    }
+    unlockEmergencyNumbers();
+
+    return found;
+}
+
 /**
  * Store an ECC list in the r/w ECC list property (ril.ecclist).
  *
@@ -2040,7 +2664,7 @@ static void storeEccList(const char *list, int use_japan_extensions)
         phoneListAppendList(&buf, std_ecc_jpn);
     if (buf) {
         LOGD("[ECC]: ECC phone numbers: %s", buf);
-        (void)property_set(PROP_EMERGENCY_LIST_RW, buf);
+        setEmergencyNumbers(buf);
         free(buf);
     }
 exit:
@@ -2085,10 +2709,11 @@ bool read3GECCFile(int use_japan_extensions)
     int err = 0;
     ATResponse *atresponse = NULL;
     int numRecords = 0;
-    int fileSize = 0;
     int recordSize = 0;
     int i = 1;
     char *ecc_list = NULL;
+    uint8_t fcp[FCP_MAX_SIZE];
+    struct fcp_info fcpInfo;
 
     RIL_SIM_IO ioargs;
     RIL_SIM_IO_Response sr;
@@ -2111,32 +2736,21 @@ bool read3GECCFile(int use_japan_extensions)
         return false;
     }
 
-    /*
-     * Convert response from GET_RESPONSE using convertSimIoFcp() to
-     * simplify fetching record size and file size using fixed offsets.
-     */
-    err = convertSimIoFcp(&sr, &sr.simResponse);
-    if (err < 0) {
-        LOGW("[ECC]: Conversion of GET RESPONSE data failed.");
-        goto error2;
+    err = decodeSimIoFcp(sr.simResponse, fcp, &fcpInfo);
+    if (err < 0 || fcpInfo.record_size == 0) {
+        LOGW("[ECC]: Decoding of GET RESPONSE data failed.");
+        goto error;
     }
 
-    /* Convert hex string to int's and calculate number of records */
-    recordSize = ((char2nib(sr.simResponse[28]) * 16) +
-        char2nib(sr.simResponse[29])) & 0xff;
-    fileSize = ((((char2nib(sr.simResponse[4]) * 16) +
-        char2nib(sr.simResponse[5])) & 0xff) << 8) +
-        (((char2nib(sr.simResponse[6]) * 16) +
-        char2nib(sr.simResponse[7])) & 0xff);
-    numRecords = fileSize / recordSize;
+    recordSize = fcpInfo.record_size;
+    numRecords = fcpInfo.file_size / recordSize;
 
     LOGI("[ECC]: Number of records in EFecc file: %d", numRecords);
 
     if (numRecords > 254) {
-        goto error1;
+        goto error;
     }
 
-    free(sr.simResponse); /* sr.simResponse needs to be freed */
     at_response_free(atresponse);
     atresponse = NULL;
 
@@ -2147,7 +2761,7 @@ bool read3GECCFile(int use_japan_extensions)
     ecc_list = malloc((numRecords * 3 * 2) + 1);
     if(!ecc_list) {
         LOGE("[ECC]: Failed to allocate memory for SIM fetched ECC's");
-        goto error1;
+        goto error;
     }
     memset(ecc_list, 0, (numRecords * 3 * 2) + 1);
 
@@ -2182,10 +2796,7 @@ bool read3GECCFile(int use_japan_extensions)
     }
     goto finally;
 
-error1:
-    if(sr.simResponse)
-        free(sr.simResponse); /* sr.simResponse needs to be freed */
-error2:
+error:
     at_response_free(atresponse);
 
 finally:
@@ -24,9 +24,16 @@
 #ifndef U300_RIL_SIM_H
 #define U300_RIL_SIM_H 1
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define PROP_EMERGENCY_LIST_RO ("ro.ril.ecclist")
 #define PROP_EMERGENCY_LIST_RW ("ril.ecclist")
 
+/* Emergency numbers from 3GPP TS 22.101, chapter 10.1.1 */
+#define DEFAULT_EMERGENCY_LIST "911,112,000,08,110,999,118,119"
+
 void onSimStateChanged(const char *s);
 
 void requestGetSimStatus(void *data, size_t datalen, RIL_Token t);
@@ -38,9 +45,22 @@ void requestChangeBarringPassword(void *data, size_t datalen, RIL_Token t, int r
 void requestSetFacilityLock(void *data, size_t datalen, RIL_Token t);
 void requestQueryFacilityLock(void *data, size_t datalen, RIL_Token t);
 
+int getFacilityLock(const char *facility, int classx, int *response);
+bool isFdnEnabled(void);
+
 bool isSimAbsent();
 void pollSIMState(void *param);
+void invalidateSIMState(void);
+void simIOInvalidateSelection(void);
+void simIOInvalidateChannels(void);
+void simIOLock(void);
+void simIOUnlock(void);
 
 void setupECCList(int check_attached_network);
+void setEmergencyNumbers(const char *list);
+bool isEmergencyNumber(const char *number);
 
+#ifdef __cplusplus
+}
+#endif
 #endif
@@ -0,0 +1,309 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <telephony/ril.h>
+
+#include "u300-ril-simcache.h"
+
+#define LOG_TAG "RILV"
+#include <utils/Log.h>
+
+/*
+ * Cache of successful SIM I/O read responses.
+ *
+ * An entry is identified by the application (SIM or USIM ADF), the command
+ * (READ BINARY, READ RECORD or GET RESPONSE), the path and file id, and the
+ * P1-P3 parameters which hold the record number or offset and length.
+ *
+ * The cache is filled from the request queue threads and invalidated both
+ * from there (UPDATE commands) and from the AT reader thread (REFRESH and
+ * SIM state indications), so all access is serialized by s_cacheMutex.
+ */
+typedef struct simCacheEntry {
+    int used;
+    int app;
+    int command;
+    int fileid;
+    int p1;
+    int p2;
+    int p3;
+    char path[SIM_CACHE_MAX_PATH_LEN + 1];
+    int sw1;
+    int sw2;
+    char *response;
+    unsigned long lastUsed;
+} simCacheEntry;
+
+static simCacheEntry s_cache[SIM_CACHE_MAX_ENTRIES];
+static unsigned long s_cacheClock = 0;
+static unsigned long s_cacheGeneration = 0;
+static struct simCacheStats s_cacheStats;
+static pthread_mutex_t s_cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void cacheLock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_lock(&s_cacheMutex)) != 0) {
+        LOGE("%s() failed to take cache mutex: %s!", __func__, strerror(err));
+        assert(0);
+    }
+}
+
+static void cacheUnlock(void)
+{
+    int err;
+
+    if ((err = pthread_mutex_unlock(&s_cacheMutex)) != 0) {
+        LOGE("%s() failed to release cache mutex: %s", __func__,
+             strerror(err));
+        assert(0);
+    }
+}
+
+static void clearEntry(simCacheEntry *e)
+{
+    free(e->response);
+    memset(e, 0, sizeof(*e));
+}
+
+static bool entryMatches(const simCacheEntry *e, int app,
+                         const RIL_SIM_IO *ioargs)
+{
+    const char *path = ioargs->path != NULL ? ioargs->path : "";
+
+    return e->used &&
+           e->app == app &&
+           e->command == ioargs->command &&
+           e->fileid == ioargs->fileid &&
+           e->p1 == ioargs->p1 &&
+           e->p2 == ioargs->p2 &&
+           e->p3 == ioargs->p3 &&
+           strcasecmp(e->path, path) == 0;
+}
+
+/**
+ * Returns true if the SIM I/O command only reads from the SIM and its
+ * response can be served from the cache.
+ */
+bool simCacheIsCacheable(int command)
+{
+    switch (command) {
+    case 0xB0: /* Read binary */
+    case 0xB2: /* Read record */
+    case 0xC0: /* Get response */
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Look up a cached response for a SIM I/O request.
+ *
+ * \param app: application the path refers to (see UICC_Type).
+ * \param ioargs: the request, after any path rewriting done by the caller.
+ * \param sr: filled in on hit. sr->simResponse is allocated and must be
+ *            freed by the caller.
+ * \return true on cache hit.
+ */
+bool simCacheLookup(int app, const RIL_SIM_IO *ioargs,
+                    RIL_SIM_IO_Response *sr)
+{
+    int i;
+    bool found = false;
+
+    if (!simCacheIsCacheable(ioargs->command))
+        return false;
+
+    cacheLock();
+
+    for (i = 0; i < SIM_CACHE_MAX_ENTRIES; i++) {
+        simCacheEntry *e = &s_cache[i];
+
+        if (!entryMatches(e, app, ioargs))
+            continue;
+
+        sr->sw1 = e->sw1;
+        sr->sw2 = e->sw2;
+        sr->simResponse = e->response != NULL ? strdup(e->response) : NULL;
+        if (e->response != NULL && sr->simResponse == NULL)
+            break;
+
+        e->lastUsed = ++s_cacheClock;
+        found = true;
+        break;
+    }
+
+    if (found)
+        s_cacheStats.hits++;
+    else
+        s_cacheStats.misses++;
+
+    cacheUnlock();
+
+    return found;
+}
+
+/**
+ * Store the successful response of a SIM I/O read request. The least
+ * recently used entry is replaced when the cache is full.
+ */
+void simCacheStore(int app, const RIL_SIM_IO *ioargs,
+                   const RIL_SIM_IO_Response *sr)
+{
+    int i;
+    simCacheEntry *slot = NULL;
+    const char *path = ioargs->path != NULL ? ioargs->path : "";
+
+    if (!simCacheIsCacheable(ioargs->command))
+        return;
+
+    if (strlen(path) > SIM_CACHE_MAX_PATH_LEN)
+        return;
+
+    cacheLock();
+
+    for (i = 0; i < SIM_CACHE_MAX_ENTRIES; i++) {
+        simCacheEntry *e = &s_cache[i];
+
+        if (entryMatches(e, app, ioargs)) {
+            slot = e;
+            break;
+        }
+        if (!e->used) {
+            if (slot == NULL || slot->used)
+                slot = e;
+        } else if (slot == NULL ||
+                   (slot->used && e->lastUsed < slot->lastUsed)) {
+            slot = e;
+        }
+    }
+
+    if (slot->used && !entryMatches(slot, app, ioargs))
+        s_cacheStats.evictions++;
+
+    clearEntry(slot);
+
+    if (sr->simResponse != NULL) {
+        slot->response = strdup(sr->simResponse);
+        if (slot->response == NULL)
+            goto exit;
+    }
+
+    slot->used = 1;
+    slot->app = app;
+    slot->command = ioargs->command;
+    slot->fileid = ioargs->fileid;
+    slot->p1 = ioargs->p1;
+    slot->p2 = ioargs->p2;
+    slot->p3 = ioargs->p3;
+    strcpy(slot->path, path);
+    slot->sw1 = sr->sw1;
+    slot->sw2 = sr->sw2;
+    slot->lastUsed = ++s_cacheClock;
+    s_cacheStats.stores++;
+
+exit:
+    cacheUnlock();
+}
+
+/**
+ * Drop all cached content of one elementary file, regardless of the path
+ * it was read through.
+ */
+void simCacheInvalidateFile(int fileid)
+{
+    int i;
+    int dropped = 0;
+
+    cacheLock();
+
+    for (i = 0; i < SIM_CACHE_MAX_ENTRIES; i++) {
+        if (s_cache[i].used && s_cache[i].fileid == fileid) {
+            clearEntry(&s_cache[i]);
+            dropped++;
+        }
+    }
+    s_cacheGeneration++;
+    s_cacheStats.invalidations++;
+
+    cacheUnlock();
+
+    if (dropped > 0)
+        LOGD("%s(): dropped %d entries of EF %.4X", __func__, dropped,
+             fileid);
+}
+
+/**
+ * Drop the whole cache, e.g. on SIM reset, SIM state change or REFRESH
+ * with SIM initialization.
+ */
+void simCacheInvalidateAll(const char *reason)
+{
+    int i;
+
+    cacheLock();
+
+    for (i = 0; i < SIM_CACHE_MAX_ENTRIES; i++)
+        if (s_cache[i].used)
+            clearEntry(&s_cache[i]);
+    s_cacheGeneration++;
+    s_cacheStats.invalidations++;
+
+    LOGD("%s(): %s (hits %lu, misses %lu, stores %lu, evictions %lu)",
+         __func__, reason != NULL ? reason : "", s_cacheStats.hits,
+         s_cacheStats.misses, s_cacheStats.stores, s_cacheStats.evictions);
+
+    cacheUnlock();
+}
+
+/**
+ * Returns a counter that changes on every invalidation. Background readers
+ * compare it before storing, to avoid filling the cache with content that
+ * was invalidated while they were reading.
+ */
+unsigned long simCacheGeneration(void)
+{
+    unsigned long generation;
+
+    cacheLock();
+    generation = s_cacheGeneration;
+    cacheUnlock();
+
+    return generation;
+}
+
+void simCacheGetStats(struct simCacheStats *stats)
+{
+    cacheLock();
+    *stats = s_cacheStats;
+    cacheUnlock();
+}
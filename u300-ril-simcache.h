@@ -0,0 +1,56 @@
+/* ST-Ericsson U300 RIL
+**
+** Copyright (C) ST-Ericsson AB 2008-2010
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**
+** Based on reference-ril by The Android Open Source Project.
+**
+** Heavily modified for ST-Ericsson U300 modems.
+*/
+
+#ifndef U300_RIL_SIMCACHE_H
+#define U300_RIL_SIMCACHE_H 1
+
+#include <stdbool.h>
+#include <telephony/ril.h>
+
+/* Maximum number of cached SIM I/O responses */
+#define SIM_CACHE_MAX_ENTRIES       512
+
+/* Longest path (in hex characters) that will be cached */
+#define SIM_CACHE_MAX_PATH_LEN      40
+
+struct simCacheStats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long stores;
+    unsigned long evictions;
+    unsigned long invalidations;
+};
+
+bool simCacheIsCacheable(int command);
+
+bool simCacheLookup(int app, const RIL_SIM_IO *ioargs,
+                    RIL_SIM_IO_Response *sr);
+void simCacheStore(int app, const RIL_SIM_IO *ioargs,
+                   const RIL_SIM_IO_Response *sr);
+
+void simCacheInvalidateFile(int fileid);
+void simCacheInvalidateAll(const char *reason);
+
+unsigned long simCacheGeneration(void);
+void simCacheGetStats(struct simCacheStats *stats);
+
+#endif
@@ -29,6 +29,8 @@
 #include "misc.h"
 #include <telephony/ril.h>
 #include "u300-ril.h"
+#include "u300-ril-sim.h"
+#include "u300-ril-simcache.h"
 
 #define LOG_TAG "RILV"
 #include <utils/Log.h>
@@ -527,6 +529,12 @@ void onStkSimRefresh(const char *s)
     }
 
     if (response[0] != SIM_FILE_UPDATE) {
+        invalidateSIMState();
+        simCacheInvalidateAll("SIM refresh");
+        if (response[0] == SIM_RESET)
+            simIOInvalidateChannels();
+        else
+            simIOInvalidateSelection();
         response[1] = 0;
         RIL_onUnsolicitedResponse(RIL_UNSOL_SIM_REFRESH,
                                   response, sizeof(response));
@@ -551,6 +559,8 @@ void onStkSimRefresh(const char *s)
             else
                 goto error;
         }
+        simCacheInvalidateFile(response[1]);
+        simIOInvalidateSelection();
         RIL_onUnsolicitedResponse(RIL_UNSOL_SIM_REFRESH,
                                   response, sizeof(response));
     }
@@ -566,6 +576,9 @@ error:
         s_refeshStatus.Result = 2; /* command performed with missing info */
     response[0] = SIM_INIT;
     response[1] = 0;
+    invalidateSIMState();
+    simCacheInvalidateAll("SIM refresh");
+    simIOInvalidateSelection();
     RIL_onUnsolicitedResponse(RIL_UNSOL_SIM_REFRESH,
                               response, sizeof(response));
 
@@ -24,7 +24,7 @@
 #ifndef U300_RIL_STK_H
 #define U300_RIL_STK_H 1
 
-int checkAndClear_SIM_NAA_SESSION_RESET(void *param);
+int checkAndClear_SIM_NAA_SESSION_RESET(void);
 void requestStkSendTerminalResponse(void *data, size_t datalen,
                                     RIL_Token t);
 void requestStkSendEnvelopeCommand(void *data, size_t datalen,
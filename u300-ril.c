@@ -52,11 +52,13 @@
 
 #include "u300-ril.h"
 #include "u300-ril-callhandling.h"
+#include "u300-ril-calltimeline.h"
 #include "u300-ril-messaging.h"
 #include "u300-ril-network.h"
 #include "u300-ril-pdp.h"
 #include "u300-ril-services.h"
 #include "u300-ril-sim.h"
+#include "u300-ril-simcache.h"
 #include "u300-ril-stk.h"
 #include "u300-ril-oem.h"
 #include "u300-ril-requestdatahandler.h"
@@ -132,9 +134,19 @@ static RequestQueue s_requestQueueAuxiliary = {
     .closed = 1
 };
 
+static RequestQueue s_requestQueueData = {
+    .queueMutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .requestList = NULL,
+    .eventList = NULL,
+    .enabled = 0,
+    .closed = 1
+};
+
 static RequestQueue *s_requestQueues[] = {
     &s_requestQueueDefault,
-    &s_requestQueueAuxiliary
+    &s_requestQueueAuxiliary,
+    &s_requestQueueData
 };
 
 #define RIL_REQUEST_LAST_ELEMENT 0xFFFF
@@ -151,9 +163,23 @@ static int defaultRequests[] = {
     RIL_REQUEST_LAST_ELEMENT
 };
 
+/*
+ * Data call setup and deactivation wait for the network for seconds. With
+ * the optional DATA group they get an AT channel of their own, so they do
+ * not hold up other requests on the AUXILIARY channel. Requests for the
+ * same cid stay in order since they share one queue.
+ */
+static int dataRequests[] = {
+    RIL_REQUEST_SETUP_DATA_CALL,
+    RIL_REQUEST_DEACTIVATE_DATA_CALL,
+    RIL_REQUEST_LAST_DATA_CALL_FAIL_CAUSE,
+    RIL_REQUEST_LAST_ELEMENT
+};
+
 static RILRequestGroup RILRequestGroups[] = {
     {CMD_QUEUE_DEFAULT, "DEFAULT", defaultRequests, &s_requestQueueDefault},
-    {CMD_QUEUE_AUXILIARY, "AUXILIARY", NULL, &s_requestQueueAuxiliary}
+    {CMD_QUEUE_AUXILIARY, "AUXILIARY", NULL, &s_requestQueueAuxiliary},
+    {CMD_QUEUE_DATA, "DATA", dataRequests, &s_requestQueueData}
 };
 
 void enqueueRILEventOnList(RequestQueue* q, RILEvent* e)
@@ -250,6 +276,15 @@ void enqueueRILEvent(int eventQueue, void (*callback)(void *param),
         } else
             enqueueRILEventOnList(&s_requestQueueAuxiliary, e);
         break;
+    case CMD_QUEUE_DATA:
+        /* DATA group is optional, its work is done on AUXILIARY otherwise */
+        if (RILRequestGroups[CMD_QUEUE_DATA].requestQueue->enabled)
+            enqueueRILEventOnList(&s_requestQueueData, e);
+        else if (RILRequestGroups[CMD_QUEUE_AUXILIARY].requestQueue->enabled)
+            enqueueRILEventOnList(&s_requestQueueAuxiliary, e);
+        else
+            enqueueRILEventOnList(&s_requestQueueDefault, e);
+        break;
     default:
         LOGW("%s(): Unknown event queue!"
             " Posting event on DEFAULT queue.", __func__);
@@ -344,6 +379,11 @@ static void onSIMReady()
     /* Configure ST-Ericsson current PS bearer Reporting. */
     if (at_send_command("AT*EPSB=1", NULL) < 0)
         LOGW("%s(): Failed to send AT+EPSB", __func__);
+    else
+        pdpSetBearerReporting(true);
+
+    /* Set up the PDP accounts used before, ready for the next data call. */
+    enqueueRILEvent(CMD_QUEUE_DATA, pdpProvisionAccounts, NULL, NULL);
 
 #ifdef LTE_COMMAND_SET_ENABLED
     /*
@@ -946,6 +986,7 @@ static void onRequest(int request, void *data, size_t datalen, RIL_Token t)
 {
     RILRequest *r;
     RequestQueue *q = &s_requestQueueDefault;
+    bool emergency = false;
     int err;
 
     /* In radio state unavailable no requests are to enter the queues */
@@ -956,6 +997,19 @@ static void onRequest(int request, void *data, size_t datalen, RIL_Token t)
 
     q = getRequestQueue(request);
 
+    if (request == RIL_REQUEST_DIAL && data != NULL &&
+        isEmergencyNumber(((RIL_Dial *) data)->address)) {
+        emergencyDialReceived();
+        emergency = true;
+    }
+
+    if (request == RIL_REQUEST_DIAL)
+        callTimelineRecord(0, CALL_EVENT_DIAL_RECEIVED);
+    else if (request == RIL_REQUEST_ANSWER)
+        callTimelineRecord(0, CALL_EVENT_ANSWER_RECEIVED);
+    else if (request == RIL_REQUEST_HANGUP && data != NULL)
+        callTimelineRecord(((int *) data)[0], CALL_EVENT_HANGUP_RECEIVED);
+
     r = calloc(1, sizeof(RILRequest));
     assert(r != NULL);
 
@@ -974,7 +1028,11 @@ static void onRequest(int request, void *data, size_t datalen, RIL_Token t)
     /* Queue empty, just throw r on top. */
     if (q->requestList == NULL)
         q->requestList = r;
-    else {
+    /* Emergency calls go ahead of everything already queued. */
+    else if (emergency) {
+        r->next = q->requestList;
+        q->requestList = r;
+    } else {
         RILRequest *l = q->requestList;
         while (l->next != NULL)
             l = l->next;
@@ -994,6 +1052,52 @@ finally:
     return;
 }
 
+/**
+ * Removes the request at the head of the queue serving \a request, if it
+ * is of that type, so a handler can serve consecutive requests in one go.
+ * Only to be called from the queue thread serving \a request.
+ *
+ * The request passes the same radio and SIM state filter as requests run
+ * by the queue, a request rejected by the filter is completed here.
+ *
+ * \return the request, to be completed by the caller and freed with
+ *         freeQueuedRequest(), or NULL.
+ */
+RILRequest *takeQueuedRequest(int request)
+{
+    RequestQueue *q = getRequestQueue(request);
+    RILRequest *r = NULL;
+    int err;
+
+    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0) {
+        LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+        assert(0);
+    }
+
+    if (q->requestList != NULL && q->requestList->request == request) {
+        r = q->requestList;
+        q->requestList = r->next;
+        r->next = NULL;
+    }
+
+    if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to release queue mutex: %s!",
+            __func__, strerror(err));
+
+    if (r != NULL && requestStateFilter(r->request, r->token)) {
+        freeQueuedRequest(r);
+        r = NULL;
+    }
+
+    return r;
+}
+
+void freeQueuedRequest(RILRequest *r)
+{
+    freeRequestData(r->request, r->data, r->datalen);
+    free(r);
+}
+
 int getRestrictedState(void)
 {
     return s_restrictedState;
@@ -1115,6 +1219,21 @@ void setRadioState(RIL_RadioState newState)
         RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED,
                                   NULL, 0);
 
+        /* SIM content can not be trusted across power cycles. */
+        if (s_state == RADIO_STATE_OFF ||
+            s_state == RADIO_STATE_UNAVAILABLE) {
+            simCacheInvalidateAll("radio off");
+            simIOInvalidateChannels();
+        }
+
+        /* PDP accounts are lost if the modem restarts. */
+        if (s_state == RADIO_STATE_UNAVAILABLE) {
+            pdpInvalidateAccounts();
+            pdpSetBearerReporting(false);
+            resetDTMFState();
+            callTimelineReset();
+        }
+
         if (s_state == RADIO_STATE_SIM_READY)
             enqueueRILEvent(CMD_QUEUE_DEFAULT, onSIMReady, NULL, NULL);
         else if (s_state == RADIO_STATE_SIM_NOT_READY)
@@ -1349,28 +1468,20 @@ static bool initializeDefault()
      * 911 and 112 should always be set in the system property, but if SIM is
      * absent, these numbers also has to be added: 000, 08, 110, 999, 118
      * and 119.
+     *
+     * We do not go to error if the property can not be set. Even though we
+     * cannot set emergency numbers it is better to continue and at least be
+     * able to call some numbers.
      */
-    err = property_set(PROP_EMERGENCY_LIST_RW,
-                        "911,112,000,08,110,999,118,119");
-
-    /*
-     * We do not go to error in this case. Even though we cannot set emergency
-     * numbers it is better to continue and at least be able to call some
-     * numbers.
-     */
-    if (err < 0)
-        LOGE("[ECC] Creating emergency list ril.ecclist"
-            " in system properties failed!");
-    else
-        LOGD("[ECC] Set initial defaults to system property ril.ecclist");
+    setEmergencyNumbers(DEFAULT_EMERGENCY_LIST);
+    LOGD("[ECC] Set initial defaults to system property ril.ecclist");
 
     /*
      * Older versions of Android does not support ril.ecclist. For legacy
      * reasons ro.ril.ecclist is therefore set up with emergency numbers from
      * 3GPP TS 22.101, chapter 10.1.1.
      */
-    err = property_set(PROP_EMERGENCY_LIST_RO,
-                        "911,112,000,08,110,999,118,119");
+    err = property_set(PROP_EMERGENCY_LIST_RO, DEFAULT_EMERGENCY_LIST);
 
     if (err < 0)
         LOGE("[ECC] Creating emergency list ro.ril.ecclist in "
@@ -1419,9 +1530,12 @@ static void onUnsolicited(const char *s, const char *sms_pdu)
                                   NULL, 0);
 
         onNetworkTimeReceived(s);
-    } else if (strStartsWith(s, "*EPEV"))
+    } else if (strStartsWith(s, "*EPEV")) {
         /* Pin event, poll SIM State! */
+        invalidateSIMState();
+        simCacheInvalidateAll("PIN event");
         enqueueRILEvent(CMD_QUEUE_DEFAULT, pollSIMState, NULL, NULL);
+    }
     else if (strStartsWith(s, "*ESIMSR"))
         onSimStateChanged(s);
     else if (strStartsWith(s, "+CRING:")
@@ -1443,14 +1557,9 @@ static void onUnsolicited(const char *s, const char *sms_pdu)
         onNewSmsOnSIM(s);
     else if (strStartsWith(s, "+CDS:"))
         onNewStatusReport(sms_pdu);
-    else if (strStartsWith(s, "+CGEV:")) {
-        /* Really, we can ignore NW CLASS and ME CLASS events here,
-         * but right now we don't since extranous
-         * RIL_UNSOL_PDP_CONTEXT_LIST_CHANGED calls are tolerated.
-         */
-        enqueueRILEvent(CMD_QUEUE_AUXILIARY, onPDPContextListChanged,
-                        NULL, NULL);
-    } else if (strStartsWith(s, "+CIEV: 2"))
+    else if (strStartsWith(s, "+CGEV:"))
+        onCGEVReceived(s);
+    else if (strStartsWith(s, "+CIEV: 2"))
         unsolSignalStrength(s);
     else if (strStartsWith(s, "+CIEV: 10"))
         unsolSimSmsFull(s);
@@ -1602,6 +1711,13 @@ int parseGroups(char* groups, RILRequestGroup **parsedGroups)
     parsedGroups[n] = &RILRequestGroups[CMD_QUEUE_AUXILIARY];
     n++;
 
+    /* DATA group is optional and adds a third AT channel */
+    if (strcasestr(groups, RILRequestGroups[CMD_QUEUE_DATA].name)) {
+        RILRequestGroups[CMD_QUEUE_DATA].requestQueue->enabled = 1;
+        parsedGroups[n] = &RILRequestGroups[CMD_QUEUE_DATA];
+        n++;
+    }
+
 exit:
     return n;
 }
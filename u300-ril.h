@@ -74,6 +74,9 @@ typedef struct RILRequest {
     struct RILRequest *next;
 } RILRequest;
 
+RILRequest *takeQueuedRequest(int request);
+void freeQueuedRequest(RILRequest *r);
+
 typedef struct RILEvent {
     void (*eventCallback)(void *param);
     void *param;
@@ -109,11 +112,12 @@ struct queueArgs {
 
 int parseGroups(char* groups, RILRequestGroup **parsedGroups);
 
-#define RIL_MAX_NR_OF_CHANNELS 2 /* DEFAULT, AUXILIARY */
+#define RIL_MAX_NR_OF_CHANNELS 3 /* DEFAULT, AUXILIARY, DATA */
 
 enum RequestGroups {
     CMD_QUEUE_DEFAULT = 0,
-    CMD_QUEUE_AUXILIARY = 1
+    CMD_QUEUE_AUXILIARY = 1,
+    CMD_QUEUE_DATA = 2
 };
 
 #endif